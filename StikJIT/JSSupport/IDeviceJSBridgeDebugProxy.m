@@ -10,11 +10,24 @@
 #import "../idevice/JITEnableContext.h"
 #import "../idevice/idevice.h"
 #include "../idevice/jit.h"
+#include "../idevice/rsp.h"
+#include "../idevice/debug_session.h"
+#include "../idevice/memory_scan.h"
+#include "../idevice/jit_trap.h"
 
 NSString* handleJSContextSendDebugCommand(JSContext* context, NSString* commandStr, DebugProxyHandle* debugProxy) {
     DebugserverCommandHandle* command = 0;
+    DebugSession* session = debug_session_get(debugProxy);
+    const char* commandCStr = [commandStr UTF8String];
+    
+    // registers of the stopped thread are answered from the last stop reply
+    char cachedRegister[17];
+    if(debug_session_cached_register_read(session, commandCStr, cachedRegister)) {
+        return @(cachedRegister);
+    }
 
-    command = debugserver_command_new([commandStr UTF8String], NULL, 0);
+    command = debugserver_command_new(commandCStr, NULL, 0);
+    debug_session_note_command(session, commandCStr);
 
     char* attach_response = 0;
     IdeviceFfiError* err = debug_proxy_send_command(debugProxy, command, &attach_response);
@@ -27,100 +40,585 @@ NSString* handleJSContextSendDebugCommand(JSContext* context, NSString* commandS
     NSString* commandResponse = nil;
     if(attach_response) {
         commandResponse = @(attach_response);
+        debug_session_note_reply(session, commandCStr, attach_response, strlen(attach_response));
     }
     idevice_string_free(attach_response);
     return commandResponse;
 }
 
-// 0 <= val <= 15
-char u8toHexChar(uint8_t val) {
-    if(val < 10) {
-        return val + '0';
-    } else {
-        return val + 87;
-    }
-}
-
-void calcAndWriteCheckSum(char* commandStart) {
-    uint8_t sum = 0;
-    char* cur = commandStart;
-    for(; *cur != '#'; ++cur) {
-        sum += *cur;
-    }
-    cur[1] = u8toHexChar((sum & 0xf0) >> 4);
-    cur[2] = u8toHexChar(sum & 0xf);
-}
-
-// support up to 9 digit
-void writeAddress(char* writeStart, uint64_t addr) {
-    writeStart[0] = u8toHexChar((addr & 0xf00000000) >> 32);
-    writeStart[1] = u8toHexChar((addr & 0xf0000000) >> 28);
-    writeStart[2] = u8toHexChar((addr & 0xf000000) >> 24);
-    writeStart[3] = u8toHexChar((addr & 0xf00000) >> 20);
-    writeStart[4] = u8toHexChar((addr & 0xf0000) >> 16);
-    writeStart[5] = u8toHexChar((addr & 0xf000) >> 12);
-    writeStart[6] = u8toHexChar((addr & 0xf00) >> 8);
-    writeStart[7] = u8toHexChar((addr & 0xf0) >> 4);
-    writeStart[8] = u8toHexChar((addr & 0xf));
-}
-
-// you need to free generated buffer
-char* getBulkMemWriteCommand(uint64_t startAddr, uint64_t JITPagesSize, uint32_t* commandCountOut, uint32_t* bufferLengthOut) {
-    // $M10c128000,1:69#12
-    uint32_t commandCount = (uint32_t)(JITPagesSize >> 14);
-    uint32_t commandBufferSize = commandCount * 19;
-    *commandCountOut = commandCount;
-    *bufferLengthOut = commandBufferSize;
-    char* buffer = malloc(commandBufferSize + 1);
-    char* bufferEnd = buffer + commandBufferSize;
-    buffer[commandBufferSize] = 0;
+static void setConnectionException(JSContext* context, int result, IdeviceFfiError* err) {
+    if(err) {
+        context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"error code %d, msg %s", err->code, err->message] inContext:context];
+        idevice_error_free(err);
+    } else if(result == -2) {
+        context.exception = [JSValue valueWithObject:@"debugserver closed the connection" inContext:context];
+    }
+}
+
+static void freeArrayBufferBytes(void* bytes, void* deallocatorContext) {
+    free(bytes);
+}
+
+// wraps a malloc'd buffer in an ArrayBuffer that frees it, no copy is made
+static JSValue* makeArrayBuffer(JSContext* context, uint8_t* bytes, size_t length) {
+    JSValueRef exception = NULL;
+    JSObjectRef buffer = JSObjectMakeArrayBufferWithBytesNoCopy(context.JSGlobalContextRef, bytes, length, freeArrayBufferBytes, NULL, &exception);
+    if(exception) {
+        free(bytes);
+        context.exception = [JSValue valueWithJSValueRef:exception inContext:context];
+        return nil;
+    }
+    return [JSValue valueWithJSValueRef:buffer inContext:context];
+}
+
+// sends a command and reads its reply, run-length expanded and checksum verified. with hex set the reply's
+// hex digits are converted to bytes. returns a malloc'd buffer, or nil with context.exception set
+static uint8_t* sendCommandForReply(JSContext* context, const char* command, bool hex, size_t* lengthOut, DebugProxyHandle* debugProxy) {
+    size_t commandLength = strlen(command);
+    debug_session_note_command(debug_session_get(debugProxy), command);
+    char* packet = malloc(commandLength + 4);
+    size_t packetLength = rsp_build_packet(packet, command, commandLength);
+    IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, (const uint8_t*)packet, packetLength);
+    free(packet);
+    if(err) {
+        setConnectionException(context, -1, err);
+        return nil;
+    }
     
-    uint64_t curAddr = startAddr;
-    for(char* curBufferPtr = buffer; curBufferPtr < bufferEnd; curBufferPtr += 19) {
-        curBufferPtr[0] = '$';
-        curBufferPtr[1] = 'M';
-        curBufferPtr[11] = ',';
-        curBufferPtr[12] = '1';
-        curBufferPtr[13] = ':';
-        curBufferPtr[14] = '6';
-        curBufferPtr[15] = '9';
-        curBufferPtr[16] = '#';
-        writeAddress(curBufferPtr + 2, curAddr);
-        calcAndWriteCheckSum(curBufferPtr + 1);
-        curAddr += 16384;
-    }
-    return buffer;
+    char* reply = 0;
+    size_t replyLength = 0;
+    int ret = rsp_read_reply(debugProxy, &reply, &replyLength, &err);
+    if(ret) {
+        setConnectionException(context, ret, err);
+        return nil;
+    }
+    const char* payload = reply + 1;
+    size_t payloadLength = replyLength - 4;
+    size_t capacity = rsp_expanded_length(payload, payloadLength);
+    if(hex) {
+        capacity /= 2;
+    }
+    uint8_t* bytes = malloc(capacity ? capacity : 1);
+    int64_t decoded = rsp_decode_payload(bytes, capacity, payload, payloadLength, payload + payloadLength + 1, hex);
+    if(decoded < 0) {
+        context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"%s reply: %.*s", decoded == RSP_DECODE_BAD_CHECKSUM ? "checksum mismatch in" : "malformed", (int)(payloadLength < 64 ? payloadLength : 64), payload] inContext:context];
+        free(reply);
+        free(bytes);
+        return nil;
+    }
+    free(reply);
+    *lengthOut = (size_t)decoded;
+    return bytes;
+}
+
+// sends a command and returns its reply as an ArrayBuffer, run-length expanded and checksum verified.
+// with hex set the reply's hex digits are converted to bytes (for m, p, g...), otherwise its raw payload is returned
+JSValue* handleJSSendDebugCommandBinary(JSContext* context, NSString* commandStr, JSValue* hexValue, DebugProxyHandle* debugProxy) {
+    bool hex = hexValue.isUndefined || hexValue.isNull || [hexValue toBool];
+    size_t length = 0;
+    uint8_t* bytes = sendCommandForReply(context, commandStr.UTF8String, hex, &length, debugProxy);
+    if(!bytes) {
+        return nil;
+    }
+    return makeArrayBuffer(context, bytes, length);
 }
 
 NSString* handleJITPageWrite(JSContext* context, uint64_t startAddr, uint64_t JITPagesSize, DebugProxyHandle* debugProxy) {
-    uint32_t bufferLength = 0;
-    uint32_t commandCount = 0;
-    char* commandBuffer = getBulkMemWriteCommand(startAddr, JITPagesSize, &commandCount, &bufferLength);
-    // we send 1024 commands at a time
-    for(int curCommand = 0; curCommand < commandCount; curCommand += 1024) {
-        uint32_t commandsToSend = (commandCount - curCommand > 1024) ? 1024 : (commandCount - curCommand);
-        IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, (const uint8_t *)commandBuffer + curCommand * 19, commandsToSend * 19);
-        if(err) {
-            context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"error code %d, msg %s", err->code, err->message] inContext:context];
-            free(commandBuffer);
-            idevice_error_free(err);
+    uint64_t pageSize = vm_page_size;
+    RspMemoryRegion region = { .start = startAddr, .size = JITPagesSize };
+    IdeviceFfiError* err = 0;
+    int result = rsp_prepare_memory_regions(debugProxy, &region, 1, pageSize, NULL, &err);
+    if(result) {
+        setConnectionException(context, result, err);
+        return nil;
+    }
+    if(region.failedPage >= 0) {
+        context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"failed to prepare page at 0x%llx: %s", startAddr + (uint64_t)region.failedPage * pageSize, region.error] inContext:context];
+        return nil;
+    }
+    return @"OK";
+}
+
+// regions is an array of [start, size] pairs or {start, size} objects
+JSValue* handleJITPageWriteRegions(JSContext* context, JSValue* regions, DebugProxyHandle* debugProxy) {
+    NSArray* regionArray = [regions toArray];
+    if(![regionArray isKindOfClass:NSArray.class]) {
+        context.exception = [JSValue valueWithObject:@"regions should be an array." inContext:context];
+        return nil;
+    }
+    
+    uint64_t pageSize = vm_page_size;
+    size_t regionCount = regionArray.count;
+    RspMemoryRegion* rspRegions = calloc(regionCount ? regionCount : 1, sizeof(RspMemoryRegion));
+    for(size_t i = 0; i < regionCount; ++i) {
+        id item = regionArray[i];
+        NSNumber* start = nil;
+        NSNumber* size = nil;
+        if([item isKindOfClass:NSArray.class] && [item count] == 2) {
+            start = item[0];
+            size = item[1];
+        } else if([item isKindOfClass:NSDictionary.class]) {
+            start = item[@"start"];
+            size = item[@"size"];
+        }
+        if(![start isKindOfClass:NSNumber.class] || ![size isKindOfClass:NSNumber.class]) {
+            context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"region %zu should be [start, size] or {start, size}.", i] inContext:context];
+            free(rspRegions);
             return nil;
         }
-        
-        for(int i = 0; i < commandsToSend; ++i) {
-            char* response = 0;
-            IdeviceFfiError* err = debug_proxy_read_response(debugProxy, &response);
-            if(response) {
-                idevice_string_free(response);
-            }
-            if(err) {
-                context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"error code %d, msg %s", err->code, err->message] inContext:context];
-                free(commandBuffer);
-                idevice_error_free(err);
-                return nil;
+        rspRegions[i].start = start.unsignedLongLongValue;
+        rspRegions[i].size = size.unsignedLongLongValue;
+    }
+    
+    RspPrepareStats stats = {0};
+    IdeviceFfiError* err = 0;
+    int result = rsp_prepare_memory_regions(debugProxy, rspRegions, regionCount, pageSize, &stats, &err);
+    if(result) {
+        setConnectionException(context, result, err);
+        free(rspRegions);
+        return nil;
+    }
+    
+    NSMutableArray* regionResults = [NSMutableArray arrayWithCapacity:regionCount];
+    for(size_t i = 0; i < regionCount; ++i) {
+        RspMemoryRegion* region = &rspRegions[i];
+        if(region->failedPage < 0) {
+            [regionResults addObject:@{ @"start": @(region->start), @"size": @(region->size), @"status": @"OK" }];
+        } else {
+            [regionResults addObject:@{
+                @"start": @(region->start),
+                @"size": @(region->size),
+                @"status": @(region->error),
+                @"failedAddress": @(region->start + (uint64_t)region->failedPage * pageSize)
+            }];
+        }
+    }
+    free(rspRegions);
+    DebugSession* session = debug_session_get(debugProxy);
+    return [JSValue valueWithObject:@{
+        @"regions": regionResults,
+        @"commandCount": @(stats.commandCount),
+        @"skippedCount": @(stats.skippedCount),
+        @"sessionSkippedCount": @(session ? session->preparedPages.skippedTotal : 0),
+        @"bytesSent": @(stats.bytesSent),
+        @"bytesReceived": @(stats.bytesReceived),
+        @"window": @(stats.window),
+        @"minRttMicros": @(stats.minRttMicros)
+    } inContext:context];
+}
+
+// data is an ArrayBuffer or a typed array, its bytes are written to addr as is
+JSValue* handleJSWriteMemory(JSContext* context, uint64_t addr, JSValue* data, JSValue* allowBinary, DebugProxyHandle* debugProxy) {
+    JSContextRef ctx = context.JSGlobalContextRef;
+    JSValueRef exception = NULL;
+    JSTypedArrayType arrayType = JSValueGetTypedArrayType(ctx, data.JSValueRef, &exception);
+    const uint8_t* bytes = NULL;
+    size_t length = 0;
+    if(arrayType == kJSTypedArrayTypeArrayBuffer) {
+        JSObjectRef object = JSValueToObject(ctx, data.JSValueRef, &exception);
+        bytes = JSObjectGetArrayBufferBytesPtr(ctx, object, &exception);
+        length = JSObjectGetArrayBufferByteLength(ctx, object, &exception);
+    } else if(arrayType != kJSTypedArrayTypeNone) {
+        JSObjectRef object = JSValueToObject(ctx, data.JSValueRef, &exception);
+        bytes = (const uint8_t*)JSObjectGetTypedArrayBytesPtr(ctx, object, &exception) + JSObjectGetTypedArrayByteOffset(ctx, object, &exception);
+        length = JSObjectGetTypedArrayByteLength(ctx, object, &exception);
+    }
+    if(exception || !bytes) {
+        context.exception = [JSValue valueWithObject:@"data should be an ArrayBuffer or a typed array." inContext:context];
+        return nil;
+    }
+    
+    // binary X packets unless the script asks for hex M packets with false
+    bool binary = allowBinary.isUndefined || allowBinary.toBool;
+    RspWriteResult result;
+    IdeviceFfiError* err = 0;
+    uint64_t startTime = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    int ret = rsp_write_memory(debugProxy, addr, bytes, length, binary, &result, &err);
+    uint64_t elapsedMicros = (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - startTime) / 1000;
+    if(ret == -3) {
+        context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"failed to write memory at 0x%llx: %s", addr + (uint64_t)result.failedOffset, result.error] inContext:context];
+        return nil;
+    } else if(ret) {
+        setConnectionException(context, ret, err);
+        return nil;
+    }
+    return [JSValue valueWithObject:@{
+        @"bytesWritten": @(length),
+        @"binary": @(result.binary),
+        @"packetCount": @(result.packetCount),
+        @"bytesSent": @(result.bytesSent),
+        @"bytesReceived": @(result.bytesReceived),
+        @"micros": @(elapsedMicros)
+    } inContext:context];
+}
+
+static void setReadException(JSContext* context, int ret, uint64_t addr, RspReadResult* result, IdeviceFfiError* err) {
+    if(ret == -3) {
+        context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"failed to read memory at 0x%llx: %s", addr + (uint64_t)result->failedOffset, result->error[0] ? result->error : "short read"] inContext:context];
+    } else if(ret == -4) {
+        context.exception = [JSValue valueWithObject:@"failed to read memory: malformed reply" inContext:context];
+    } else {
+        setConnectionException(context, ret, err);
+    }
+}
+
+static bool copyToBufferSink(void* userData, uint64_t offset, const uint8_t* data, size_t length) {
+    memcpy((uint8_t*)userData + offset, data, length);
+    return true;
+}
+
+// returns an ArrayBuffer with the memory at [addr, addr + length)
+JSValue* handleJSReadMemory(JSContext* context, uint64_t addr, uint64_t length, DebugProxyHandle* debugProxy) {
+    uint8_t* bytes = malloc(length ? length : 1);
+    if(!bytes) {
+        context.exception = [JSValue valueWithObject:@"not enough memory for the read." inContext:context];
+        return nil;
+    }
+    RspReadResult result;
+    IdeviceFfiError* err = 0;
+    int ret = rsp_read_memory(debugProxy, addr, length, copyToBufferSink, bytes, &result, &err);
+    if(ret) {
+        free(bytes);
+        setReadException(context, ret, addr, &result, err);
+        return nil;
+    }
+    return makeArrayBuffer(context, bytes, length);
+}
+
+static bool writeToFileSink(void* userData, uint64_t offset, const uint8_t* data, size_t length) {
+    return fwrite(data, 1, length, (FILE*)userData) == length;
+}
+
+// streams [addr, addr + length) into path, relative paths are resolved against Documents
+JSValue* handleJSDumpMemory(JSContext* context, uint64_t addr, uint64_t length, NSString* path, DebugProxyHandle* debugProxy) {
+    if(!path.isAbsolutePath) {
+        NSURL* docPathUrl = [NSFileManager.defaultManager URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask].firstObject;
+        path = [docPathUrl URLByAppendingPathComponent:path].path;
+    }
+    FILE* file = fopen(path.fileSystemRepresentation, "wb");
+    if(!file) {
+        context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"failed to open %@: %s", path, strerror(errno)] inContext:context];
+        return nil;
+    }
+    RspReadResult result;
+    IdeviceFfiError* err = 0;
+    uint64_t startTime = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    int ret = rsp_read_memory(debugProxy, addr, length, writeToFileSink, file, &result, &err);
+    uint64_t elapsedMicros = (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - startTime) / 1000;
+    fclose(file);
+    if(ret) {
+        setReadException(context, ret, addr, &result, err);
+        return nil;
+    }
+    return [JSValue valueWithObject:@{
+        @"path": path,
+        @"bytesRead": @(result.bytesRead),
+        @"packetCount": @(result.packetCount),
+        @"bytesSent": @(result.bytesSent),
+        @"bytesReceived": @(result.bytesReceived),
+        @"micros": @(elapsedMicros)
+    } inContext:context];
+}
+
+static NSDictionary* mappedRegionObject(const MappedRegion* region) {
+    char permissions[4] = {
+        region->permissions & MAPPED_REGION_READ ? 'r' : '-',
+        region->permissions & MAPPED_REGION_WRITE ? 'w' : '-',
+        region->permissions & MAPPED_REGION_EXECUTE ? 'x' : '-',
+        0
+    };
+    return @{ @"start": @(region->start), @"size": @(region->size), @"permissions": @(permissions) };
+}
+
+// the session's region map, scanned now if it was never scanned or may be stale.
+// the debug run owns the session, scripts only ever borrow it
+static const RegionMap* currentRegionMap(JSContext* context, bool refresh, DebugProxyHandle* debugProxy) {
+    DebugSession* session = debug_session_get(debugProxy);
+    if(!session) {
+        context.exception = [JSValue valueWithObject:@"no debug session on this connection" inContext:context];
+        return nil;
+    }
+    const RegionMap* map = 0;
+    IdeviceFfiError* err = 0;
+    int ret = debug_session_region_map(session, refresh, &map, &err);
+    if(ret == -3) {
+        context.exception = [JSValue valueWithObject:@"debugserver doesn't support qMemoryRegionInfo" inContext:context];
+        return nil;
+    } else if(ret) {
+        setConnectionException(context, ret, err);
+        return nil;
+    }
+    return map;
+}
+
+// every mapped region of the process as {start, size, permissions}, sorted by address. the array's
+// truncated property is true when the walk stopped early and regions above the last one are missing
+JSValue* handleJSGetMemoryRegions(JSContext* context, JSValue* refresh, DebugProxyHandle* debugProxy) {
+    const RegionMap* map = currentRegionMap(context, [refresh toBool], debugProxy);
+    if(!map) {
+        return nil;
+    }
+    NSMutableArray* regions = [NSMutableArray arrayWithCapacity:map->count];
+    for(size_t i = 0; i < map->count; ++i) {
+        [regions addObject:mappedRegionObject(&map->regions[i])];
+    }
+    JSValue* value = [JSValue valueWithObject:regions inContext:context];
+    value[@"truncated"] = @(map->truncated);
+    return value;
+}
+
+// region containing addr, null if it isn't mapped
+JSValue* handleJSFindMemoryRegion(JSContext* context, uint64_t addr, DebugProxyHandle* debugProxy) {
+    const RegionMap* map = currentRegionMap(context, false, debugProxy);
+    if(!map) {
+        return nil;
+    }
+    const MappedRegion* region = region_map_lookup(map, addr);
+    if(!region) {
+        return [JSValue valueWithNullInContext:context];
+    }
+    return [JSValue valueWithObject:mappedRegionObject(region) inContext:context];
+}
+
+// searches readable memory for pattern ("48 8b ?? ?? 05 4?"). options is optional: {start, end, maxHits}
+JSValue* handleJSScanMemory(JSContext* context, NSString* patternStr, JSValue* options, DebugProxyHandle* debugProxy) {
+    ScanPattern pattern;
+    if(!scan_pattern_parse(patternStr.UTF8String, &pattern)) {
+        context.exception = [JSValue valueWithObject:@"pattern should be hex bytes separated by spaces, with ?? for any byte." inContext:context];
+        return nil;
+    }
+    uint64_t start = 0;
+    uint64_t end = UINT64_MAX;
+    size_t maxHits = 0;
+    if(options.isObject) {
+        if([options hasProperty:@"start"]) {
+            start = [options[@"start"] toNumber].unsignedLongLongValue;
+        }
+        if([options hasProperty:@"end"]) {
+            end = [options[@"end"] toNumber].unsignedLongLongValue;
+        }
+        if([options hasProperty:@"maxHits"]) {
+            maxHits = [options[@"maxHits"] toNumber].unsignedLongValue;
+        }
+    }
+    const RegionMap* map = currentRegionMap(context, false, debugProxy);
+    if(!map) {
+        scan_pattern_free(&pattern);
+        return nil;
+    }
+    
+    ScanResult result;
+    IdeviceFfiError* err = 0;
+    uint64_t startTime = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    int ret = memory_scan(debugProxy, map, start, end, &pattern, vm_page_size, maxHits, &result, &err);
+    uint64_t elapsedMicros = (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - startTime) / 1000;
+    scan_pattern_free(&pattern);
+    if(ret) {
+        free(result.hits);
+        setConnectionException(context, ret, err);
+        return nil;
+    }
+    NSMutableArray* hits = [NSMutableArray arrayWithCapacity:result.hitCount];
+    for(size_t i = 0; i < result.hitCount; ++i) {
+        [hits addObject:@(result.hits[i])];
+    }
+    free(result.hits);
+    return [JSValue valueWithObject:@{
+        @"hits": hits,
+        @"bytesScanned": @(result.bytesScanned),
+        @"regionCount": @(result.regionCount),
+        @"failedRegionCount": @(result.failedRegionCount),
+        @"unreadableBytes": @(result.unreadableBytes),
+        @"regionsTruncated": @(map->truncated),
+        @"packetCount": @(result.packetCount),
+        @"bytesReceived": @(result.bytesReceived),
+        @"micros": @(elapsedMicros)
+    } inContext:context];
+}
+
+// continues the attached process and services its JIT traps natively. returns when it detaches, exits or stops
+// for something else: {outcome: "detached" | "stopped" | "exited", stop, trapCount, ...}, where stop is the
+// last stop reply, to be handled by the script before calling again
+JSValue* handleJSRunJITTrapLoop(JSContext* context, DebugProxyHandle* debugProxy) {
+    JitTrapStats stats;
+    StopReply stop;
+    char stopText[2048] = {0};
+    int outcome = JIT_TRAP_UNHANDLED_STOP;
+    IdeviceFfiError* err = 0;
+    int ret = jit_trap_loop(debugProxy, vm_page_size, &stats, &stop, stopText, sizeof(stopText), &outcome, &err);
+    if(ret == -3) {
+        context.exception = [JSValue valueWithObject:[NSString stringWithFormat:@"debugserver refused a request while handling the trap at %s", stopText] inContext:context];
+        return nil;
+    } else if(ret) {
+        setConnectionException(context, ret, err);
+        return nil;
+    }
+    NSString* outcomeName = outcome == JIT_TRAP_DETACHED ? @"detached" : outcome == JIT_TRAP_EXITED ? @"exited" : @"stopped";
+    return [JSValue valueWithObject:@{
+        @"outcome": outcomeName,
+        @"stop": @(stopText),
+        @"stopCount": @(stats.stopCount),
+        @"trapCount": @(stats.trapCount),
+        @"prepareCount": @(stats.prepareCount),
+        @"preparedBytes": @(stats.preparedBytes),
+        @"instructionReads": @(stats.instructionReads),
+        @"averageTrapMicros": @(stats.trapCount ? stats.totalMicros / stats.trapCount : 0),
+        @"minTrapMicros": @(stats.minMicros),
+        @"maxTrapMicros": @(stats.maxMicros)
+    } inContext:context];
+}
+
+// the last stop as {kind, signal, thread, exceptionType, registers: {number: value}}, null while the process runs
+JSValue* handleJSGetStopInfo(JSContext* context, DebugProxyHandle* debugProxy) {
+    DebugSession* session = debug_session_get(debugProxy);
+    if(!session || !session->hasStop) {
+        return [JSValue valueWithNullInContext:context];
+    }
+    const StopReply* stop = &session->stop;
+    NSMutableDictionary* registers = [NSMutableDictionary dictionaryWithCapacity:stop->registerCount];
+    for(uint32_t i = 0; i < stop->registerCount; ++i) {
+        if(stop->registers[i].size <= 8) {
+            registers[[NSString stringWithFormat:@"%u", stop->registers[i].number]] = @(stop->registers[i].value);
+        }
+    }
+    NSMutableDictionary* info = [@{
+        @"kind": [NSString stringWithFormat:@"%c", stop->kind],
+        @"signal": @(stop->signal),
+        @"exceptionType": @(stop->exceptionType),
+        @"registers": registers,
+        @"registerCacheHits": @(session->registerCacheHits)
+    } mutableCopy];
+    if(stop->hasThread) {
+        info[@"thread"] = @(stop->thread);
+    }
+    return [JSValue valueWithObject:info inContext:context];
+}
+
+// arm64 register numbers in debugserver's numbering
+#define THREAD_REGISTER_FP 29
+#define THREAD_REGISTER_LR 30
+#define THREAD_REGISTER_SP 31
+#define THREAD_REGISTER_PC 32
+
+static NSNumber* threadRegisterValue(NSDictionary* registers, int number) {
+    NSString* hex = registers[[NSString stringWithFormat:@"%d", number]];
+    if(![hex isKindOfClass:NSString.class]) {
+        return nil;
+    }
+    const char* hexCStr = hex.UTF8String;
+    return @(stop_reply_le_value(hexCStr, strlen(hexCStr)));
+}
+
+// one compact {tid, name, reason, signal, pc, sp, fp, lr, queue} per jThreadsInfo entry
+static NSArray* threadsFromThreadsInfo(NSArray* threadsInfo) {
+    NSMutableArray* threads = [NSMutableArray arrayWithCapacity:threadsInfo.count];
+    for(NSDictionary* info in threadsInfo) {
+        if(![info isKindOfClass:NSDictionary.class] || ![info[@"tid"] isKindOfClass:NSNumber.class]) {
+            continue;
+        }
+        NSMutableDictionary* thread = [NSMutableDictionary dictionaryWithObject:info[@"tid"] forKey:@"tid"];
+        for(NSString* key in @[@"name", @"reason", @"signal", @"description"]) {
+            if(info[key]) {
+                thread[key] = info[key];
             }
         }
+        if(info[@"qname"]) {
+            thread[@"queue"] = info[@"qname"];
+        }
+        NSDictionary* registers = info[@"registers"];
+        if([registers isKindOfClass:NSDictionary.class]) {
+            thread[@"pc"] = threadRegisterValue(registers, THREAD_REGISTER_PC);
+            thread[@"sp"] = threadRegisterValue(registers, THREAD_REGISTER_SP);
+            thread[@"fp"] = threadRegisterValue(registers, THREAD_REGISTER_FP);
+            thread[@"lr"] = threadRegisterValue(registers, THREAD_REGISTER_LR);
+        }
+        [threads addObject:thread];
     }
-    free(commandBuffer);
-    return @"OK";
+    return threads;
+}
+
+// debugservers without jThreadsInfo: list the threads with qfThreadInfo/qsThreadInfo, then read every
+// thread's pc with one pipelined batch of p packets
+static NSArray* threadsFromThreadList(JSContext* context, DebugProxyHandle* debugProxy) {
+    NSMutableArray* tids = [NSMutableArray array];
+    const char* listCommand = "qfThreadInfo";
+    while(true) {
+        size_t length = 0;
+        char* reply = (char*)sendCommandForReply(context, listCommand, false, &length, debugProxy);
+        if(!reply) {
+            return nil;
+        }
+        NSString* list = [[NSString alloc] initWithBytes:reply length:length encoding:NSUTF8StringEncoding];
+        free(reply);
+        if(![list hasPrefix:@"m"]) {
+            break;
+        }
+        for(NSString* tid in [[list substringFromIndex:1] componentsSeparatedByString:@","]) {
+            [tids addObject:@(strtoull(tid.UTF8String, NULL, 16))];
+        }
+        listCommand = "qsThreadInfo";
+    }
+    if(tids.count == 0) {
+        return tids;
+    }
+    
+    NSMutableData* batch = [NSMutableData data];
+    for(NSNumber* tid in tids) {
+        char command[64];
+        char packet[68];
+        int commandLength = snprintf(command, sizeof(command), "p%x;thread:%llx;", THREAD_REGISTER_PC, tid.unsignedLongLongValue);
+        [batch appendBytes:packet length:rsp_build_packet(packet, command, commandLength)];
+    }
+    IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, batch.bytes, batch.length);
+    if(err) {
+        setConnectionException(context, -1, err);
+        return nil;
+    }
+    NSMutableArray* threads = [NSMutableArray arrayWithCapacity:tids.count];
+    RspPacketReader reader;
+    rsp_reader_init(&reader, 4096);
+    for(NSNumber* tid in tids) {
+        const char* payload = 0;
+        size_t payloadLength = 0;
+        int ret = rsp_reader_next(debugProxy, &reader, &payload, &payloadLength, &err);
+        if(ret) {
+            rsp_reader_free(&reader);
+            setConnectionException(context, ret, err);
+            return nil;
+        }
+        NSMutableDictionary* thread = [NSMutableDictionary dictionaryWithObject:tid forKey:@"tid"];
+        char value[16];
+        int64_t valueLength = rsp_decode_payload((uint8_t*)value, sizeof(value), payload, payloadLength, payload + payloadLength + 1, false);
+        if(valueLength > 0 && value[0] != 'E') {
+            thread[@"pc"] = @(stop_reply_le_value(value, (size_t)valueLength));
+        }
+        [threads addObject:thread];
+    }
+    rsp_reader_free(&reader);
+    return threads;
+}
+
+// every thread of the stopped process with its pc, sp, fp, lr and stop reason, fetched in one jThreadsInfo request
+JSValue* handleJSGetThreads(JSContext* context, DebugProxyHandle* debugProxy) {
+    size_t length = 0;
+    uint8_t* reply = sendCommandForReply(context, "jThreadsInfo", false, &length, debugProxy);
+    if(!reply) {
+        return nil;
+    }
+    NSData* json = [NSData dataWithBytesNoCopy:reply length:length freeWhenDone:YES];
+    NSArray* threads = nil;
+    if(length > 0 && reply[0] == '[') {
+        NSArray* threadsInfo = [NSJSONSerialization JSONObjectWithData:json options:0 error:nil];
+        if([threadsInfo isKindOfClass:NSArray.class]) {
+            threads = threadsFromThreadsInfo(threadsInfo);
+        }
+    }
+    if(!threads) {
+        // empty or error reply: not supported by this debugserver
+        threads = threadsFromThreadList(context, debugProxy);
+        if(!threads) {
+            return nil;
+        }
+    }
+    return [JSValue valueWithObject:threads inContext:context];
 }
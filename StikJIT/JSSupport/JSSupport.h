@@ -9,4 +9,15 @@
 #include "../idevice/jit.h"
 
 NSString* handleJSContextSendDebugCommand(JSContext* context, NSString* commandStr, DebugProxyHandle* debugProxy);
+JSValue* handleJSSendDebugCommandBinary(JSContext* context, NSString* commandStr, JSValue* hexValue, DebugProxyHandle* debugProxy);
 NSString* handleJITPageWrite(JSContext* context, uint64_t startAddr, uint64_t JITPagesSize, DebugProxyHandle* debugProxy);
+JSValue* handleJITPageWriteRegions(JSContext* context, JSValue* regions, DebugProxyHandle* debugProxy);
+JSValue* handleJSWriteMemory(JSContext* context, uint64_t addr, JSValue* data, JSValue* allowBinary, DebugProxyHandle* debugProxy);
+JSValue* handleJSReadMemory(JSContext* context, uint64_t addr, uint64_t length, DebugProxyHandle* debugProxy);
+JSValue* handleJSDumpMemory(JSContext* context, uint64_t addr, uint64_t length, NSString* path, DebugProxyHandle* debugProxy);
+JSValue* handleJSGetMemoryRegions(JSContext* context, JSValue* refresh, DebugProxyHandle* debugProxy);
+JSValue* handleJSFindMemoryRegion(JSContext* context, uint64_t addr, DebugProxyHandle* debugProxy);
+JSValue* handleJSScanMemory(JSContext* context, NSString* patternStr, JSValue* options, DebugProxyHandle* debugProxy);
+JSValue* handleJSRunJITTrapLoop(JSContext* context, DebugProxyHandle* debugProxy);
+JSValue* handleJSGetStopInfo(JSContext* context, DebugProxyHandle* debugProxy);
+JSValue* handleJSGetThreads(JSContext* context, DebugProxyHandle* debugProxy);
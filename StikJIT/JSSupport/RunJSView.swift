@@ -45,6 +45,19 @@ class RunJSViewModel: ObservableObject {
             return handleJSContextSendDebugCommand(self.context, commandStr, self.debugProxy) ?? ""
         }
         
+        let sendCommandBinaryFunction: @convention(block) (String?, JSValue) -> JSValue? = { commandStr, hex in
+            guard let commandStr else {
+                self.context?.exception = JSValue(object: "Command should not be nil.", in: self.context!)
+                return nil
+            }
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            
+            return handleJSSendDebugCommandBinary(self.context, commandStr, hex, self.debugProxy)
+        }
+        
         let logFunction: @convention(block) (String) -> Void = { logStr in
             DispatchQueue.main.async {
                 self.logs.append(logStr)
@@ -55,6 +68,86 @@ class RunJSViewModel: ObservableObject {
             return handleJITPageWrite(self.context, startAddr, regionSize, self.debugProxy) ?? ""
         }
         
+        let prepareMemoryRegionsFunction: @convention(block) (JSValue) -> JSValue? = { regions in
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJITPageWriteRegions(self.context, regions, self.debugProxy)
+        }
+        
+        let writeMemoryFunction: @convention(block) (UInt64, JSValue, JSValue) -> JSValue? = { addr, data, allowBinary in
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSWriteMemory(self.context, addr, data, allowBinary, self.debugProxy)
+        }
+        
+        let readMemoryFunction: @convention(block) (UInt64, UInt64) -> JSValue? = { addr, length in
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSReadMemory(self.context, addr, length, self.debugProxy)
+        }
+        
+        let dumpMemoryFunction: @convention(block) (UInt64, UInt64, String) -> JSValue? = { addr, length, path in
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSDumpMemory(self.context, addr, length, path, self.debugProxy)
+        }
+        
+        let getMemoryRegionsFunction: @convention(block) (JSValue) -> JSValue? = { refresh in
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSGetMemoryRegions(self.context, refresh, self.debugProxy)
+        }
+        
+        let findMemoryRegionFunction: @convention(block) (UInt64) -> JSValue? = { addr in
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSFindMemoryRegion(self.context, addr, self.debugProxy)
+        }
+        
+        let scanMemoryFunction: @convention(block) (String, JSValue) -> JSValue? = { pattern, options in
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSScanMemory(self.context, pattern, options, self.debugProxy)
+        }
+        
+        let runJITTrapLoopFunction: @convention(block) () -> JSValue? = {
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSRunJITTrapLoop(self.context, self.debugProxy)
+        }
+        
+        let getStopInfoFunction: @convention(block) () -> JSValue? = {
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSGetStopInfo(self.context, self.debugProxy)
+        }
+        
+        let getThreadsFunction: @convention(block) () -> JSValue? = {
+            if self.executionInterrupted {
+                self.context?.exception = JSValue(object: "Script execution is interrupted by StikDebug.", in: self.context!)
+                return nil
+            }
+            return handleJSGetThreads(self.context, self.debugProxy)
+        }
+        
         let hasTXMFunction: @convention(block) () -> Bool = {
             return ProcessInfo.processInfo.hasTXM
         }
@@ -63,7 +156,18 @@ class RunJSViewModel: ObservableObject {
         context?.setObject(hasTXMFunction, forKeyedSubscript: "hasTXM" as NSString)
         context?.setObject(getPidFunction, forKeyedSubscript: "get_pid" as NSString)
         context?.setObject(sendCommandFunction, forKeyedSubscript: "send_command" as NSString)
+        context?.setObject(sendCommandBinaryFunction, forKeyedSubscript: "send_command_binary" as NSString)
         context?.setObject(prepareMemoryRegionFunction, forKeyedSubscript: "prepare_memory_region" as NSString)
+        context?.setObject(prepareMemoryRegionsFunction, forKeyedSubscript: "prepare_memory_regions" as NSString)
+        context?.setObject(writeMemoryFunction, forKeyedSubscript: "write_memory" as NSString)
+        context?.setObject(readMemoryFunction, forKeyedSubscript: "read_memory" as NSString)
+        context?.setObject(dumpMemoryFunction, forKeyedSubscript: "dump_memory" as NSString)
+        context?.setObject(getMemoryRegionsFunction, forKeyedSubscript: "get_memory_regions" as NSString)
+        context?.setObject(findMemoryRegionFunction, forKeyedSubscript: "find_memory_region" as NSString)
+        context?.setObject(scanMemoryFunction, forKeyedSubscript: "scan_memory" as NSString)
+        context?.setObject(runJITTrapLoopFunction, forKeyedSubscript: "run_jit_trap_loop" as NSString)
+        context?.setObject(getStopInfoFunction, forKeyedSubscript: "get_stop_info" as NSString)
+        context?.setObject(getThreadsFunction, forKeyedSubscript: "get_threads" as NSString)
         context?.setObject(logFunction, forKeyedSubscript: "log" as NSString)
         
         context?.evaluateScript(scriptContent)
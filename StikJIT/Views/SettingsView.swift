@@ -13,6 +13,9 @@ struct SettingsView: View {
     @AppStorage("selectedAppIcon") private var selectedAppIcon: String = "AppIcon"
     @AppStorage("useDefaultScript") private var useDefaultScript = false
     @AppStorage("enableAdvancedOptions") private var enableAdvancedOptions = false
+    @AppStorage("debugLaunchMode") private var debugLaunchMode = 0
+    @AppStorage("launchArguments") private var launchArguments = ""
+    @AppStorage("launchEnvironment") private var launchEnvironment = ""
 
     @State private var isShowingPairingFilePicker = false
     @Environment(\.colorScheme) private var colorScheme
@@ -280,6 +283,29 @@ struct SettingsView: View {
                                                    Toggle("Run Default Script After Connecting", isOn: $useDefaultScript)
                                                        .foregroundColor(.primary)
                                                        .padding(.vertical, 6)
+
+                                                   Picker("Launch Mode", selection: $debugLaunchMode) {
+                                                       Text("Process Control").tag(0)
+                                                       Text("Attach on Launch").tag(1)
+                                                       Text("Launch via debugserver").tag(2)
+                                                   }
+                                                   .foregroundColor(.primary)
+                                                   .padding(.vertical, 6)
+
+                                                   // only debugserver launches pass them on
+                                                   if debugLaunchMode == 2 {
+                                                       TextField("Launch Arguments (one per line)", text: $launchArguments, axis: .vertical)
+                                                           .textInputAutocapitalization(.never)
+                                                           .autocorrectionDisabled()
+                                                           .foregroundColor(.primary)
+                                                           .padding(.vertical, 6)
+
+                                                       TextField("Environment (KEY=VALUE, one per line)", text: $launchEnvironment, axis: .vertical)
+                                                           .textInputAutocapitalization(.never)
+                                                           .autocorrectionDisabled()
+                                                           .foregroundColor(.primary)
+                                                           .padding(.vertical, 6)
+                                                   }
                                                }
                                            }
                                            .padding(.vertical, 20)
@@ -287,6 +313,7 @@ struct SettingsView: View {
                                            .onChange(of: enableAdvancedOptions) { _, newValue in
                                                if !newValue {
                                                    useDefaultScript = false
+                                                   debugLaunchMode = 0
                                                }
                                            }
                                        }
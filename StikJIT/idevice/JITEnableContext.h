@@ -19,6 +19,11 @@ typedef void (^LogFunc)(NSString *message);
 - (void)startHeartbeatWithCompletionHandler:(HeartbeatCompletionHandler)completionHandler logger:(LogFunc)logger;
 - (BOOL)debugAppWithBundleID:(NSString*)bundleID logger:(LogFunc)logger jsCallback:(DebugAppCallback)jsCallback;
 - (BOOL)debugAppWithPID:(int)pid logger:(LogFunc)logger jsCallback:(DebugAppCallback)jsCallback;
+// enables JIT for every target (NSString bundle IDs to launch, NSNumber pids to attach to) over one tunnel;
+// one result per target with "target", "success", "pid" and "timings" (as in lastDebugTimings)
+- (NSArray<NSDictionary<NSString*, id>*>*)debugAppsWithTargets:(NSArray*)targets logger:(LogFunc)logger;
+// per stage microseconds of the last debugApp call, keyed by debug_stage_name, plus "total"
+- (NSDictionary<NSString*, NSNumber*>*)lastDebugTimings;
 - (NSDictionary<NSString*, NSString*>*)getAppListWithError:(NSError**)error;
 - (UIImage*)getAppIconWithBundleId:(NSString*)bundleId error:(NSError**)error;
 @end
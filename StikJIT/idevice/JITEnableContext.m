@@ -20,6 +20,14 @@ JITEnableContext* sharedJITContext = nil;
 @implementation JITEnableContext {
     bool heartbeatRunning;
     IdeviceProviderHandle* provider;
+    // idle tunnel kept open across debug requests, only touched while holding tunnelLock.
+    // a request takes it out of here while it runs
+    DeviceTunnel tunnel;
+    bool tunnelOpen;
+    NSLock* tunnelLock;
+    // written by whichever request finishes last; requests run concurrently, so only touched while holding timingsLock
+    NSDictionary<NSString*, NSNumber*>* lastDebugTimings;
+    NSLock* timingsLock;
 }
 
 + (instancetype)shared {
@@ -34,6 +42,8 @@ JITEnableContext* sharedJITContext = nil;
     NSURL* docPathUrl = [fm URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask].firstObject;
     NSURL* logURL = [docPathUrl URLByAppendingPathComponent:@"idevice_log.txt"];
     idevice_init_logger(Info, Debug, (char*)logURL.path.UTF8String);
+    tunnelLock = [NSLock new];
+    timingsLock = [NSLock new];
     return self;
 }
 
@@ -131,6 +141,83 @@ JITEnableContext* sharedJITContext = nil;
     }
 }
 
+// stage name -> microseconds for the stages that ran, plus "total" and "failedStage" if one failed
+- (NSDictionary<NSString*, NSNumber*>*)timingsDictionary:(DebugStageTimings*)timings {
+    NSMutableDictionary<NSString*, NSNumber*>* result = [NSMutableDictionary dictionaryWithCapacity:DEBUG_STAGE_COUNT + 2];
+    for (int stage = 0; stage < DEBUG_STAGE_COUNT; stage++) {
+        if (timings->micros[stage]) {
+            result[[NSString stringWithUTF8String:debug_stage_name(stage)]] = @(timings->micros[stage]);
+        }
+    }
+    result[@"total"] = @(timings->totalMicros);
+    if (timings->failedStage != DEBUG_STAGE_COUNT) {
+        result[@"failedStage"] = @(timings->failedStage);
+    }
+    return result;
+}
+
+- (NSDictionary<NSString*, NSNumber*>*)lastDebugTimings {
+    [timingsLock lock];
+    NSDictionary<NSString*, NSNumber*>* timings = lastDebugTimings;
+    [timingsLock unlock];
+    return timings;
+}
+
+- (void)setLastDebugTimings:(DebugStageTimings*)timings {
+    NSDictionary<NSString*, NSNumber*>* dictionary = [self timingsDictionary:timings];
+    [timingsLock lock];
+    lastDebugTimings = dictionary;
+    [timingsLock unlock];
+}
+
+// runs body over the cached tunnel, (re)building it when it's missing, stale or dropped before the launch.
+// the adapter isn't thread safe, so body gets the tunnel to itself: it's taken out of the cache under
+// tunnelLock and put back afterwards, and the lock isn't held while body (and any script it runs) does
+// its work. a request arriving meanwhile builds a tunnel of its own
+- (int)runWithTunnel:(LogFuncC)logger body:(int (^)(DeviceTunnel* tunnel))body {
+    int result = DEBUG_APP_TUNNEL_FAILED;
+    for (int attempt = 0; attempt < 2 && result == DEBUG_APP_TUNNEL_FAILED; attempt++) {
+        DeviceTunnel current;
+        [tunnelLock lock];
+        if (tunnelOpen && (tunnel.provider != provider || !device_tunnel_check(&tunnel))) {
+            logger("Device tunnel is gone after %llu requests, rebuilding", tunnel.useCount);
+            device_tunnel_close(&tunnel);
+            tunnelOpen = false;
+        }
+        if (!tunnelOpen) {
+            IdeviceFfiError* err = NULL;
+            if (device_tunnel_open(provider, &tunnel, &err)) {
+                logger("Failed to open device tunnel: [%d] %s", err->code, err->message);
+                idevice_error_free(err);
+                [tunnelLock unlock];
+                result = 1;
+                break;
+            }
+            tunnelOpen = true;
+        }
+        current = tunnel;
+        tunnelOpen = false;
+        [tunnelLock unlock];
+        
+        current.useCount++;
+        result = body(&current);
+        
+        [tunnelLock lock];
+        if (result == DEBUG_APP_TUNNEL_FAILED) {
+            logger("Device tunnel is gone after %llu requests, rebuilding", current.useCount);
+            device_tunnel_close(&current);
+        } else if (tunnelOpen) {
+            // another request cached its tunnel while body ran, one idle tunnel is enough
+            device_tunnel_close(&current);
+        } else {
+            tunnel = current;
+            tunnelOpen = true;
+        }
+        [tunnelLock unlock];
+    }
+    return result;
+}
+
 - (BOOL)debugAppWithBundleID:(NSString*)bundleID logger:(LogFunc)logger jsCallback:(DebugAppCallback)jsCallback {
     if (!provider) {
         if (logger) {
@@ -142,9 +229,81 @@ JITEnableContext* sharedJITContext = nil;
     
     [self ensureHeartbeat];
     
-    return debug_app(provider,
-                     [bundleID UTF8String],
-                     [self createCLogger:logger], jsCallback) == 0;
+    NSUserDefaults* defaults = NSUserDefaults.standardUserDefaults;
+    DebugLaunchOptions options = { .mode = DEBUG_LAUNCH_PROCESS_CONTROL };
+    NS_VALID_UNTIL_END_OF_SCOPE NSArray<NSString*>* arguments = [self launchStringsForKey:@"launchArguments"];
+    NS_VALID_UNTIL_END_OF_SCOPE NSArray<NSString*>* environment = [self launchStringsForKey:@"launchEnvironment"];
+    const char** cArguments = [self cStringArray:arguments];
+    const char** cEnvironment = [self cStringArray:environment];
+    options.arguments = cArguments;
+    options.argumentCount = arguments.count;
+    options.environment = cEnvironment;
+    options.environmentCount = environment.count;
+    
+    // the app lookup goes over its own installation_proxy connection, so it runs while the tunnel is
+    // checked or rebuilt instead of in front of it
+    NSInteger mode = [defaults integerForKey:@"debugLaunchMode"];
+    __block NSDictionary<NSString*, NSString*>* launchInfo = nil;
+    __block NSString* launchInfoError = nil;
+    dispatch_group_t lookup = dispatch_group_create();
+    if ((mode == DEBUG_LAUNCH_ATTACH_WAIT || mode == DEBUG_LAUNCH_DEBUGSERVER) && !jsCallback) {
+        IdeviceProviderHandle* lookupProvider = provider;
+        dispatch_group_async(lookup, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+            NSString* errorStr = nil;
+            launchInfo = get_app_launch_info(lookupProvider, bundleID, &errorStr);
+            launchInfoError = errorStr;
+        });
+    }
+    
+    LogFuncC cLogger = [self createCLogger:logger];
+    __block DebugStageTimings timings = { .failedStage = DEBUG_STAGE_COUNT };
+    BOOL result = [self runWithTunnel:cLogger body:^int(DeviceTunnel* tunnel) {
+        uint64_t waitStart = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        dispatch_group_wait(lookup, DISPATCH_TIME_FOREVER);
+        uint64_t waitMicros = (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - waitStart) / 1000;
+        
+        DebugLaunchOptions launchOptions = options;
+        NS_VALID_UNTIL_END_OF_SCOPE NSString* executablePath = nil;
+        if (launchInfo) {
+            cLogger("App lookup overlapped tunnel setup, waited %llu us for it", waitMicros);
+            launchOptions.mode = (DebugLaunchMode)mode;
+            launchOptions.executableName = [launchInfo[@"CFBundleExecutable"] UTF8String];
+            if (launchInfo[@"Path"]) {
+                executablePath = [launchInfo[@"Path"] stringByAppendingPathComponent:launchInfo[@"CFBundleExecutable"]];
+                launchOptions.executablePath = [executablePath UTF8String];
+            }
+        } else if (launchInfoError && logger) {
+            logger([NSString stringWithFormat:@"%@, launching through ProcessControl", launchInfoError]);
+        }
+        return debug_app(tunnel,
+                         [bundleID UTF8String],
+                         &launchOptions,
+                         cLogger, jsCallback, &timings);
+    }] == 0;
+    // the tunnel may have failed before body ran
+    dispatch_group_wait(lookup, DISPATCH_TIME_FOREVER);
+    [self setLastDebugTimings:&timings];
+    free(cArguments);
+    free(cEnvironment);
+    return result;
+}
+
+// launch arguments or KEY=VALUE environment entries from settings, one per line and
+// kept verbatim so an argument or value may contain spaces
+- (NSArray<NSString*>*)launchStringsForKey:(NSString*)key {
+    NSString* value = [NSUserDefaults.standardUserDefaults stringForKey:key] ?: @"";
+    NSArray<NSString*>* parts = [value componentsSeparatedByCharactersInSet:NSCharacterSet.newlineCharacterSet];
+    return [parts filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"length > 0"]];
+}
+
+// NULL-terminated, the strings stay owned by the array
+- (const char**)cStringArray:(NSArray<NSString*>*)strings {
+    const char** result = malloc((strings.count + 1) * sizeof(char*));
+    for (NSUInteger i = 0; i < strings.count; i++) {
+        result[i] = [strings[i] UTF8String];
+    }
+    result[strings.count] = NULL;
+    return result;
 }
 
 - (BOOL)debugAppWithPID:(int)pid logger:(LogFunc)logger jsCallback:(DebugAppCallback)jsCallback {
@@ -158,9 +317,130 @@ JITEnableContext* sharedJITContext = nil;
     
     [self ensureHeartbeat];
     
-    return debug_app_pid(provider,
-                     pid,
-                     [self createCLogger:logger], jsCallback) == 0;
+    LogFuncC cLogger = [self createCLogger:logger];
+    __block DebugStageTimings timings = { .failedStage = DEBUG_STAGE_COUNT };
+    BOOL result = [self runWithTunnel:cLogger body:^int(DeviceTunnel* tunnel) {
+        return debug_app_pid(tunnel,
+                             pid,
+                             cLogger, jsCallback, &timings);
+    }] == 0;
+    [self setLastDebugTimings:&timings];
+    return result;
+}
+
+- (NSArray<NSDictionary<NSString*, id>*>*)debugAppsWithTargets:(NSArray*)targets logger:(LogFunc)logger {
+    if (!provider) {
+        if (logger) {
+            logger(@"Provider not initialized!");
+        }
+        NSLog(@"Provider not initialized!");
+        return nil;
+    }
+    
+    [self ensureHeartbeat];
+    
+    NSUserDefaults* defaults = NSUserDefaults.standardUserDefaults;
+    DebugLaunchOptions options = { .mode = DEBUG_LAUNCH_PROCESS_CONTROL };
+    NS_VALID_UNTIL_END_OF_SCOPE NSArray<NSString*>* arguments = [self launchStringsForKey:@"launchArguments"];
+    NS_VALID_UNTIL_END_OF_SCOPE NSArray<NSString*>* environment = [self launchStringsForKey:@"launchEnvironment"];
+    const char** cArguments = [self cStringArray:arguments];
+    const char** cEnvironment = [self cStringArray:environment];
+    options.arguments = cArguments;
+    options.argumentCount = arguments.count;
+    options.environment = cEnvironment;
+    options.environmentCount = environment.count;
+    
+    // one installation_proxy lookup for every app, again overlapping the tunnel
+    NSInteger mode = [defaults integerForKey:@"debugLaunchMode"];
+    NSMutableArray<NSString*>* bundleIDs = [NSMutableArray array];
+    // targets are bundle ID strings or pid numbers, anything else a script passed in is reported and skipped
+    size_t count = 0;
+    size_t* targetIndices = calloc(targets.count, sizeof(size_t));
+    for (NSUInteger i = 0; i < targets.count; i++) {
+        id target = targets[i];
+        if ([target isKindOfClass:NSString.class]) {
+            [bundleIDs addObject:target];
+        } else if (![target isKindOfClass:NSNumber.class] || [target intValue] <= 0) {
+            if (logger) {
+                logger([NSString stringWithFormat:@"Skipping target %@, expected a bundle ID or a pid", target]);
+            }
+            continue;
+        }
+        targetIndices[count++] = i;
+    }
+    __block NSDictionary<NSString*, NSDictionary<NSString*, NSString*>*>* launchInfos = nil;
+    __block NSString* launchInfoError = nil;
+    dispatch_group_t lookup = dispatch_group_create();
+    if ((mode == DEBUG_LAUNCH_ATTACH_WAIT || mode == DEBUG_LAUNCH_DEBUGSERVER) && bundleIDs.count) {
+        IdeviceProviderHandle* lookupProvider = provider;
+        dispatch_group_async(lookup, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+            NSString* errorStr = nil;
+            launchInfos = get_apps_launch_info(lookupProvider, bundleIDs, &errorStr);
+            launchInfoError = errorStr;
+        });
+    }
+    
+    LogFuncC cLogger = [self createCLogger:logger];
+    DebugTarget* debugTargets = calloc(count, sizeof(DebugTarget));
+    DebugLaunchOptions* targetOptions = calloc(count, sizeof(DebugLaunchOptions));
+    // keeps the executable names and paths alive until debug_apps returns
+    NSMutableArray<NSString*>* launchStrings = [NSMutableArray array];
+    [self runWithTunnel:cLogger body:^int(DeviceTunnel* tunnel) {
+        dispatch_group_wait(lookup, DISPATCH_TIME_FOREVER);
+        if (launchInfoError && logger) {
+            logger([NSString stringWithFormat:@"%@, launching through ProcessControl", launchInfoError]);
+        }
+        for (size_t i = 0; i < count; i++) {
+            // a retried attempt starts over
+            debugTargets[i] = (DebugTarget){ 0 };
+            targetOptions[i] = options;
+            id target = targets[targetIndices[i]];
+            if (![target isKindOfClass:NSString.class]) {
+                debugTargets[i].pid = [target intValue];
+                continue;
+            }
+            debugTargets[i].bundleId = [target UTF8String];
+            debugTargets[i].options = &targetOptions[i];
+            NSDictionary<NSString*, NSString*>* launchInfo = launchInfos[target];
+            if (!launchInfo) {
+                continue;
+            }
+            targetOptions[i].mode = (DebugLaunchMode)mode;
+            targetOptions[i].executableName = [launchInfo[@"CFBundleExecutable"] UTF8String];
+            if (launchInfo[@"Path"]) {
+                NSString* executablePath = [launchInfo[@"Path"] stringByAppendingPathComponent:launchInfo[@"CFBundleExecutable"]];
+                [launchStrings addObject:executablePath];
+                targetOptions[i].executablePath = [executablePath UTF8String];
+            }
+        }
+        return debug_apps(tunnel, debugTargets, count, cLogger);
+    }];
+    // the tunnel may have failed before body ran
+    dispatch_group_wait(lookup, DISPATCH_TIME_FOREVER);
+    
+    // one result per target in the order given, skipped targets fail without timings
+    NSMutableArray<NSDictionary<NSString*, id>*>* results = [NSMutableArray arrayWithCapacity:targets.count];
+    size_t next = 0;
+    for (NSUInteger i = 0; i < targets.count; i++) {
+        if (next == count || targetIndices[next] != i) {
+            [results addObject:@{ @"target": targets[i], @"success": @NO, @"pid": @0, @"timings": @{} }];
+            continue;
+        }
+        DebugTarget* debugTarget = &debugTargets[next++];
+        BOOL ran = debugTarget->bundleId || debugTarget->pid;
+        [results addObject:@{
+            @"target": targets[i],
+            @"success": @(ran && debugTarget->result == 0),
+            @"pid": @(debugTarget->timings.pid),
+            @"timings": [self timingsDictionary:&debugTarget->timings],
+        }];
+    }
+    free(targetIndices);
+    free(debugTargets);
+    free(targetOptions);
+    free(cArguments);
+    free(cEnvironment);
+    return results;
 }
 
 - (NSDictionary<NSString*, NSString*>*)getAppListWithError:(NSError**)error {
@@ -196,6 +476,9 @@ JITEnableContext* sharedJITContext = nil;
 }
 
 - (void)dealloc {
+    if (tunnelOpen) {
+        device_tunnel_close(&tunnel);
+    }
     if (provider) {
         idevice_provider_free(provider);
     }
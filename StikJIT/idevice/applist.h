@@ -11,6 +11,10 @@
 @import UIKit;
 
 NSDictionary<NSString*, NSString*>* list_installed_apps(IdeviceProviderHandle* provider, NSString** error);
+// CFBundleExecutable and Path of installed apps, keyed by bundle ID; apps without an executable are left out
+NSDictionary<NSString*, NSDictionary<NSString*, NSString*>*>* get_apps_launch_info(IdeviceProviderHandle* provider, NSArray<NSString*>* bundleIDs, NSString** error);
+// CFBundleExecutable and Path of one installed app
+NSDictionary<NSString*, NSString*>* get_app_launch_info(IdeviceProviderHandle* provider, NSString* bundleID, NSString** error);
 UIImage* getAppIcon(IdeviceProviderHandle* provider, NSString* bundleID, NSString** error);
 
 #endif /* APPLIST_H */
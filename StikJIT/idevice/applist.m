@@ -70,6 +70,60 @@ NSDictionary<NSString*, NSString*>* list_installed_apps(IdeviceProviderHandle* p
     return result;
 }
 
+NSDictionary<NSString*, NSDictionary<NSString*, NSString*>*>* get_apps_launch_info(IdeviceProviderHandle* provider, NSArray<NSString*>* bundleIDs, NSString** error) {
+    InstallationProxyClientHandle *client = NULL;
+    if (installation_proxy_connect_tcp(provider, &client)) {
+        *error = @"Failed to connect to installation proxy";
+        return nil;
+    }
+
+    // one lookup for all of them
+    const char **bundleIDsC = malloc(bundleIDs.count * sizeof(char *));
+    for (NSUInteger i = 0; i < bundleIDs.count; i++) {
+        bundleIDsC[i] = [bundleIDs[i] UTF8String];
+    }
+    void *apps = NULL;
+    size_t count = 0;
+    if (installation_proxy_get_apps(client, NULL, bundleIDsC, bundleIDs.count, &apps, &count) || count == 0) {
+        free(bundleIDsC);
+        installation_proxy_client_free(client);
+        *error = @"Failed to look up app";
+        return nil;
+    }
+    free(bundleIDsC);
+
+    NSMutableDictionary<NSString*, NSDictionary<NSString*, NSString*>*> *result = [NSMutableDictionary dictionaryWithCapacity:count];
+    for (size_t i = 0; i < count; i++) {
+        plist_t app = ((plist_t *)apps)[i];
+        NSMutableDictionary<NSString*, NSString*> *info = [NSMutableDictionary dictionaryWithCapacity:3];
+        for (NSString *key in @[@"CFBundleIdentifier", @"CFBundleExecutable", @"Path"]) {
+            plist_t node = plist_dict_get_item(app, [key UTF8String]);
+            if (!node) continue;
+
+            char *valueC = NULL;
+            plist_get_string_val(node, &valueC);
+            if (valueC && valueC[0] != '\0') {
+                info[key] = [NSString stringWithUTF8String:valueC];
+            }
+            free(valueC);
+        }
+        if (info[@"CFBundleIdentifier"] && info[@"CFBundleExecutable"]) {
+            result[info[@"CFBundleIdentifier"]] = info;
+        }
+    }
+
+    installation_proxy_client_free(client);
+    return result;
+}
+
+NSDictionary<NSString*, NSString*>* get_app_launch_info(IdeviceProviderHandle* provider, NSString* bundleID, NSString** error) {
+    NSDictionary<NSString*, NSString*> *result = get_apps_launch_info(provider, @[bundleID], error)[bundleID];
+    if (!result && !*error) {
+        *error = @"App has no executable";
+    }
+    return result;
+}
+
 UIImage* getAppIcon(IdeviceProviderHandle* provider, NSString* bundleID, NSString** error) {
     SpringBoardServicesClientHandle *client = NULL;
     if (springboard_services_connect(provider, &client)) {
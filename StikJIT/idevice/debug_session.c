@@ -0,0 +1,372 @@
+//
+//  debug_session.c
+//  StikJIT
+//
+//  Per connection state of a debugserver session: capabilities negotiated once
+//  with qSupported, looked up by the native helpers through the DebugProxyHandle.
+//
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug_session.h"
+#include "rsp.h"
+
+static DebugSession* debugSessionList = 0;
+static pthread_mutex_t debugSessionLock = PTHREAD_MUTEX_INITIALIZER;
+
+DebugSession* debug_session_open(DebugProxyHandle* debugProxy) {
+    DebugSession* session = calloc(1, sizeof(DebugSession));
+    session->debugProxy = debugProxy;
+    session->packetSize = DEBUG_SESSION_DEFAULT_PACKET_SIZE;
+    session->binaryWrite = -1;
+    pthread_mutex_lock(&debugSessionLock);
+    session->next = debugSessionList;
+    debugSessionList = session;
+    pthread_mutex_unlock(&debugSessionLock);
+    return session;
+}
+
+DebugSession* debug_session_get(DebugProxyHandle* debugProxy) {
+    pthread_mutex_lock(&debugSessionLock);
+    DebugSession* session = debugSessionList;
+    while(session && session->debugProxy != debugProxy) {
+        session = session->next;
+    }
+    pthread_mutex_unlock(&debugSessionLock);
+    return session;
+}
+
+void debug_session_close(DebugProxyHandle* debugProxy) {
+    pthread_mutex_lock(&debugSessionLock);
+    for(DebugSession** cur = &debugSessionList; *cur; cur = &(*cur)->next) {
+        if((*cur)->debugProxy == debugProxy) {
+            DebugSession* session = *cur;
+            *cur = session->next;
+            free(session->supported);
+            region_map_free(&session->regions);
+            prepared_pages_clear(&session->preparedPages);
+            free(session);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&debugSessionLock);
+}
+
+IdeviceFfiError* debug_session_negotiate(DebugSession* session) {
+    DebugserverCommandHandle* command = debugserver_command_new("qSupported", NULL, 0);
+    char* response = 0;
+    IdeviceFfiError* err = debug_proxy_send_command(session->debugProxy, command, &response);
+    debugserver_command_free(command);
+    if(!err && response) {
+        // "PacketSize=20000" comes back as "PacketSize=20* " from a run-length encoding debugserver
+        size_t length = strlen(response);
+        size_t expandedLength = rsp_expanded_length(response, length);
+        char* expanded = malloc(expandedLength + 1);
+        int64_t decoded = rsp_decode_payload((uint8_t*)expanded, expandedLength, response, length, NULL, false);
+        if(decoded >= 0) {
+            expanded[decoded] = 0;
+            debug_session_parse_supported(session, expanded);
+        }
+        free(expanded);
+    }
+    idevice_string_free(response);
+    return err;
+}
+
+void debug_session_parse_supported(DebugSession* session, const char* reply) {
+    free(session->supported);
+    session->supported = strdup(reply);
+    char packetSize[32];
+    if(debug_session_feature_value(session, "PacketSize", packetSize, sizeof(packetSize))) {
+        uint64_t size = strtoull(packetSize, NULL, 16);
+        if(size > 0) {
+            session->packetSize = size;
+        }
+    }
+    
+    session->compressions = 0;
+    char compressions[128];
+    if(debug_session_feature_value(session, "SupportedCompressions", compressions, sizeof(compressions))) {
+        char* saveptr = 0;
+        for(char* name = strtok_r(compressions, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+            if(strcmp(name, "zlib-deflate") == 0) {
+                session->compressions |= DEBUG_SESSION_COMPRESSION_ZLIB;
+            } else if(strcmp(name, "lzfse") == 0) {
+                session->compressions |= DEBUG_SESSION_COMPRESSION_LZFSE;
+            } else if(strcmp(name, "lz4") == 0) {
+                session->compressions |= DEBUG_SESSION_COMPRESSION_LZ4;
+            } else if(strcmp(name, "lzma") == 0) {
+                session->compressions |= DEBUG_SESSION_COMPRESSION_LZMA;
+            }
+        }
+    }
+}
+
+// finds "name" followed by '+', '-' or '=' as a whole ';' separated entry
+static const char* debug_session_find_feature(const DebugSession* session, const char* name) {
+    if(!session->supported) {
+        return 0;
+    }
+    size_t nameLength = strlen(name);
+    const char* cur = session->supported;
+    while(*cur) {
+        const char* end = strchr(cur, ';');
+        if(!end) {
+            end = cur + strlen(cur);
+        }
+        if((size_t)(end - cur) > nameLength && strncmp(cur, name, nameLength) == 0 && strchr("+-=", cur[nameLength])) {
+            return cur + nameLength;
+        }
+        cur = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
+bool debug_session_has_feature(const DebugSession* session, const char* name) {
+    const char* suffix = debug_session_find_feature(session, name);
+    return suffix && (*suffix == '+' || *suffix == '=');
+}
+
+bool debug_session_feature_value(const DebugSession* session, const char* name, char* value, size_t valueSize) {
+    const char* suffix = debug_session_find_feature(session, name);
+    if(!suffix || *suffix != '=' || valueSize == 0) {
+        return false;
+    }
+    ++suffix;
+    size_t length = strcspn(suffix, ";");
+    if(length >= valueSize) {
+        length = valueSize - 1;
+    }
+    memcpy(value, suffix, length);
+    value[length] = 0;
+    return true;
+}
+
+// parses "<n>[;thread:<tid>;]" following a p or P, *hasThread is false without a suffix
+static uint16_t debug_session_register_operand(const char* operand, const char** next, bool* hasThread, uint64_t* thread) {
+    char* end = 0;
+    uint16_t number = (uint16_t)strtoul(operand, &end, 16);
+    *next = end;
+    const char* suffix = strstr(end, ";thread:");
+    *hasThread = suffix != NULL;
+    if(suffix) {
+        *thread = strtoull(suffix + 8, NULL, 16);
+    }
+    return number;
+}
+
+static bool debug_session_register_target_is_stop(const DebugSession* session, bool hasThread, uint64_t thread) {
+    if(!session->hasStop || !session->stop.hasThread) {
+        return false;
+    }
+    return hasThread ? thread == session->stop.thread : !session->otherThreadSelected;
+}
+
+static void debug_session_set_register(DebugSession* session, uint16_t number, uint16_t size, uint64_t value) {
+    StopReply* stop = &session->stop;
+    for(uint32_t i = 0; i < stop->registerCount; ++i) {
+        if(stop->registers[i].number == number) {
+            stop->registers[i].size = size;
+            stop->registers[i].value = value;
+            return;
+        }
+    }
+    if(stop->registerCount < STOP_REPLY_MAX_REGISTERS) {
+        stop->registers[stop->registerCount++] = (StopRegister){ .number = number, .size = size, .value = value };
+    }
+}
+
+static void debug_session_forget_register(DebugSession* session, uint16_t number) {
+    StopReply* stop = &session->stop;
+    for(uint32_t i = 0; i < stop->registerCount; ++i) {
+        if(stop->registers[i].number == number) {
+            stop->registers[i] = stop->registers[--stop->registerCount];
+            return;
+        }
+    }
+}
+
+void debug_session_note_command(DebugSession* session, const char* command) {
+    if(!session) {
+        return;
+    }
+    bool resumes = false;
+    bool changesMappings = false;
+    // the pages may belong to another process, or be gone, afterwards
+    bool dropsPreparedPages = false;
+    switch(command[0]) {
+        case 'c': case 'C': case 's': case 'S':
+            resumes = true;
+            changesMappings = true;
+            break;
+        case 'A': case 'k': case 'D':
+            // detaching lets the process run on its own
+            resumes = true;
+            changesMappings = true;
+            dropsPreparedPages = true;
+            break;
+        case 'v':
+            // vCont, vAttach*, vRun; vFile and other queries leave the process alone
+            if(strncmp(command, "vCont", 5) == 0 && command[5] != '?') {
+                resumes = true;
+                changesMappings = true;
+            } else if(strncmp(command, "vAttach", 7) == 0 || strncmp(command, "vRun", 4) == 0) {
+                resumes = true;
+                changesMappings = true;
+                dropsPreparedPages = true;
+            } else if(strncmp(command, "vKill", 5) == 0) {
+                resumes = true;
+                changesMappings = true;
+                dropsPreparedPages = true;
+            }
+            break;
+        case '_':
+            if(command[1] == 'M' || command[1] == 'm') {
+                changesMappings = true;
+            }
+            // _m only names the start of the allocation it frees, not its size
+            dropsPreparedPages = command[1] == 'm';
+            break;
+        case 'H':
+            if(command[1] == 'g' && session->hasStop) {
+                uint64_t thread = strtoull(command + 2, NULL, 16);
+                session->otherThreadSelected = thread != session->stop.thread;
+            }
+            break;
+        case 'P':
+            if(session->hasStop) {
+                // the write may still be refused, read the register again next time
+                const char* next;
+                bool hasThread;
+                uint64_t thread = 0;
+                uint16_t number = debug_session_register_operand(command + 1, &next, &hasThread, &thread);
+                debug_session_forget_register(session, number);
+            }
+            break;
+        case 'G':
+            session->stop.registerCount = 0;
+            break;
+        case 'Q':
+            if(strncmp(command, "QRestoreRegisterState", 21) == 0) {
+                session->stop.registerCount = 0;
+            }
+            break;
+    }
+    if(resumes) {
+        session->hasStop = false;
+    }
+    if(changesMappings) {
+        session->regions.valid = false;
+    }
+    if(dropsPreparedPages) {
+        prepared_pages_clear(&session->preparedPages);
+    }
+}
+
+void debug_session_record_stop(DebugSession* session, const char* reply, size_t length) {
+    if(!session || length == 0 || !strchr("TSWX", reply[0])) {
+        return;
+    }
+    StopReply* stop = &session->stop;
+    bool parsed;
+    if(memchr(reply, '*', length)) {
+        // still run-length encoded
+        size_t expandedLength = rsp_expanded_length(reply, length);
+        char* expanded = malloc(expandedLength);
+        int64_t decoded = rsp_decode_payload((uint8_t*)expanded, expandedLength, reply, length, NULL, false);
+        parsed = decoded > 0 && stop_reply_parse(expanded, (size_t)decoded, stop);
+        free(expanded);
+    } else {
+        parsed = stop_reply_parse(reply, length, stop);
+    }
+    session->hasStop = parsed && (stop->kind == 'T' || stop->kind == 'S');
+    session->otherThreadSelected = false;
+    if(reply[0] == 'W' || reply[0] == 'X') {
+        // the process exited
+        prepared_pages_clear(&session->preparedPages);
+    }
+}
+
+// commands debugserver answers with the stop the process reached
+static bool debug_session_command_stops(const char* command) {
+    switch(command[0]) {
+        case 'c': case 'C': case 's': case 'S': case '?':
+            return true;
+        case 'v':
+            return (strncmp(command, "vCont", 5) == 0 && command[5] != '?') ||
+                strncmp(command, "vAttach", 7) == 0 || strncmp(command, "vRun", 4) == 0;
+        default:
+            return false;
+    }
+}
+
+void debug_session_note_reply(DebugSession* session, const char* command, const char* reply, size_t length) {
+    if(!session) {
+        return;
+    }
+    if(command[0] == 'p') {
+        debug_session_cache_register_read(session, command, reply);
+    } else if(debug_session_command_stops(command)) {
+        debug_session_record_stop(session, reply, length);
+    }
+}
+
+bool debug_session_cached_register_read(DebugSession* session, const char* command, char* value) {
+    if(!session || command[0] != 'p' || !session->hasStop) {
+        return false;
+    }
+    const char* next;
+    bool hasThread;
+    uint64_t thread = 0;
+    uint16_t number = debug_session_register_operand(command + 1, &next, &hasThread, &thread);
+    if(!debug_session_register_target_is_stop(session, hasThread, thread)) {
+        return false;
+    }
+    const StopReply* stop = &session->stop;
+    for(uint32_t i = 0; i < stop->registerCount; ++i) {
+        const StopRegister* reg = &stop->registers[i];
+        if(reg->number == number && reg->size > 0 && reg->size <= 8) {
+            for(uint16_t byte = 0; byte < reg->size; ++byte) {
+                snprintf(value + 2 * byte, 3, "%02x", (unsigned)(reg->value >> (8 * byte)) & 0xff);
+            }
+            ++session->registerCacheHits;
+            return true;
+        }
+    }
+    return false;
+}
+
+void debug_session_cache_register_read(DebugSession* session, const char* command, const char* reply) {
+    if(!session || command[0] != 'p' || !session->hasStop || reply[0] == 'E') {
+        return;
+    }
+    const char* next;
+    bool hasThread;
+    uint64_t thread = 0;
+    uint16_t number = debug_session_register_operand(command + 1, &next, &hasThread, &thread);
+    size_t valueLength = strlen(reply);
+    if(debug_session_register_target_is_stop(session, hasThread, thread) && valueLength > 0 && valueLength <= 16 && !strchr(reply, '*')) {
+        debug_session_set_register(session, number, (uint16_t)(valueLength / 2), stop_reply_le_value(reply, valueLength));
+    }
+}
+
+int debug_session_region_map(DebugSession* session, bool refresh, const RegionMap** mapOut, IdeviceFfiError** errOut) {
+    if(!session->regions.valid || refresh) {
+        int ret = region_map_scan(session->debugProxy, &session->regions, errOut);
+        if(ret) {
+            return ret;
+        }
+    }
+    *mapOut = &session->regions;
+    return 0;
+}
+
+uint64_t debug_session_max_hex_payload(const DebugSession* session) {
+    // "$M" + 16 address digits + ',' + 16 length digits + ':' ... "#xx", two hex chars per byte
+    const uint64_t overhead = 2 + 16 + 1 + 16 + 1 + 3;
+    uint64_t packetSize = session ? session->packetSize : DEBUG_SESSION_DEFAULT_PACKET_SIZE;
+    return packetSize > overhead ? (packetSize - overhead) / 2 : 1;
+}
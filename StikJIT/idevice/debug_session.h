@@ -0,0 +1,90 @@
+//
+//  debug_session.h
+//  StikJIT
+//
+//  Per connection state of a debugserver session: capabilities negotiated once
+//  with qSupported, looked up by the native helpers through the DebugProxyHandle.
+//
+
+#ifndef DEBUG_SESSION_H
+#define DEBUG_SESSION_H
+#include "idevice.h"
+#include "region_map.h"
+#include "stop_reply.h"
+#include "prepared_pages.h"
+
+// used when debugserver doesn't advertise PacketSize
+#define DEBUG_SESSION_DEFAULT_PACKET_SIZE 4096
+
+// algorithms debugserver lists in SupportedCompressions
+#define DEBUG_SESSION_COMPRESSION_ZLIB (1 << 0)
+#define DEBUG_SESSION_COMPRESSION_LZFSE (1 << 1)
+#define DEBUG_SESSION_COMPRESSION_LZ4 (1 << 2)
+#define DEBUG_SESSION_COMPRESSION_LZMA (1 << 3)
+
+typedef struct DebugSession {
+    DebugProxyHandle* debugProxy;
+    // largest packet debugserver accepts, including framing
+    uint64_t packetSize;
+    // raw qSupported reply, NULL if it was never negotiated
+    char* supported;
+    // whether debugserver accepts binary X writes: -1 not tried yet, 0 no, 1 yes
+    int binaryWrite;
+    // DEBUG_SESSION_COMPRESSION_* flags debugserver offers for QEnableCompression.
+    // compression is never enabled: debug_proxy_read hands replies back as UTF-8 converted
+    // C strings, which can't carry the raw bytes of a compressed packet
+    uint32_t compressions;
+    // mapped regions of the debugged process, rescanned once a command may have changed them
+    RegionMap regions;
+    // last stop reply; its registers array doubles as the register cache of the stopped thread,
+    // extended by p reads and P writes, until the process resumes
+    StopReply stop;
+    bool hasStop;
+    // Hg selected another thread since the stop, so a p without a thread suffix isn't for stop.thread
+    bool otherThreadSelected;
+    uint64_t registerCacheHits;
+    // pages rsp_prepare_memory_regions already touched in the process debugged now
+    PreparedPages preparedPages;
+    struct DebugSession* next;
+} DebugSession;
+
+DebugSession* debug_session_open(DebugProxyHandle* debugProxy);
+DebugSession* debug_session_get(DebugProxyHandle* debugProxy);
+void debug_session_close(DebugProxyHandle* debugProxy);
+
+// sends qSupported and caches what debugserver answered
+IdeviceFfiError* debug_session_negotiate(DebugSession* session);
+void debug_session_parse_supported(DebugSession* session, const char* reply);
+// true for "name+" and "name=value" features
+bool debug_session_has_feature(const DebugSession* session, const char* name);
+// copies the value of a "name=value" feature, returns false if there is none
+bool debug_session_feature_value(const DebugSession* session, const char* name, char* value, size_t valueSize);
+
+// call with every command sent on the session's behalf: resuming the process or allocating and
+// freeing memory (_M/_m) can change its mappings, so the cached region map is dropped.
+// resuming (detaching and killing included) also drops the current stop and its registers, register
+// writes drop the register written. attaching, launching, detaching, killing and freeing memory (_m)
+// drop the prepared pages
+void debug_session_note_command(DebugSession* session, const char* command);
+
+// remembers a reply that may be a stop reply (to c, s, vCont, vAttach or ?) as the current stop.
+// an exit (W or X) drops the prepared pages
+void debug_session_record_stop(DebugSession* session, const char* reply, size_t length);
+// call with the reply to every command sent on the session's behalf: a p reply extends the register cache,
+// the reply to c, C, s, S, vCont, vAttach, vRun or ? is recorded as the current stop. other replies, stop
+// info queries such as qThreadStopInfo for another thread included, leave the cache alone
+void debug_session_note_reply(DebugSession* session, const char* command, const char* reply, size_t length);
+// answers a "p<n>[;thread:<tid>;]" command from the register cache. on a hit the register's little
+// endian hex value is written to value (17 bytes) and true is returned
+bool debug_session_cached_register_read(DebugSession* session, const char* command, char* value);
+// adds the reply to a p command that missed the cache
+void debug_session_cache_register_read(DebugSession* session, const char* command, const char* reply);
+
+// the session's region map, walked again only when refresh is set or the mappings may have changed
+// since the last walk. returns region_map_scan's codes, *mapOut is set on 0
+int debug_session_region_map(DebugSession* session, bool refresh, const RegionMap** mapOut, IdeviceFfiError** errOut);
+
+// bytes of memory one $M write or one m read may carry within the negotiated packet size
+uint64_t debug_session_max_hex_payload(const DebugSession* session);
+
+#endif /* DEBUG_SESSION_H */
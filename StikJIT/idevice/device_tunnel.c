@@ -0,0 +1,127 @@
+//
+//  device_tunnel.c
+//  StikJIT
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "device_tunnel.h"
+
+static uint64_t device_tunnel_now_micros(void) {
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW) / 1000;
+}
+
+int device_tunnel_open(IdeviceProviderHandle* provider, DeviceTunnel* tunnel, IdeviceFfiError** errOut) {
+    memset(tunnel, 0, sizeof(*tunnel));
+    uint64_t stageStart = device_tunnel_now_micros();
+    
+    CoreDeviceProxyHandle* coreDevice = NULL;
+    IdeviceFfiError* err = core_device_proxy_connect(provider, &coreDevice);
+    if(err) {
+        *errOut = err;
+        return 1;
+    }
+    
+    uint16_t rsdPort = 0;
+    err = core_device_proxy_get_server_rsd_port(coreDevice, &rsdPort);
+    if(err) {
+        core_device_proxy_free(coreDevice);
+        *errOut = err;
+        return 1;
+    }
+    
+    uint64_t proxyMicros = device_tunnel_now_micros() - stageStart;
+    stageStart = device_tunnel_now_micros();
+    
+    // takes ownership of coreDevice
+    AdapterHandle* adapter = NULL;
+    err = core_device_proxy_create_tcp_adapter(coreDevice, &adapter);
+    if(err) {
+        *errOut = err;
+        return 1;
+    }
+    
+    char* path = malloc(2048);
+    snprintf(path, 2048, "%s/Documents/debugProxy.pcap", getenv("HOME"));
+    err = adapter_pcap(adapter, path);
+    free(path);
+    if(err) {
+        idevice_error_free(err);
+    }
+    uint64_t adapterMicros = device_tunnel_now_micros() - stageStart;
+    stageStart = device_tunnel_now_micros();
+    
+    AdapterStreamHandle* stream = NULL;
+    err = adapter_connect(adapter, rsdPort, (ReadWriteOpaque**)&stream);
+    if(err) {
+        adapter_free(adapter);
+        *errOut = err;
+        return 1;
+    }
+    
+    RsdHandshakeHandle* handshake = NULL;
+    err = rsd_handshake_new((ReadWriteOpaque*)stream, &handshake);
+    if(err) {
+        adapter_close(stream);
+        adapter_free(adapter);
+        *errOut = err;
+        return 1;
+    }
+    
+    tunnel->adapter = adapter;
+    tunnel->handshake = handshake;
+    tunnel->rsdPort = rsdPort;
+    tunnel->provider = provider;
+    tunnel->proxyMicros = proxyMicros;
+    tunnel->adapterMicros = adapterMicros;
+    tunnel->handshakeMicros = device_tunnel_now_micros() - stageStart;
+    return 0;
+}
+
+int device_tunnel_connect_remote_server(DeviceTunnel* tunnel, RemoteServerHandle** remoteServer, IdeviceFfiError** errOut) {
+    IdeviceFfiError* err = remote_server_connect_rsd(tunnel->adapter, tunnel->handshake, remoteServer);
+    if(err) {
+        *errOut = err;
+        return 1;
+    }
+    return 0;
+}
+
+int device_tunnel_connect_debug_proxy(DeviceTunnel* tunnel, DebugProxyHandle** debugProxy, IdeviceFfiError** errOut) {
+    IdeviceFfiError* err = debug_proxy_connect_rsd(tunnel->adapter, tunnel->handshake, debugProxy);
+    if(err) {
+        *errOut = err;
+        return 1;
+    }
+    return 0;
+}
+
+bool device_tunnel_check(DeviceTunnel* tunnel) {
+    if(!tunnel->adapter) {
+        return false;
+    }
+    AdapterStreamHandle* stream = NULL;
+    IdeviceFfiError* err = adapter_connect(tunnel->adapter, tunnel->rsdPort, (ReadWriteOpaque**)&stream);
+    if(err) {
+        idevice_error_free(err);
+        return false;
+    }
+    err = adapter_close(stream);
+    if(err) {
+        idevice_error_free(err);
+    }
+    return true;
+}
+
+void device_tunnel_close(DeviceTunnel* tunnel) {
+    if(tunnel->handshake) {
+        rsd_handshake_free(tunnel->handshake);
+    }
+    if(tunnel->adapter) {
+        adapter_free(tunnel->adapter);
+    }
+    memset(tunnel, 0, sizeof(*tunnel));
+}
@@ -0,0 +1,40 @@
+//
+//  device_tunnel.h
+//  StikJIT
+//
+//  CoreDeviceProxy tunnel to the device: the TCP adapter plus the RSD handshake that lists
+//  its services. Building one costs several round trips, so it's kept open across debug
+//  requests and each request only opens the service streams it needs.
+//
+
+#ifndef DEVICE_TUNNEL_H
+#define DEVICE_TUNNEL_H
+#include "idevice.h"
+
+typedef struct DeviceTunnel {
+    AdapterHandle* adapter;
+    RsdHandshakeHandle* handshake;
+    uint16_t rsdPort;
+    // provider the tunnel was built on, it's rebuilt once the heartbeat replaces the provider
+    IdeviceProviderHandle* provider;
+    // number of debug requests served, for logging
+    uint64_t useCount;
+    // time spent connecting CoreDeviceProxy, creating the adapter and in the RSD handshake that no
+    // debug request reported yet; the request after a (re)build takes them over
+    uint64_t proxyMicros;
+    uint64_t adapterMicros;
+    uint64_t handshakeMicros;
+} DeviceTunnel;
+
+// connects CoreDeviceProxy, creates the adapter and performs the RSD handshake.
+// returns 0, or 1 with the failing call's error in *errOut
+int device_tunnel_open(IdeviceProviderHandle* provider, DeviceTunnel* tunnel, IdeviceFfiError** errOut);
+// open service streams over the tunnel, looked up through the handshake's service list.
+// both return 0, or 1 with the error in *errOut
+int device_tunnel_connect_remote_server(DeviceTunnel* tunnel, RemoteServerHandle** remoteServer, IdeviceFfiError** errOut);
+int device_tunnel_connect_debug_proxy(DeviceTunnel* tunnel, DebugProxyHandle** debugProxy, IdeviceFfiError** errOut);
+// opens and closes a stream to the RSD port, false once the tunnel no longer carries traffic
+bool device_tunnel_check(DeviceTunnel* tunnel);
+void device_tunnel_close(DeviceTunnel* tunnel);
+
+#endif /* DEVICE_TUNNEL_H */
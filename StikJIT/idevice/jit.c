@@ -15,295 +15,684 @@
 #include <unistd.h>
 #include <CoreFoundation/CoreFoundation.h>
 #include <limits.h>
+#include <time.h>
 
 #include "jit.h"
+#include "device_tunnel.h"
+#include "debug_session.h"
+#include "rsp.h"
 
-void runDebugServerCommand(int pid, DebugProxyHandle* debug_proxy, LogFuncC logger, DebugAppCallback callback) {
-    // enable QStartNoAckMode
-    char *disableResponse = NULL;
-    debug_proxy_send_ack(debug_proxy);
-    debug_proxy_send_ack(debug_proxy);
-    DebugserverCommandHandle *disableAckCommand = debugserver_command_new("QStartNoAckMode", NULL, 0);
-    IdeviceFfiError* err = debug_proxy_send_command(debug_proxy, disableAckCommand, &disableResponse);
-    debugserver_command_free(disableAckCommand);
-    logger("QStartNoAckMode result = %s, err = %d", disableResponse, err);
-    idevice_string_free(disableResponse);
+static uint64_t jit_now_micros(void) {
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW) / 1000;
+}
+
+// sends QStartNoAckMode and qSupported in one write without waiting, finish_debug_session collects
+// the replies, so debugserver can answer them while the caller does something else
+static IdeviceFfiError* begin_debug_session(DebugProxyHandle* debug_proxy) {
+    // acks for anything debugserver sent before noack mode, then both requests
+    char requests[64] = "++";
+    size_t length = 2;
+    length += rsp_build_packet(requests + length, "QStartNoAckMode", strlen("QStartNoAckMode"));
+    length += rsp_build_packet(requests + length, "qSupported", strlen("qSupported"));
+    IdeviceFfiError* err = debug_proxy_send_raw(debug_proxy, (const uint8_t*)requests, length);
     debug_proxy_set_ack_mode(debug_proxy, false);
-    
-    if(callback) {
-        dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
-        callback(pid, debug_proxy, semaphore);
-        dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
-        err = debug_proxy_send_raw(debug_proxy, "\x03", 1);
-        usleep(500);
-    } else {
-        // Send vAttach command with PID in hex
-        char attach_command[64];
-        snprintf(attach_command, sizeof(attach_command), "vAttach;%" PRIx64, pid);
-        
-        DebugserverCommandHandle *attach_cmd = debugserver_command_new(attach_command, NULL, 0);
-        if (attach_cmd == NULL) {
-            logger("Failed to create attach command");
-            return;
+    debug_session_open(debug_proxy);
+    return err;
+}
+
+// reads the replies to begin_debug_session's requests through reader
+static void finish_debug_session(DebugProxyHandle* debug_proxy, RspPacketReader* reader, LogFuncC logger) {
+    DebugSession* session = debug_session_get(debug_proxy);
+    const char* payload = NULL;
+    size_t payload_length = 0;
+    IdeviceFfiError* err = NULL;
+    int ret = rsp_reader_next(debug_proxy, reader, &payload, &payload_length, &err);
+    if (ret) {
+        logger("QStartNoAckMode failed: %d", err ? err->code : ret);
+        if (err) {
+            idevice_error_free(err);
         }
-        
-        char *attach_response = NULL;
-        err = debug_proxy_send_command(debug_proxy, attach_cmd, &attach_response);
-        debugserver_command_free(attach_cmd);
-        
+        return;
+    }
+    logger("QStartNoAckMode result = %.*s", (int)payload_length, payload);
+    
+    // learn debugserver's limits once, native helpers size their packets from them
+    ret = rsp_reader_next(debug_proxy, reader, &payload, &payload_length, &err);
+    if (ret) {
+        logger("qSupported failed: %d, using packet size %llu", err ? err->code : ret, (unsigned long long)session->packetSize);
         if (err) {
-            logger("Failed to attach to process: %d", err);
-        } else if (attach_response != NULL) {
-            logger("Attach response: %s", attach_response);
-            idevice_string_free(attach_response);
+            idevice_error_free(err);
         }
-        
+        return;
+    }
+    char* supported = malloc(rsp_expanded_length(payload, payload_length) + 1);
+    int64_t supported_length = rsp_decode_payload((uint8_t*)supported, rsp_expanded_length(payload, payload_length), payload, payload_length, NULL, false);
+    if (supported_length < 0) {
+        logger("qSupported reply malformed, using packet size %llu", (unsigned long long)session->packetSize);
+        free(supported);
+        return;
     }
+    supported[supported_length] = '\0';
+    debug_session_parse_supported(session, supported);
+    free(supported);
+    logger("qSupported result = %s", session->supported);
+    if(session->compressions) {
+        // see DebugSession.compressions, replies stay uncompressed
+        logger("debugserver offers compression (0x%x), not enabled on this transport", session->compressions);
+    }
+}
 
-    // Send detach command
-    DebugserverCommandHandle *detach_cmd = debugserver_command_new("D", NULL, 0);
-    if (detach_cmd == NULL) {
-        logger("Failed to create detach command");
-    } else {
-        char *detach_response = NULL;
-        err = debug_proxy_send_command(debug_proxy, detach_cmd, &detach_response);
-        debugserver_command_free(detach_cmd);
-        
-        if (err) {
-            logger("Failed to detach from process: %d", err->code);
+// sends vAttachWait for the executable without waiting for the reply, debugserver answers once it attached
+static IdeviceFfiError* arm_attach_wait(DebugProxyHandle* debug_proxy, const char* executable_name) {
+    size_t name_length = strlen(executable_name);
+    size_t command_length = strlen("vAttachWait;") + 2 * name_length;
+    char* command = malloc(command_length);
+    char* packet = malloc(command_length + 4);
+    memcpy(command, "vAttachWait;", strlen("vAttachWait;"));
+    rsp_hex_encode(command + strlen("vAttachWait;"), (const uint8_t*)executable_name, name_length);
+    size_t packet_length = rsp_build_packet(packet, command, command_length);
+    IdeviceFfiError* err = debug_proxy_send_raw(debug_proxy, (const uint8_t*)packet, packet_length);
+    free(command);
+    free(packet);
+    return err;
+}
+
+// reads debugserver's answer to vAttachWait, true if it's a stop reply, i.e. the process is attached
+static bool wait_for_attach(DebugProxyHandle* debug_proxy, RspPacketReader* reader, LogFuncC logger) {
+    const char* payload = NULL;
+    size_t payload_length = 0;
+    IdeviceFfiError* err = NULL;
+    int ret = rsp_reader_next(debug_proxy, reader, &payload, &payload_length, &err);
+    if(ret) {
+        logger("Failed to wait for attach: %d", err ? err->code : ret);
+        if(err) {
             idevice_error_free(err);
-        } else if (detach_response != NULL) {
-            logger("Detach response: %s", detach_response);
-            idevice_string_free(detach_response);
         }
+        return false;
     }
+    logger("Attach wait response: %.*s", (int)payload_length, payload);
+    bool attached = payload_length && (payload[0] == 'T' || payload[0] == 'S');
+    if(attached) {
+        debug_session_record_stop(debug_session_get(debug_proxy), payload, payload_length);
+    }
+    return attached;
 }
 
-int debug_app(IdeviceProviderHandle* tcp_provider, const char *bundle_id, LogFuncC logger, DebugAppCallback callback) {
-    // Initialize logger
-    idevice_init_logger(Info, Disabled, NULL);
-    IdeviceFfiError* err = 0;
-    
-    CoreDeviceProxyHandle *core_device = NULL;
-    err = core_device_proxy_connect(tcp_provider, &core_device);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to connect to CoreDeviceProxy: [%d] %s\n",
-              err->code, err->message);
-      idevice_error_free(err);
-      return 1;
+// sends one command and returns its reply (caller frees with idevice_string_free), NULL if it failed
+static char* send_launch_command(DebugProxyHandle* debug_proxy, const char* command, LogFuncC logger) {
+    DebugserverCommandHandle *cmd = debugserver_command_new(command, NULL, 0);
+    if (cmd == NULL) {
+        logger("Failed to create %s command", command);
+        return NULL;
+    }
+    char *response = NULL;
+    IdeviceFfiError* err = debug_proxy_send_command(debug_proxy, cmd, &response);
+    debugserver_command_free(cmd);
+    if (err) {
+        logger("%s failed: %d", command, err->code);
+        idevice_error_free(err);
+        return NULL;
+    }
+    if (!response) {
+        logger("%s got no response", command);
     }
+    return response;
+}
 
-    uint16_t rsd_port;
-    err = core_device_proxy_get_server_rsd_port(core_device, &rsd_port);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to get server RSD port: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      core_device_proxy_free(core_device);
-      return 1;
+// pid of the process debugserver is attached to, from qProcessInfo; 0 if it can't tell
+static int debugged_pid(DebugProxyHandle* debug_proxy, LogFuncC logger) {
+    char* response = send_launch_command(debug_proxy, "qProcessInfo", logger);
+    const char* pid_field = response ? strstr(response, "pid:") : NULL;
+    int pid = 0;
+    // skip parent-pid:, which qProcessInfo lists after pid: anyway
+    if (pid_field && (pid_field == response || pid_field[-1] == ';')) {
+        pid = (int)strtoull(pid_field + strlen("pid:"), NULL, 16);
     }
-    printf("Server RSD Port: %d\n", rsd_port);
+    idevice_string_free(response);
+    return pid;
+}
 
-    printf("\n=== Creating TCP Tunnel Adapter ===\n");
+// sends prefix followed by value hex encoded, true if debugserver answered OK
+static bool send_hex_launch_command(DebugProxyHandle* debug_proxy, const char* prefix, const char* value, LogFuncC logger) {
+    size_t prefix_length = strlen(prefix);
+    size_t value_length = strlen(value);
+    char* command = malloc(prefix_length + 2 * value_length + 1);
+    memcpy(command, prefix, prefix_length);
+    rsp_hex_encode(command + prefix_length, (const uint8_t*)value, value_length);
+    command[prefix_length + 2 * value_length] = '\0';
+    char* response = send_launch_command(debug_proxy, command, logger);
+    free(command);
+    bool ok = response && strcmp(response, "OK") == 0;
+    if (response && !ok) {
+        logger("%s%s rejected: %s", prefix, value, response);
+    }
+    idevice_string_free(response);
+    return ok;
+}
 
-    AdapterHandle *adapter = NULL;
-    err = core_device_proxy_create_tcp_adapter(core_device, &adapter);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to create TCP adapter: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      return 1;
+static const char* const debugStageNames[DEBUG_STAGE_COUNT] = {
+    "proxy", "adapter", "handshake", "remote server", "launch", "debug proxy", "attach", "detach",
+};
+
+const char* debug_stage_name(DebugStage stage) {
+    return stage < DEBUG_STAGE_COUNT ? debugStageNames[stage] : "none";
+}
+
+// one debug request going through its stages, owns every handle it opened
+typedef struct DebugRun {
+    DeviceTunnel* tunnel;
+    const char* bundleId;
+    int pid;
+    DebugLaunchMode mode;
+    const DebugLaunchOptions* options;
+    LogFuncC logger;
+    DebugAppCallback callback;
+    DebugProxyHandle* debugProxy;
+    RemoteServerHandle* remoteServer;
+    ProcessControlHandle* processControl;
+    RspPacketReader reader;
+    // QStartNoAckMode and qSupported were sent, their replies not read yet
+    bool sessionPending;
+    // vAttachWait was sent and not answered yet
+    bool attachWaitPending;
+    // vAttach or D was sent and not answered yet
+    bool attachPending;
+    bool detachPending;
+    bool attached;
+    // the launch stage began, a tunnel failure from here on can't be retried without launching twice
+    bool launchStarted;
+    // processControl is another run's in the same batch, not freed here
+    bool borrowsProcessControl;
+} DebugRun;
+
+// reads the session replies that are still outstanding, usually buffered by now
+static void debug_run_finish_session(DebugRun* run) {
+    if (run->sessionPending) {
+        finish_debug_session(run->debugProxy, &run->reader, run->logger);
+        run->sessionPending = false;
     }
+}
 
-    AdapterStreamHandle *stream = NULL;
-    err = adapter_connect(adapter, rsd_port, (ReadWriteOpaque **)&stream);
+// connects the debug proxy and leaves the session requests (and vAttachWait) in flight, nothing
+// here waits for the launch so it runs first in every mode
+static int stage_debug_proxy(DebugRun* run) {
+    IdeviceFfiError* err = NULL;
+    if (device_tunnel_connect_debug_proxy(run->tunnel, &run->debugProxy, &err)) {
+        run->logger("Failed to create debug proxy client: [%d] %s", err->code, err->message);
+        idevice_error_free(err);
+        return DEBUG_APP_TUNNEL_FAILED;
+    }
+    err = begin_debug_session(run->debugProxy);
+    if (err == NULL && run->mode == DEBUG_LAUNCH_ATTACH_WAIT) {
+        err = arm_attach_wait(run->debugProxy, run->options->executableName);
+        run->attachWaitPending = err == NULL;
+    }
     if (err != NULL) {
-      fprintf(stderr, "Failed to connect to RSD port: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      adapter_free(adapter);
-      return 1;
+        run->logger("Failed to send debug session requests: [%d] %s", err->code, err->message);
+        idevice_error_free(err);
+        return 1;
     }
-    printf("Successfully connected to RSD port\n");
-
-    printf("\n=== Performing RSD Handshake ===\n");
+    run->sessionPending = true;
+    return 0;
+}
 
-    RsdHandshakeHandle *handshake = NULL;
-    err = rsd_handshake_new((ReadWriteOpaque *)stream, &handshake);
+static int stage_remote_server(DebugRun* run) {
+    IdeviceFfiError* err = NULL;
+    if (device_tunnel_connect_remote_server(run->tunnel, &run->remoteServer, &err)) {
+        run->logger("Failed to create remote server: [%d] %s", err->code, err->message);
+        idevice_error_free(err);
+        // nothing was launched yet either
+        return DEBUG_APP_TUNNEL_FAILED;
+    }
+    err = process_control_new(run->remoteServer, &run->processControl);
     if (err != NULL) {
-      fprintf(stderr, "Failed to perform RSD handshake: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      adapter_close(stream);
-      adapter_free(adapter);
-      return 1;
+        run->logger("Failed to create process control client: [%d] %s", err->code, err->message);
+        idevice_error_free(err);
+        return 1;
     }
+    return 0;
+}
+
+// launches through debugserver with the A packet, the new process is stopped and attached once this returns
+static int launch_with_debugserver(DebugRun* run) {
+    const DebugLaunchOptions* options = run->options;
+    // the launch commands below wait for their replies, so the session ones go first
+    debug_run_finish_session(run);
     
-    // Create RemoteServerClient
-    RemoteServerHandle *remote_server = NULL;
-    err = remote_server_connect_rsd(adapter, handshake, &remote_server);
+    for (size_t i = 0; i < options->environmentCount; i++) {
+        send_hex_launch_command(run->debugProxy, "QEnvironmentHexEncoded:", options->environment[i], run->logger);
+    }
+    if (options->workingDirectory) {
+        send_hex_launch_command(run->debugProxy, "QSetWorkingDir:", options->workingDirectory, run->logger);
+    }
+    
+    size_t argc = options->argumentCount + 1;
+    const char** argv = malloc(argc * sizeof(char*));
+    argv[0] = options->executablePath;
+    for (size_t i = 0; i < options->argumentCount; i++) {
+        argv[i + 1] = options->arguments[i];
+    }
+    char* response = NULL;
+    IdeviceFfiError* err = debug_proxy_set_argv(run->debugProxy, argv, argc, &response);
+    free(argv);
     if (err != NULL) {
-      fprintf(stderr, "Failed to create remote server: [%d] %s", err->code,
-              err->message);
-      idevice_error_free(err);
-      adapter_free(adapter);
-      rsd_handshake_free(handshake);
-      return 1;
+        run->logger("Failed to launch through debugserver: [%d] %s", err->code, err->message);
+        idevice_error_free(err);
+        return 1;
     }
+    run->logger("A response: %s", response);
+    idevice_string_free(response);
+    
+    response = send_launch_command(run->debugProxy, "qLaunchSuccess", run->logger);
+    bool launched = response && strcmp(response, "OK") == 0;
+    if (!launched) {
+        run->logger("Launch failed: %s", response ? response : "no response");
+    }
+    idevice_string_free(response);
+    if (!launched) {
+        return 1;
+    }
+    
+    run->pid = debugged_pid(run->debugProxy, run->logger);
+    if (!run->pid) {
+        run->logger("Failed to get the launched process's pid");
+        return 1;
+    }
+    run->attached = true;
+    return 0;
+}
 
-    printf("\n=== Testing Process Control ===\n");
-
-    // Create ProcessControlClient
-    ProcessControlHandle *process_control = NULL;
-    err = process_control_new(remote_server, &process_control);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to create process control client: [%d] %s",
-              err->code, err->message);
-      idevice_error_free(err);
-      remote_server_free(remote_server);
-      return 1;
+static int stage_launch(DebugRun* run) {
+    run->launchStarted = true;
+    if (run->mode == DEBUG_LAUNCH_DEBUGSERVER) {
+        if (launch_with_debugserver(run)) {
+            return 1;
+        }
+    } else {
+        uint64_t pid = 0;
+        // vAttachWait waits for a new process of that name, an instance already running would
+        // never let it finish, so that mode has it killed and launched afresh
+        bool kill_existing = run->mode == DEBUG_LAUNCH_ATTACH_WAIT;
+        IdeviceFfiError* err = process_control_launch_app(run->processControl, run->bundleId, NULL, 0, NULL, 0,
+                                                          true, kill_existing, &pid);
+        if (err != NULL) {
+            run->logger("Failed to launch app: [%d] %s", err->code, err->message);
+            idevice_error_free(err);
+            return 1;
+        }
+        run->pid = (int)pid;
     }
+    run->logger("Launched app with PID: %d", run->pid);
+    return 0;
+}
 
-    // Launch application
-    uint64_t pid;
-    err = process_control_launch_app(process_control, bundle_id, NULL, 0, NULL, 0,
-                                     true, false, &pid);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to launch app: [%d] %s", err->code, err->message);
-      idevice_error_free(err);
-      process_control_free(process_control);
-      remote_server_free(remote_server);
-      return 1;
+// sends command without waiting, debug_run_reply reads the answer
+static int debug_run_send(DebugRun* run, const char* command) {
+    size_t length = strlen(command);
+    char* packet = malloc(length + 4);
+    size_t packet_length = rsp_build_packet(packet, command, length);
+    IdeviceFfiError* err = debug_proxy_send_raw(run->debugProxy, (const uint8_t*)packet, packet_length);
+    free(packet);
+    if (err) {
+        run->logger("Failed to send %s: [%d] %s", command, err->code, err->message);
+        idevice_error_free(err);
+        return 1;
     }
-    printf("Successfully launched app with PID: %llu\n", pid);
-    
-    char* path = malloc(2048);
-    snprintf(path, 2048, "%s/Documents/debugProxy.pcap", getenv("HOME"));
-    adapter_pcap(adapter, path);
-    free(path);
+    return 0;
+}
 
-    printf("\n=== Setting up Debug Proxy ===\n");
+// next reply on the run's connection, *payload stays valid until the next read
+static int debug_run_reply(DebugRun* run, const char* what, const char** payload, size_t* payload_length) {
+    IdeviceFfiError* err = NULL;
+    int ret = rsp_reader_next(run->debugProxy, &run->reader, payload, payload_length, &err);
+    if (ret) {
+        run->logger("Failed to read %s response: %d", what, err ? err->code : ret);
+        if (err) {
+            idevice_error_free(err);
+        }
+        return 1;
+    }
+    run->logger("%s response: %.*s", what, (int)*payload_length, *payload);
+    return 0;
+}
 
-    DebugProxyHandle *debug_proxy = NULL;
-    err = debug_proxy_connect_rsd(adapter, handshake, &debug_proxy);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to create debug proxy client: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      rsd_handshake_free(handshake);
-      adapter_free(adapter);
-      return 1;
+// first half of the attach stage: collects what's in flight and sends vAttach if still needed,
+// a batch calls it for every target before reading any of the replies
+static int debug_run_begin_attach(DebugRun* run) {
+    // replies that arrived during the launch are buffered already
+    debug_run_finish_session(run);
+    if (run->attachWaitPending) {
+        run->attached = wait_for_attach(run->debugProxy, &run->reader, run->logger);
+        run->attachWaitPending = false;
+        int attached_pid = run->attached ? debugged_pid(run->debugProxy, run->logger) : 0;
+        if (run->attached && attached_pid != run->pid) {
+            // another process of the same name appeared first, let it go and attach by pid
+            run->logger("Attach wait caught pid %d instead of %d, attaching by pid", attached_pid, run->pid);
+            debug_session_note_command(debug_session_get(run->debugProxy), "D");
+            char* detach_response = send_launch_command(run->debugProxy, "D", run->logger);
+            if (detach_response == NULL) {
+                return 1;
+            }
+            idevice_string_free(detach_response);
+            run->attached = false;
+        }
+    }
+    if (run->callback || run->attached || run->attachPending) {
+        return 0;
     }
     
-    runDebugServerCommand((int)pid, debug_proxy, logger, callback);
-    
-    /*****************************************************************
-     * Cleanup
-     *****************************************************************/
-    debug_proxy_free(debug_proxy);
-    process_control_free(process_control);
-    remote_server_free(remote_server);
-    rsd_handshake_free(handshake);
-    adapter_free(adapter);
-    
-    logger("Debug session completed");
+    // Send vAttach command with PID in hex
+    char attach_command[64];
+    snprintf(attach_command, sizeof(attach_command), "vAttach;%" PRIx64, (uint64_t)run->pid);
+    if (debug_run_send(run, attach_command)) {
+        return 1;
+    }
+    run->attachPending = true;
     return 0;
 }
 
-
-int debug_app_pid(IdeviceProviderHandle* tcp_provider, int pid, LogFuncC logger, DebugAppCallback callback) {
-    IdeviceFfiError* err = 0;
+// attaches (unless the launch did already) or hands the process to the callback until it's done
+static int stage_attach(DebugRun* run) {
+    if (debug_run_begin_attach(run)) {
+        return 1;
+    }
     
-    CoreDeviceProxyHandle *core_device = NULL;
-    err = core_device_proxy_connect(tcp_provider, &core_device);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to connect to CoreDeviceProxy: [%d] %s\n",
-              err->code, err->message);
-      idevice_error_free(err);
-      return 1;
+    if (run->callback) {
+        dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+        run->callback(run->pid, run->debugProxy, semaphore);
+        dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+        IdeviceFfiError* err = debug_proxy_send_raw(run->debugProxy, (const uint8_t*)"\x03", 1);
+        if (err) {
+            idevice_error_free(err);
+        }
+        usleep(500);
+        return 0;
     }
+    if (!run->attachPending) {
+        return 0;
+    }
+    
+    const char* payload = NULL;
+    size_t payload_length = 0;
+    run->attachPending = false;
+    if (debug_run_reply(run, "Attach", &payload, &payload_length)) {
+        return 1;
+    }
+    run->attached = payload_length && (payload[0] == 'T' || payload[0] == 'S');
+    if (run->attached) {
+        debug_session_record_stop(debug_session_get(run->debugProxy), payload, payload_length);
+    }
+    return run->attached ? 0 : 1;
+}
 
-    uint16_t rsd_port;
-    err = core_device_proxy_get_server_rsd_port(core_device, &rsd_port);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to get server RSD port: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      core_device_proxy_free(core_device);
-      return 1;
+static int debug_run_begin_detach(DebugRun* run) {
+    if (run->detachPending) {
+        return 0;
+    }
+    // after a script the interrupt's stop reply comes first, the synchronous D below skips it
+    if (run->callback) {
+        return 0;
     }
-    printf("Server RSD Port: %d\n", rsd_port);
+    if (debug_run_send(run, "D")) {
+        return 1;
+    }
+    run->detachPending = true;
+    return 0;
+}
 
-    printf("\n=== Creating TCP Tunnel Adapter ===\n");
+static int stage_detach(DebugRun* run) {
+    if (debug_run_begin_detach(run)) {
+        return 1;
+    }
+    if (!run->detachPending) {
+        char* detach_response = send_launch_command(run->debugProxy, "D", run->logger);
+        if (detach_response == NULL) {
+            return 1;
+        }
+        run->logger("Detach response: %s", detach_response);
+        idevice_string_free(detach_response);
+        return 0;
+    }
+    
+    const char* payload = NULL;
+    size_t payload_length = 0;
+    run->detachPending = false;
+    return debug_run_reply(run, "Detach", &payload, &payload_length);
+}
 
-    AdapterHandle *adapter = NULL;
-    err = core_device_proxy_create_tcp_adapter(core_device, &adapter);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to create TCP adapter: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      return 1;
+// frees what the stages opened, in reverse order
+static void debug_run_cleanup(DebugRun* run) {
+    if (run->processControl && !run->borrowsProcessControl) {
+        process_control_free(run->processControl);
+    }
+    if (run->remoteServer) {
+        remote_server_free(run->remoteServer);
+    }
+    if (run->debugProxy) {
+        if (run->attachWaitPending) {
+            // the launch it waits for never happened
+            IdeviceFfiError* err = debug_proxy_send_raw(run->debugProxy, (const uint8_t*)"\x03", 1);
+            if (err) {
+                idevice_error_free(err);
+            }
+        }
+        debug_session_close(run->debugProxy);
+        debug_proxy_free(run->debugProxy);
     }
+    rsp_reader_free(&run->reader);
+}
 
-    AdapterStreamHandle *stream = NULL;
-    err = adapter_connect(adapter, rsd_port, (ReadWriteOpaque **)&stream);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to connect to RSD port: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      adapter_free(adapter);
-      return 1;
+static int (* const debugStageFunctions[DEBUG_STAGE_COUNT])(DebugRun* run) = {
+    [DEBUG_STAGE_REMOTE_SERVER] = stage_remote_server,
+    [DEBUG_STAGE_LAUNCH] = stage_launch,
+    [DEBUG_STAGE_DEBUG_PROXY] = stage_debug_proxy,
+    [DEBUG_STAGE_ATTACH] = stage_attach,
+    [DEBUG_STAGE_DETACH] = stage_detach,
+};
+
+// the debug proxy branch doesn't need the launch, so it goes first and its requests stay in
+// flight while ProcessControl launches; the adapter isn't thread safe, so the connects themselves
+// stay on this thread and only debugserver's side of the work overlaps
+static const DebugStage processControlStages[] = {
+    DEBUG_STAGE_DEBUG_PROXY, DEBUG_STAGE_REMOTE_SERVER, DEBUG_STAGE_LAUNCH, DEBUG_STAGE_ATTACH, DEBUG_STAGE_DETACH,
+};
+static const DebugStage debugserverStages[] = {
+    DEBUG_STAGE_DEBUG_PROXY, DEBUG_STAGE_LAUNCH, DEBUG_STAGE_ATTACH, DEBUG_STAGE_DETACH,
+};
+static const DebugStage attachStages[] = {
+    DEBUG_STAGE_DEBUG_PROXY, DEBUG_STAGE_ATTACH, DEBUG_STAGE_DETACH,
+};
+
+// which stages the run goes through, in order
+static bool debug_run_has_stage(const DebugRun* run, DebugStage stage) {
+    if (!run->bundleId) {
+        return stage == DEBUG_STAGE_DEBUG_PROXY || stage == DEBUG_STAGE_ATTACH || stage == DEBUG_STAGE_DETACH;
     }
-    printf("Successfully connected to RSD port\n");
+    return stage != DEBUG_STAGE_REMOTE_SERVER || run->mode != DEBUG_LAUNCH_DEBUGSERVER;
+}
 
-    printf("\n=== Performing RSD Handshake ===\n");
+static void debug_run_start(DebugRun* run, DebugStageTimings* timings) {
+    memset(timings, 0, sizeof(*timings));
+    timings->failedStage = DEBUG_STAGE_COUNT;
+    rsp_reader_init(&run->reader, 4096);
+}
 
-    RsdHandshakeHandle *handshake = NULL;
-    err = rsd_handshake_new((ReadWriteOpaque *)stream, &handshake);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to perform RSD handshake: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      adapter_close(stream);
-      adapter_free(adapter);
-      return 1;
+// times one stage
+static int debug_run_stage(DebugRun* run, DebugStage stage, DebugStageTimings* timings) {
+    uint64_t stageStart = jit_now_micros();
+    int ret = debugStageFunctions[stage](run);
+    if (ret == DEBUG_APP_TUNNEL_FAILED && run->launchStarted) {
+        // the app may be running already, a retry on a rebuilt tunnel would launch it again
+        ret = 1;
     }
+    timings->micros[stage] += jit_now_micros() - stageStart;
+    if (ret) {
+        timings->failedStage = stage;
+        run->logger("Debug request failed in stage %s", debug_stage_name(stage));
+    }
+    return ret;
+}
+
+// cleans up and completes timings, the tunnel (re)build the request waited for is handed to it here
+static void debug_run_finish(DebugRun* run, DebugStageTimings* timings, int ret) {
+    DeviceTunnel* tunnel = run->tunnel;
+    debug_run_cleanup(run);
     
-    // Create RemoteServerClient
-    RemoteServerHandle *remote_server = NULL;
-    err = remote_server_connect_rsd(adapter, handshake, &remote_server);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to create remote server: [%d] %s", err->code,
-              err->message);
-      idevice_error_free(err);
-      adapter_free(adapter);
-      rsd_handshake_free(handshake);
-      return 1;
+    timings->micros[DEBUG_STAGE_PROXY] += tunnel->proxyMicros;
+    timings->micros[DEBUG_STAGE_ADAPTER] += tunnel->adapterMicros;
+    timings->micros[DEBUG_STAGE_HANDSHAKE] += tunnel->handshakeMicros;
+    tunnel->proxyMicros = 0;
+    tunnel->adapterMicros = 0;
+    tunnel->handshakeMicros = 0;
+    timings->pid = run->pid;
+    
+    char summary[512];
+    size_t length = 0;
+    timings->totalMicros = 0;
+    for (int stage = 0; stage < DEBUG_STAGE_COUNT; stage++) {
+        timings->totalMicros += timings->micros[stage];
+        if (timings->micros[stage] && length < sizeof(summary)) {
+            length += snprintf(summary + length, sizeof(summary) - length, "%s %llu us, ", debug_stage_name(stage), (unsigned long long)timings->micros[stage]);
+        }
+    }
+    run->logger("Debug request stage timings (pid %d): %stotal %llu us", run->pid, length < sizeof(summary) ? summary : "", (unsigned long long)timings->totalMicros);
+    if (ret == 0) {
+        run->logger("Debug session completed");
     }
+}
 
-    printf("\n=== Setting up Debug Proxy ===\n");
+// runs stages in order until one fails
+static int debug_run(DebugRun* run, const DebugStage* stages, size_t stageCount, DebugStageTimings* timings) {
+    debug_run_start(run, timings);
+    int ret = 0;
+    for (size_t i = 0; i < stageCount && ret == 0; i++) {
+        ret = debug_run_stage(run, stages[i], timings);
+    }
+    debug_run_finish(run, timings, ret);
+    return ret;
+}
 
-    DebugProxyHandle *debug_proxy = NULL;
-    err = debug_proxy_connect_rsd(adapter, handshake, &debug_proxy);
-    if (err != NULL) {
-      fprintf(stderr, "Failed to create debug proxy client: [%d] %s\n", err->code,
-              err->message);
-      idevice_error_free(err);
-      rsd_handshake_free(handshake);
-      adapter_free(adapter);
-      return 1;
+// falls back to ProcessControl when the requested mode can't serve this launch
+static DebugLaunchMode debug_launch_mode(const DebugLaunchOptions* options, DebugAppCallback callback, LogFuncC logger) {
+    DebugLaunchMode mode = options ? options->mode : DEBUG_LAUNCH_PROCESS_CONTROL;
+    if (mode == DEBUG_LAUNCH_ATTACH_WAIT && (callback || !options->executableName)) {
+        // scripts attach on their own, and vAttachWait needs the executable name
+        logger("Attach wait unavailable for this launch, launching through ProcessControl");
+        mode = DEBUG_LAUNCH_PROCESS_CONTROL;
     }
+    if (mode == DEBUG_LAUNCH_DEBUGSERVER && (callback || !options->executablePath)) {
+        // same for the A packet, which also needs the executable's path
+        logger("debugserver launch unavailable for this launch, launching through ProcessControl");
+        mode = DEBUG_LAUNCH_PROCESS_CONTROL;
+    }
+    return mode;
+}
+
+int debug_app(DeviceTunnel* tunnel, const char *bundle_id, const DebugLaunchOptions* options, LogFuncC logger, DebugAppCallback callback, DebugStageTimings* timings) {
+    // Initialize logger
+    idevice_init_logger(Info, Disabled, NULL);
     
+    DebugRun run = {
+        .tunnel = tunnel,
+        .bundleId = bundle_id,
+        .mode = debug_launch_mode(options, callback, logger),
+        .options = options,
+        .logger = logger,
+        .callback = callback,
+    };
+    DebugStageTimings localTimings;
+    if (run.mode == DEBUG_LAUNCH_DEBUGSERVER) {
+        return debug_run(&run, debugserverStages, sizeof(debugserverStages) / sizeof(*debugserverStages), timings ? timings : &localTimings);
+    }
+    return debug_run(&run, processControlStages, sizeof(processControlStages) / sizeof(*processControlStages), timings ? timings : &localTimings);
+}
+
+int debug_app_pid(DeviceTunnel* tunnel, int pid, LogFuncC logger, DebugAppCallback callback, DebugStageTimings* timings) {
+    DebugRun run = {
+        .tunnel = tunnel,
+        .pid = pid,
+        .mode = DEBUG_LAUNCH_PROCESS_CONTROL,
+        .logger = logger,
+        .callback = callback,
+    };
+    DebugStageTimings localTimings;
+    return debug_run(&run, attachStages, sizeof(attachStages) / sizeof(*attachStages), timings ? timings : &localTimings);
+}
+
+int debug_apps(DeviceTunnel* tunnel, DebugTarget* targets, size_t count, LogFuncC logger) {
+    idevice_init_logger(Info, Disabled, NULL);
     
-    runDebugServerCommand(pid, debug_proxy, logger, callback);
+    DebugRun* runs = calloc(count, sizeof(DebugRun));
+    bool* failed = calloc(count, sizeof(bool));
+    for (size_t i = 0; i < count; i++) {
+        runs[i] = (DebugRun){
+            .tunnel = tunnel,
+            .bundleId = targets[i].bundleId,
+            .pid = targets[i].bundleId ? 0 : targets[i].pid,
+            .mode = targets[i].bundleId ? debug_launch_mode(targets[i].options, NULL, logger) : DEBUG_LAUNCH_PROCESS_CONTROL,
+            .options = targets[i].options,
+            .logger = logger,
+        };
+        debug_run_start(&runs[i], &targets[i].timings);
+        targets[i].result = 0;
+    }
     
-    /*****************************************************************
-     * Cleanup
-     *****************************************************************/
-    debug_proxy_free(debug_proxy);
-    rsd_handshake_free(handshake);
-    adapter_free(adapter);
+    // stage by stage across all targets instead of target by target: every connection gets its own
+    // debugserver, so requests sent to all of them before any reply is read overlap on the device
+    static const DebugStage batchStages[] = {
+        DEBUG_STAGE_DEBUG_PROXY, DEBUG_STAGE_REMOTE_SERVER, DEBUG_STAGE_LAUNCH, DEBUG_STAGE_ATTACH, DEBUG_STAGE_DETACH,
+    };
+    DebugRun* processControlOwner = NULL;
+    for (size_t s = 0; s < sizeof(batchStages) / sizeof(*batchStages); s++) {
+        DebugStage stage = batchStages[s];
+        for (size_t i = 0; i < count; i++) {
+            if (failed[i] || !debug_run_has_stage(&runs[i], stage)) {
+                continue;
+            }
+            if (stage == DEBUG_STAGE_ATTACH || stage == DEBUG_STAGE_DETACH) {
+                uint64_t sendStart = jit_now_micros();
+                int ret = stage == DEBUG_STAGE_ATTACH ? debug_run_begin_attach(&runs[i]) : debug_run_begin_detach(&runs[i]);
+                targets[i].timings.micros[stage] += jit_now_micros() - sendStart;
+                if (ret) {
+                    targets[i].timings.failedStage = stage;
+                    targets[i].result = ret;
+                    failed[i] = true;
+                }
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (failed[i] || !debug_run_has_stage(&runs[i], stage)) {
+                continue;
+            }
+            if (stage == DEBUG_STAGE_REMOTE_SERVER && processControlOwner) {
+                // one ProcessControl launches every app
+                runs[i].processControl = processControlOwner->processControl;
+                runs[i].borrowsProcessControl = true;
+                continue;
+            }
+            int ret = debug_run_stage(&runs[i], stage, &targets[i].timings);
+            if (ret) {
+                targets[i].result = ret;
+                failed[i] = true;
+            } else if (stage == DEBUG_STAGE_REMOTE_SERVER) {
+                processControlOwner = &runs[i];
+            }
+        }
+    }
     
-    logger("Debug session completed");
-    return 0;
+    // the first target is charged with the tunnel work, like a single request would be;
+    // borrowers never free the owner's ProcessControl, so the order doesn't matter otherwise
+    size_t failedCount = 0;
+    bool tunnelFailed = count > 0;
+    for (size_t i = 0; i < count; i++) {
+        debug_run_finish(&runs[i], &targets[i].timings, targets[i].result);
+        failedCount += targets[i].result != 0;
+        tunnelFailed &= targets[i].result == DEBUG_APP_TUNNEL_FAILED;
+    }
+    free(failed);
+    free(runs);
+    if (tunnelFailed) {
+        return DEBUG_APP_TUNNEL_FAILED;
+    }
+    return failedCount ? 1 : 0;
 }
@@ -9,10 +9,86 @@
 #ifndef JIT_H
 #define JIT_H
 #include "idevice.h"
+#include "device_tunnel.h"
 
 typedef void (^LogFuncC)(const char* message, ...);
 typedef void (^DebugAppCallback)(int pid, struct DebugProxyHandle* debug_proxy, dispatch_semaphore_t semaphore);
-int debug_app(IdeviceProviderHandle* tcp_provider, const char *bundle_id, LogFuncC logger, DebugAppCallback callback);
-int debug_app_pid(IdeviceProviderHandle* tcp_provider, int pid, LogFuncC logger, DebugAppCallback callback);
+
+typedef enum DebugLaunchMode {
+    // launch suspended through ProcessControl, then connect the debug proxy and vAttach
+    DEBUG_LAUNCH_PROCESS_CONTROL = 0,
+    // connect the debug proxy and arm vAttachWait first, so debugserver attaches as soon as the launch lands
+    DEBUG_LAUNCH_ATTACH_WAIT = 1,
+    // let debugserver spawn the app itself with the A packet, no RemoteServer/ProcessControl connection at all
+    DEBUG_LAUNCH_DEBUGSERVER = 2,
+} DebugLaunchMode;
+
+typedef struct DebugLaunchOptions {
+    DebugLaunchMode mode;
+    // CFBundleExecutable of the app, vAttachWait waits for a process of this name
+    const char* executableName;
+    // full path of the executable inside the app bundle, argv[0] of a debugserver launch
+    const char* executablePath;
+    // extra arguments after argv[0], and "KEY=VALUE" environment entries, of a debugserver launch.
+    // the other modes launch through ProcessControl exactly as before and ignore them
+    const char* const* arguments;
+    size_t argumentCount;
+    const char* const* environment;
+    size_t environmentCount;
+    // working directory of a debugserver launch, may be NULL
+    const char* workingDirectory;
+} DebugLaunchOptions;
+
+// returned when a service connect over the tunnel failed before the launch stage began, nothing was
+// launched or attached and the request can be retried on a rebuilt tunnel. failures from the launch
+// on are reported as 1
+#define DEBUG_APP_TUNNEL_FAILED 2
+
+// stages of a debug request, in the order ProcessControl launches go through them. the first three
+// build the DeviceTunnel and show up in the first request after a (re)build only
+typedef enum DebugStage {
+    DEBUG_STAGE_PROXY = 0,
+    DEBUG_STAGE_ADAPTER,
+    DEBUG_STAGE_HANDSHAKE,
+    DEBUG_STAGE_REMOTE_SERVER,
+    DEBUG_STAGE_LAUNCH,
+    DEBUG_STAGE_DEBUG_PROXY,
+    DEBUG_STAGE_ATTACH,
+    DEBUG_STAGE_DETACH,
+    DEBUG_STAGE_COUNT,
+} DebugStage;
+
+typedef struct DebugStageTimings {
+    // monotonic time spent in each stage, 0 for stages the request skipped
+    uint64_t micros[DEBUG_STAGE_COUNT];
+    uint64_t totalMicros;
+    // stage that failed, DEBUG_STAGE_COUNT if none did
+    DebugStage failedStage;
+    // process the request launched or attached to, 0 if it never got that far
+    int pid;
+} DebugStageTimings;
+
+const char* debug_stage_name(DebugStage stage);
+
+// both borrow the tunnel, which stays open for the next request, and return 0 on success.
+// options may be NULL for a ProcessControl launch, timings may be NULL
+int debug_app(DeviceTunnel* tunnel, const char *bundle_id, const DebugLaunchOptions* options, LogFuncC logger, DebugAppCallback callback, DebugStageTimings* timings);
+int debug_app_pid(DeviceTunnel* tunnel, int pid, LogFuncC logger, DebugAppCallback callback, DebugStageTimings* timings);
+
+typedef struct DebugTarget {
+    // app to launch, or NULL to attach to pid
+    const char* bundleId;
+    int pid;
+    // launch options of bundleId, may be NULL
+    const DebugLaunchOptions* options;
+    // filled in: 0 on success, and the target's own stage timings
+    int result;
+    DebugStageTimings timings;
+} DebugTarget;
+
+// enables JIT for every target over the tunnel, one debug proxy connection each and one
+// ProcessControl for all launches. returns 0 if every target succeeded, DEBUG_APP_TUNNEL_FAILED
+// if none got past the tunnel, 1 otherwise
+int debug_apps(DeviceTunnel* tunnel, DebugTarget* targets, size_t count, LogFuncC logger);
 
 #endif /* JIT_H */
@@ -0,0 +1,317 @@
+//
+//  jit_trap.c
+//  StikJIT
+//
+//  Services the brk traps a TXM app raises to get JIT memory prepared, entirely
+//  natively: continue, read the stop, handle the request, step past the brk.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit_trap.h"
+#include "rsp.h"
+#include "debug_session.h"
+
+#define JIT_TRAP_REGISTER_X0 0
+#define JIT_TRAP_REGISTER_X1 1
+#define JIT_TRAP_REGISTER_X16 16
+#define JIT_TRAP_REGISTER_PC 32
+// pc values already known to hold the trap instruction, so its memory isn't read again
+#define JIT_TRAP_KNOWN_SITES 16
+
+typedef struct JitTrapState {
+    DebugProxyHandle* debugProxy;
+    RspPacketReader reader;
+    // run-length expanded text of the last packet read
+    char* text;
+    size_t textCapacity;
+    size_t textLength;
+    // packets queued to go out in the next send
+    char* out;
+    size_t outCapacity;
+    size_t outLength;
+    uint32_t outCount;
+} JitTrapState;
+
+static void jit_trap_queue(JitTrapState* state, const char* command) {
+    size_t commandLength = strlen(command);
+    if(state->outLength + commandLength + 4 > state->outCapacity) {
+        state->outCapacity = (state->outLength + commandLength + 4) * 2;
+        state->out = realloc(state->out, state->outCapacity);
+    }
+    state->outLength += rsp_build_packet(state->out + state->outLength, command, commandLength);
+    ++state->outCount;
+}
+
+// sends every queued packet at once
+static int jit_trap_flush(JitTrapState* state, IdeviceFfiError** errOut) {
+    IdeviceFfiError* err = debug_proxy_send_raw(state->debugProxy, (const uint8_t*)state->out, state->outLength);
+    state->outLength = 0;
+    state->outCount = 0;
+    if(err) {
+        *errOut = err;
+        return -1;
+    }
+    return 0;
+}
+
+// reads the next packet into state->text, run-length expanded
+static int jit_trap_read(JitTrapState* state, IdeviceFfiError** errOut) {
+    const char* payload = 0;
+    size_t payloadLength = 0;
+    int ret = rsp_reader_next(state->debugProxy, &state->reader, &payload, &payloadLength, errOut);
+    if(ret) {
+        return ret;
+    }
+    size_t expandedLength = rsp_expanded_length(payload, payloadLength);
+    if(expandedLength + 1 > state->textCapacity) {
+        state->textCapacity = expandedLength + 1;
+        state->text = realloc(state->text, state->textCapacity);
+    }
+    int64_t decoded = rsp_decode_payload((uint8_t*)state->text, expandedLength, payload, payloadLength, payload + payloadLength + 1, false);
+    state->textLength = decoded < 0 ? 0 : (size_t)decoded;
+    state->text[state->textLength] = 0;
+    return 0;
+}
+
+// reads the "OK"s answering count queued requests, returns -3 at the first other reply
+static int jit_trap_expect_ok(JitTrapState* state, uint32_t count, IdeviceFfiError** errOut) {
+    int ret = 0;
+    for(uint32_t i = 0; i < count; ++i) {
+        int readRet = jit_trap_read(state, errOut);
+        if(readRet) {
+            return readRet;
+        }
+        if(ret == 0 && strcmp(state->text, "OK") != 0) {
+            ret = -3;
+        }
+    }
+    return ret;
+}
+
+// reads the stop reply to a resume into state->text, skipping the console output (O packets)
+// that arrives while the process runs
+static int jit_trap_read_stop(JitTrapState* state, IdeviceFfiError** errOut) {
+    int ret;
+    do {
+        ret = jit_trap_read(state, errOut);
+    } while(ret == 0 && state->text[0] == 'O' && strcmp(state->text, "OK") != 0);
+    return ret;
+}
+
+// sends one request and reads its reply into state->text
+static int jit_trap_request(JitTrapState* state, const char* command, IdeviceFfiError** errOut) {
+    jit_trap_queue(state, command);
+    int ret = jit_trap_flush(state, errOut);
+    return ret ? ret : jit_trap_read(state, errOut);
+}
+
+// register from the stop reply, read with p if debugserver didn't expedite it
+static int jit_trap_register(JitTrapState* state, const StopReply* stop, uint16_t number, uint64_t* value, IdeviceFfiError** errOut) {
+    if(stop_reply_register(stop, number, value)) {
+        return 0;
+    }
+    char command[64];
+    snprintf(command, sizeof(command), "p%x;thread:%llx;", number, (unsigned long long)stop->thread);
+    int ret = jit_trap_request(state, command, errOut);
+    if(ret) {
+        return ret;
+    }
+    if(state->textLength < 16 || state->text[0] == 'E') {
+        return -3;
+    }
+    *value = stop_reply_le_value(state->text, 16);
+    return 0;
+}
+
+static void jit_trap_register_command(char* out, size_t outSize, uint16_t number, uint64_t value, uint64_t thread) {
+    char hex[17];
+    for(int i = 0; i < 8; ++i) {
+        snprintf(hex + 2 * i, 3, "%02x", (unsigned)(value >> (8 * i)) & 0xff);
+    }
+    snprintf(out, outSize, "P%x=%s;thread:%llx;", number, hex, (unsigned long long)thread);
+}
+
+static void jit_trap_copy_text(const JitTrapState* state, char* stopText, size_t stopTextSize) {
+    if(stopTextSize == 0) {
+        return;
+    }
+    size_t length = state->textLength < stopTextSize - 1 ? state->textLength : stopTextSize - 1;
+    memcpy(stopText, state->text, length);
+    stopText[length] = 0;
+}
+
+int jit_trap_loop(DebugProxyHandle* debugProxy, uint64_t pageSize, JitTrapStats* stats, StopReply* stop, char* stopText, size_t stopTextSize, int* outcome, IdeviceFfiError** errOut) {
+    JitTrapState state = { .debugProxy = debugProxy };
+    rsp_reader_init(&state.reader, 8192);
+    DebugSession* session = debug_session_get(debugProxy);
+    uint64_t knownSites[JIT_TRAP_KNOWN_SITES];
+    size_t knownSiteCount = 0;
+    memset(stats, 0, sizeof(JitTrapStats));
+    
+    // OKs still to be read for requests queued in front of the resume
+    uint32_t pendingOk = 0;
+    jit_trap_queue(&state, "c");
+    int ret = 0;
+    while(true) {
+        // the register writes finishing the last trap go out together with the resume
+        if(session) {
+            debug_session_note_command(session, "c");
+        }
+        ret = jit_trap_flush(&state, errOut);
+        if(ret) {
+            break;
+        }
+        ret = jit_trap_expect_ok(&state, pendingOk, errOut);
+        pendingOk = 0;
+        if(ret == -3) {
+            // a register write finishing the last trap was refused, but the resume went out behind it.
+            // read the stop the process runs into so no reply is left on the connection, stopText
+            // keeps the trap that failed
+            int stopRet = jit_trap_read_stop(&state, errOut);
+            if(stopRet) {
+                ret = stopRet;
+            } else if(session) {
+                debug_session_record_stop(session, state.text, state.textLength);
+            }
+            break;
+        }
+        if(ret) {
+            break;
+        }
+        ret = jit_trap_read_stop(&state, errOut);
+        if(ret) {
+            break;
+        }
+        uint64_t stopTime = rsp_now_micros();
+        ++stats->stopCount;
+        jit_trap_copy_text(&state, stopText, stopTextSize);
+        if(!stop_reply_parse(state.text, state.textLength, stop)) {
+            ret = -3;
+            break;
+        }
+        if(session) {
+            // a stop handed back to the script answers its register reads from the cache
+            debug_session_record_stop(session, state.text, state.textLength);
+        }
+        if(stop->kind == 'W' || stop->kind == 'X') {
+            *outcome = JIT_TRAP_EXITED;
+            break;
+        }
+        *outcome = JIT_TRAP_UNHANDLED_STOP;
+        if(stop->kind != 'T' || !stop->hasThread) {
+            break;
+        }
+        
+        uint64_t pc = 0;
+        uint64_t command = 0;
+        if((ret = jit_trap_register(&state, stop, JIT_TRAP_REGISTER_PC, &pc, errOut))) {
+            break;
+        }
+        bool known = false;
+        for(size_t i = 0; i < knownSiteCount && !known; ++i) {
+            known = knownSites[i] == pc;
+        }
+        if(!known) {
+            char readCommand[48];
+            snprintf(readCommand, sizeof(readCommand), "m%llx,4", (unsigned long long)pc);
+            if((ret = jit_trap_request(&state, readCommand, errOut))) {
+                break;
+            }
+            ++stats->instructionReads;
+            uint8_t instruction[4];
+            if(state.textLength != 8 || !rsp_hex_decode(instruction, state.text, 8)) {
+                break;
+            }
+            uint32_t value = instruction[0] | instruction[1] << 8 | instruction[2] << 16 | (uint32_t)instruction[3] << 24;
+            if(value != JIT_TRAP_INSTRUCTION) {
+                break;
+            }
+            if(knownSiteCount < JIT_TRAP_KNOWN_SITES) {
+                knownSites[knownSiteCount++] = pc;
+            }
+        }
+        if((ret = jit_trap_register(&state, stop, JIT_TRAP_REGISTER_X16, &command, errOut))) {
+            break;
+        }
+        if(command != JIT_TRAP_COMMAND_DETACH && command != JIT_TRAP_COMMAND_PREPARE_REGION) {
+            // a trap this loop doesn't know, the script may
+            break;
+        }
+        
+        char registerCommand[80];
+        if(command == JIT_TRAP_COMMAND_PREPARE_REGION) {
+            uint64_t addr = 0;
+            uint64_t size = 0;
+            if((ret = jit_trap_register(&state, stop, JIT_TRAP_REGISTER_X0, &addr, errOut)) ||
+               (ret = jit_trap_register(&state, stop, JIT_TRAP_REGISTER_X1, &size, errOut))) {
+                break;
+            }
+            if(addr == 0) {
+                char allocateCommand[48];
+                snprintf(allocateCommand, sizeof(allocateCommand), "_M%llx,rx", (unsigned long long)size);
+                if(session) {
+                    debug_session_note_command(session, allocateCommand);
+                }
+                if((ret = jit_trap_request(&state, allocateCommand, errOut))) {
+                    break;
+                }
+                if(state.textLength == 0 || state.text[0] == 'E') {
+                    ret = -3;
+                    break;
+                }
+                addr = strtoull(state.text, NULL, 16);
+            }
+            RspMemoryRegion region = { .start = addr, .size = size };
+            ret = rsp_prepare_memory_regions(debugProxy, &region, 1, pageSize, NULL, errOut);
+            if(ret) {
+                break;
+            }
+            if(region.failedPage >= 0) {
+                ret = -3;
+                break;
+            }
+            ++stats->prepareCount;
+            stats->preparedBytes += size;
+            jit_trap_register_command(registerCommand, sizeof(registerCommand), JIT_TRAP_REGISTER_X0, addr, stop->thread);
+            jit_trap_queue(&state, registerCommand);
+        }
+        // step over the brk
+        jit_trap_register_command(registerCommand, sizeof(registerCommand), JIT_TRAP_REGISTER_PC, pc + 4, stop->thread);
+        jit_trap_queue(&state, registerCommand);
+        pendingOk = state.outCount;
+        ++stats->trapCount;
+        
+        if(command == JIT_TRAP_COMMAND_DETACH) {
+            if(session) {
+                // the process and its prepared pages are gone for this session
+                debug_session_note_command(session, "D");
+            }
+            jit_trap_queue(&state, "D");
+            ret = jit_trap_flush(&state, errOut);
+            uint64_t elapsed = rsp_now_micros() - stopTime;
+            stats->totalMicros += elapsed;
+            stats->minMicros = stats->trapCount == 1 || elapsed < stats->minMicros ? elapsed : stats->minMicros;
+            stats->maxMicros = elapsed > stats->maxMicros ? elapsed : stats->maxMicros;
+            if(ret == 0) {
+                // the detach's own reply is one more OK
+                ret = jit_trap_expect_ok(&state, pendingOk + 1, errOut);
+            }
+            if(ret == 0) {
+                *outcome = JIT_TRAP_DETACHED;
+            }
+            break;
+        }
+        jit_trap_queue(&state, "c");
+        uint64_t elapsed = rsp_now_micros() - stopTime;
+        stats->totalMicros += elapsed;
+        stats->minMicros = stats->trapCount == 1 || elapsed < stats->minMicros ? elapsed : stats->minMicros;
+        stats->maxMicros = elapsed > stats->maxMicros ? elapsed : stats->maxMicros;
+    }
+    rsp_reader_free(&state.reader);
+    free(state.text);
+    free(state.out);
+    return ret;
+}
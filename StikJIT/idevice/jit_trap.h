@@ -0,0 +1,46 @@
+//
+//  jit_trap.h
+//  StikJIT
+//
+//  Services the brk traps a TXM app raises to get JIT memory prepared, entirely
+//  natively: continue, read the stop, handle the request, step past the brk.
+//
+
+#ifndef JIT_TRAP_H
+#define JIT_TRAP_H
+#include "idevice.h"
+#include "stop_reply.h"
+
+// brk #0xf00d, x16 says what the app wants
+#define JIT_TRAP_INSTRUCTION 0xd43e01a0
+#define JIT_TRAP_COMMAND_DETACH 0
+// x0 = address to prepare (0 to have one allocated), x1 = size; the prepared address is returned in x0
+#define JIT_TRAP_COMMAND_PREPARE_REGION 1
+
+// why jit_trap_loop returned
+#define JIT_TRAP_DETACHED 0
+// a stop that isn't a known trap, the process is left stopped exactly as it was reported
+#define JIT_TRAP_UNHANDLED_STOP 1
+#define JIT_TRAP_EXITED 2
+
+typedef struct JitTrapStats {
+    uint64_t stopCount;
+    uint64_t trapCount;
+    uint64_t prepareCount;
+    uint64_t preparedBytes;
+    // instruction reads needed to recognize traps, repeated trap sites are remembered
+    uint64_t instructionReads;
+    // per trap, from its stop reply arriving to the resume being sent
+    uint64_t totalMicros;
+    uint64_t minMicros;
+    uint64_t maxMicros;
+} JitTrapStats;
+
+// resumes the stopped, attached process and services its traps until it detaches, exits or stops
+// for another reason. the last stop reply is copied to stopText (NUL terminated) and parsed into stop.
+// returns 0 with *outcome set, -1 if the connection failed (*errOut is set), -2 if debugserver closed it,
+// -3 if debugserver refused a request while servicing the trap in stopText. a refused register write
+// still lets the resume sent with it run, the stop the process reaches next is recorded in its DebugSession
+int jit_trap_loop(DebugProxyHandle* debugProxy, uint64_t pageSize, JitTrapStats* stats, StopReply* stop, char* stopText, size_t stopTextSize, int* outcome, IdeviceFfiError** errOut);
+
+#endif /* JIT_TRAP_H */
@@ -0,0 +1,264 @@
+//
+//  memory_scan.c
+//  StikJIT
+//
+//  Searches the debugged process's readable memory for a byte pattern, streaming
+//  each region through pipelined reads so only one chunk is held at a time.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory_scan.h"
+#include "rsp.h"
+#include "debug_session.h"
+
+static int scan_hex_value(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool scan_pattern_parse(const char* text, ScanPattern* pattern) {
+    size_t textLength = strlen(text);
+    pattern->bytes = malloc(textLength + 1);
+    pattern->mask = malloc(textLength + 1);
+    pattern->length = 0;
+    pattern->anchor = -1;
+    const char* cur = text;
+    while(*cur) {
+        if(*cur == ' ') {
+            ++cur;
+            continue;
+        }
+        // a token is one or two characters up to the next space
+        size_t tokenLength = strcspn(cur, " ");
+        uint8_t byte = 0;
+        uint8_t mask = 0;
+        if(tokenLength == 1 && cur[0] == '?') {
+            // any byte
+        } else if(tokenLength == 2) {
+            for(int i = 0; i < 2; ++i) {
+                uint8_t shift = i == 0 ? 4 : 0;
+                if(cur[i] == '?') {
+                    continue;
+                }
+                int value = scan_hex_value(cur[i]);
+                if(value < 0) {
+                    scan_pattern_free(pattern);
+                    return false;
+                }
+                byte |= value << shift;
+                mask |= 0xf << shift;
+            }
+        } else {
+            scan_pattern_free(pattern);
+            return false;
+        }
+        pattern->bytes[pattern->length] = byte;
+        pattern->mask[pattern->length] = mask;
+        ++pattern->length;
+        cur += tokenLength;
+    }
+    if(pattern->length == 0) {
+        scan_pattern_free(pattern);
+        return false;
+    }
+    // locate candidates by a fully fixed byte, 0x00 and 0xff are everywhere in memory so avoid them if possible
+    for(size_t i = 0; i < pattern->length; ++i) {
+        if(pattern->mask[i] != 0xff) {
+            continue;
+        }
+        if(pattern->anchor < 0) {
+            pattern->anchor = (int64_t)i;
+        }
+        if(pattern->bytes[i] != 0x00 && pattern->bytes[i] != 0xff) {
+            pattern->anchor = (int64_t)i;
+            break;
+        }
+    }
+    return true;
+}
+
+void scan_pattern_choose_anchor(ScanPattern* pattern, const uint8_t* sample, size_t length) {
+    if(pattern->anchor < 0 || length == 0) {
+        return;
+    }
+    uint32_t counts[256] = {0};
+    for(size_t i = 0; i < length; ++i) {
+        ++counts[sample[i]];
+    }
+    for(size_t i = 0; i < pattern->length; ++i) {
+        if(pattern->mask[i] == 0xff && counts[pattern->bytes[i]] < counts[pattern->bytes[pattern->anchor]]) {
+            pattern->anchor = (int64_t)i;
+        }
+    }
+}
+
+void scan_pattern_free(ScanPattern* pattern) {
+    free(pattern->bytes);
+    free(pattern->mask);
+    pattern->bytes = 0;
+    pattern->mask = 0;
+    pattern->length = 0;
+}
+
+static inline bool scan_pattern_matches(const ScanPattern* pattern, const uint8_t* data) {
+    for(size_t i = 0; i < pattern->length; ++i) {
+        if((data[i] & pattern->mask[i]) != pattern->bytes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool scan_pattern_find(const ScanPattern* pattern, const uint8_t* data, size_t length, bool (*onHit)(void* userData, size_t offset), void* userData) {
+    if(length < pattern->length) {
+        return true;
+    }
+    size_t lastStart = length - pattern->length;
+    if(pattern->anchor < 0) {
+        for(size_t offset = 0; offset <= lastStart; ++offset) {
+            if(scan_pattern_matches(pattern, data + offset) && !onHit(userData, offset)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // memchr is vectorized, it skips ahead to the next place the anchor byte could line up
+    size_t anchor = (size_t)pattern->anchor;
+    uint8_t anchorByte = pattern->bytes[anchor];
+    const uint8_t* cur = data + anchor;
+    const uint8_t* last = data + lastStart + anchor;
+    while(cur <= last) {
+        const uint8_t* found = memchr(cur, anchorByte, last - cur + 1);
+        if(!found) {
+            break;
+        }
+        size_t offset = (size_t)(found - data) - anchor;
+        if(scan_pattern_matches(pattern, data + offset) && !onHit(userData, offset)) {
+            return false;
+        }
+        cur = found + 1;
+    }
+    return true;
+}
+
+typedef struct MemoryScanner {
+    // the caller's pattern with an anchor chosen for the region being read
+    ScanPattern pattern;
+    bool anchorChosen;
+    ScanResult* result;
+    size_t maxHits;
+    size_t hitCapacity;
+    // the previous chunk's last pattern length - 1 bytes followed by the current chunk,
+    // so matches straddling two reads are found
+    uint8_t* window;
+    size_t windowCapacity;
+    size_t carried;
+    uint64_t windowAddr;
+    uint64_t regionAddr;
+} MemoryScanner;
+
+static bool memory_scan_hit(void* userData, size_t offset) {
+    MemoryScanner* scanner = userData;
+    ScanResult* result = scanner->result;
+    if(result->hitCount == scanner->hitCapacity) {
+        scanner->hitCapacity = scanner->hitCapacity ? scanner->hitCapacity * 2 : 64;
+        result->hits = realloc(result->hits, scanner->hitCapacity * sizeof(uint64_t));
+    }
+    result->hits[result->hitCount++] = scanner->windowAddr + offset;
+    return scanner->maxHits == 0 || result->hitCount < scanner->maxHits;
+}
+
+static bool memory_scan_sink(void* userData, uint64_t offset, const uint8_t* data, size_t length) {
+    MemoryScanner* scanner = userData;
+    if(scanner->carried + length > scanner->windowCapacity) {
+        scanner->windowCapacity = scanner->carried + length;
+        scanner->window = realloc(scanner->window, scanner->windowCapacity);
+    }
+    memcpy(scanner->window + scanner->carried, data, length);
+    size_t windowLength = scanner->carried + length;
+    scanner->windowAddr = scanner->regionAddr + offset - scanner->carried;
+    scanner->result->bytesScanned += length;
+    if(!scanner->anchorChosen) {
+        scan_pattern_choose_anchor(&scanner->pattern, data, length);
+        scanner->anchorChosen = true;
+    }
+    if(!scan_pattern_find(&scanner->pattern, scanner->window, windowLength, memory_scan_hit, scanner)) {
+        // enough hits, abort the read
+        return false;
+    }
+    size_t keep = scanner->pattern.length - 1;
+    if(keep > windowLength) {
+        keep = windowLength;
+    }
+    memmove(scanner->window, scanner->window + windowLength - keep, keep);
+    scanner->carried = keep;
+    return true;
+}
+
+int memory_scan(DebugProxyHandle* debugProxy, const RegionMap* map, uint64_t start, uint64_t end, const ScanPattern* pattern, uint64_t pageSize, size_t maxHits, ScanResult* result, IdeviceFfiError** errOut) {
+    memset(result, 0, sizeof(ScanResult));
+    MemoryScanner scanner = {
+        .pattern = *pattern,
+        .result = result,
+        .maxHits = maxHits,
+    };
+    int ret = 0;
+    for(size_t i = 0; i < map->count; ++i) {
+        const MappedRegion* region = &map->regions[i];
+        uint64_t regionStart = region->start > start ? region->start : start;
+        uint64_t regionEnd = region->start + region->size < end ? region->start + region->size : end;
+        if(!(region->permissions & MAPPED_REGION_READ) || regionStart >= regionEnd) {
+            continue;
+        }
+        ++result->regionCount;
+        // code and data regions differ in which bytes are rare
+        scanner.pattern.anchor = pattern->anchor;
+        scanner.anchorChosen = false;
+        bool regionFailed = false;
+        uint64_t addr = regionStart;
+        while(addr < regionEnd) {
+            scanner.carried = 0;
+            scanner.regionAddr = addr;
+            RspReadResult readResult;
+            int readRet = rsp_read_memory(debugProxy, addr, regionEnd - addr, memory_scan_sink, &scanner, &readResult, errOut);
+            result->packetCount += readResult.packetCount;
+            result->bytesReceived += readResult.bytesReceived;
+            if(readRet == -1 || readRet == -2) {
+                ret = readRet;
+                break;
+            }
+            if(maxHits && result->hitCount >= maxHits) {
+                break;
+            }
+            if(readRet == 0) {
+                break;
+            }
+            // part of the region isn't readable after all, skip to the page after the failure
+            regionFailed = true;
+            uint64_t failedAddr = addr + (readResult.failedOffset >= 0 ? (uint64_t)readResult.failedOffset : readResult.bytesRead);
+            uint64_t nextAddr = failedAddr - failedAddr % pageSize + pageSize;
+            if(nextAddr <= failedAddr || nextAddr > regionEnd) {
+                // the region ends within this page, or the page is the last one below 2^64
+                nextAddr = regionEnd;
+            }
+            result->unreadableBytes += nextAddr - failedAddr;
+            addr = nextAddr;
+        }
+        if(regionFailed) {
+            ++result->failedRegionCount;
+        }
+        if(ret || (maxHits && result->hitCount >= maxHits)) {
+            break;
+        }
+    }
+    free(scanner.window);
+    return ret;
+}
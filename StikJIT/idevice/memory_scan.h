@@ -0,0 +1,52 @@
+//
+//  memory_scan.h
+//  StikJIT
+//
+//  Searches the debugged process's readable memory for a byte pattern, streaming
+//  each region through pipelined reads so only one chunk is held at a time.
+//
+
+#ifndef MEMORY_SCAN_H
+#define MEMORY_SCAN_H
+#include "idevice.h"
+#include "region_map.h"
+
+typedef struct ScanPattern {
+    uint8_t* bytes;
+    // per byte mask, 0xff must match, 0x00 is a wildcard, 0xf0/0x0f fix one nibble
+    uint8_t* mask;
+    size_t length;
+    // index of the fully fixed byte candidates are located by, -1 if every byte has a wildcard
+    int64_t anchor;
+} ScanPattern;
+
+// parses "48 8b ?? ?? 05 4?": hex bytes separated by spaces, "?" or "??" for any byte,
+// "4?" / "?b" for a single fixed nibble. returns false if the text isn't a pattern
+bool scan_pattern_parse(const char* text, ScanPattern* pattern);
+void scan_pattern_free(ScanPattern* pattern);
+// moves the anchor to the fully fixed byte that occurs least often in sample, so the search stops at
+// as few candidates as possible in memory like it
+void scan_pattern_choose_anchor(ScanPattern* pattern, const uint8_t* sample, size_t length);
+// calls onHit with the offset of every match of pattern in data, stops early if it returns false.
+// returns false if it was stopped
+bool scan_pattern_find(const ScanPattern* pattern, const uint8_t* data, size_t length, bool (*onHit)(void* userData, size_t offset), void* userData);
+
+typedef struct ScanResult {
+    uint64_t* hits;
+    size_t hitCount;
+    uint64_t bytesScanned;
+    uint64_t regionCount;
+    // readable regions that had pages debugserver couldn't read, and how much was skipped
+    uint64_t failedRegionCount;
+    uint64_t unreadableBytes;
+    uint64_t packetCount;
+    uint64_t bytesReceived;
+} ScanResult;
+
+// searches every readable region of map within [start, end) and collects up to maxHits match addresses
+// (0 for no limit) into result->hits, which the caller frees. each region is searched anchored on the
+// pattern byte rarest in its first chunk. unreadable memory is skipped a page of pageSize at a time.
+// returns 0 on success, -1 if the connection failed (*errOut is set), -2 if debugserver closed it
+int memory_scan(DebugProxyHandle* debugProxy, const RegionMap* map, uint64_t start, uint64_t end, const ScanPattern* pattern, uint64_t pageSize, size_t maxHits, ScanResult* result, IdeviceFfiError** errOut);
+
+#endif /* MEMORY_SCAN_H */
@@ -0,0 +1,99 @@
+//
+//  prepared_pages.c
+//  StikJIT
+//
+//  Remembers which pages of a process were already prepared for JIT in this session,
+//  so repeated prepare_memory_region calls only touch pages they haven't seen.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "prepared_pages.h"
+
+// index of the first range whose end is after page
+static size_t prepared_pages_lower_bound(PreparedPages* pages, uint64_t page) {
+    size_t low = 0;
+    size_t high = pages->count;
+    while(low < high) {
+        size_t mid = (low + high) / 2;
+        if(pages->ranges[mid].end <= page) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void append_gap(PageRange** gaps, size_t* gapCount, size_t* gapCapacity, uint64_t start, uint64_t end) {
+    if(*gapCount == *gapCapacity) {
+        *gapCapacity = *gapCapacity ? *gapCapacity * 2 : 8;
+        *gaps = realloc(*gaps, *gapCapacity * sizeof(PageRange));
+    }
+    (*gaps)[(*gapCount)++] = (PageRange){ start, end };
+}
+
+void prepared_pages_clear(PreparedPages* pages) {
+    free(pages->ranges);
+    *pages = (PreparedPages){ .skippedTotal = pages->skippedTotal };
+}
+
+// ranges counted in another page size say nothing about this one
+static void prepared_pages_use_page_size(PreparedPages* pages, uint64_t pageSize) {
+    if(pages->pageSize != pageSize) {
+        pages->count = 0;
+        pages->pageSize = pageSize;
+    }
+}
+
+uint64_t prepared_pages_missing(PreparedPages* pages, uint64_t pageSize, uint64_t start, uint64_t end, PageRange** gaps, size_t* gapCount, size_t* gapCapacity) {
+    prepared_pages_use_page_size(pages, pageSize);
+    uint64_t alreadyPrepared = 0;
+    uint64_t cur = start;
+    for(size_t i = prepared_pages_lower_bound(pages, start); i < pages->count && pages->ranges[i].start < end; ++i) {
+        PageRange range = pages->ranges[i];
+        if(range.start > cur) {
+            append_gap(gaps, gapCount, gapCapacity, cur, range.start);
+        }
+        uint64_t overlapStart = range.start > cur ? range.start : cur;
+        uint64_t overlapEnd = range.end < end ? range.end : end;
+        alreadyPrepared += overlapEnd - overlapStart;
+        cur = overlapEnd;
+    }
+    if(cur < end) {
+        append_gap(gaps, gapCount, gapCapacity, cur, end);
+    }
+    return alreadyPrepared;
+}
+
+void prepared_pages_add(PreparedPages* pages, uint64_t pageSize, uint64_t start, uint64_t end) {
+    if(start >= end) {
+        return;
+    }
+    prepared_pages_use_page_size(pages, pageSize);
+    // ranges that overlap or touch [start, end) are merged into it
+    size_t first = prepared_pages_lower_bound(pages, start > 0 ? start - 1 : 0);
+    size_t last = first;
+    while(last < pages->count && pages->ranges[last].start <= end) {
+        if(pages->ranges[last].start < start) {
+            start = pages->ranges[last].start;
+        }
+        if(pages->ranges[last].end > end) {
+            end = pages->ranges[last].end;
+        }
+        ++last;
+    }
+    if(first == last) {
+        if(pages->count == pages->capacity) {
+            pages->capacity = pages->capacity ? pages->capacity * 2 : 8;
+            pages->ranges = realloc(pages->ranges, pages->capacity * sizeof(PageRange));
+        }
+        memmove(&pages->ranges[first + 1], &pages->ranges[first], (pages->count - first) * sizeof(PageRange));
+        ++pages->count;
+    } else {
+        memmove(&pages->ranges[first + 1], &pages->ranges[last], (pages->count - last) * sizeof(PageRange));
+        pages->count -= last - first - 1;
+    }
+    pages->ranges[first] = (PageRange){ start, end };
+}
@@ -0,0 +1,40 @@
+//
+//  prepared_pages.h
+//  StikJIT
+//
+//  Remembers which pages of a process were already prepared for JIT in this session,
+//  so repeated prepare_memory_region calls only touch pages they haven't seen.
+//  Each DebugSession owns one set, so it goes away with the connection.
+//
+
+#ifndef PREPARED_PAGES_H
+#define PREPARED_PAGES_H
+#include <stdint.h>
+#include <stddef.h>
+
+// half-open range of page numbers (address / page size)
+typedef struct PageRange {
+    uint64_t start;
+    uint64_t end;
+} PageRange;
+
+// sorted, non-overlapping, non-adjacent page ranges. Like the rest of a DebugSession it is
+// only used by the thread driving that session, so it isn't locked
+typedef struct PreparedPages {
+    // page size the ranges were counted in, 0 while empty
+    uint64_t pageSize;
+    PageRange* ranges;
+    size_t count;
+    size_t capacity;
+    // pages skipped by prepared_pages_missing, i.e. $M round trips saved
+    uint64_t skippedTotal;
+} PreparedPages;
+
+// forgets every prepared page, e.g. once the process went away or may have unmapped them
+void prepared_pages_clear(PreparedPages* pages);
+// appends the parts of [start, end) not prepared yet to *gaps (grown with realloc).
+// ranges counted in another page size are dropped first. returns the number of pages already prepared
+uint64_t prepared_pages_missing(PreparedPages* pages, uint64_t pageSize, uint64_t start, uint64_t end, PageRange** gaps, size_t* gapCount, size_t* gapCapacity);
+void prepared_pages_add(PreparedPages* pages, uint64_t pageSize, uint64_t start, uint64_t end);
+
+#endif /* PREPARED_PAGES_H */
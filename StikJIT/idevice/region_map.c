@@ -0,0 +1,157 @@
+//
+//  region_map.c
+//  StikJIT
+//
+//  Sorted map of the debugged process's mapped regions, built with one
+//  qMemoryRegionInfo walk and looked up with a binary search.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "region_map.h"
+#include "rsp.h"
+
+// a process has a few thousand regions at most, stop a walk that doesn't advance long before this
+#define REGION_MAP_MAX_QUERIES 65536
+
+void region_map_free(RegionMap* map) {
+    free(map->regions);
+    map->regions = 0;
+    map->count = 0;
+    map->capacity = 0;
+    map->valid = false;
+    map->truncated = false;
+}
+
+bool region_map_parse_info(const char* reply, size_t length, MappedRegion* region) {
+    bool hasStart = false;
+    bool hasSize = false;
+    region->permissions = 0;
+    const char* cur = reply;
+    const char* end = reply + length;
+    while(cur < end) {
+        const char* entryEnd = memchr(cur, ';', end - cur);
+        if(!entryEnd) {
+            entryEnd = end;
+        }
+        const char* colon = memchr(cur, ':', entryEnd - cur);
+        if(colon) {
+            size_t keyLength = colon - cur;
+            const char* value = colon + 1;
+            if(keyLength == 5 && memcmp(cur, "start", 5) == 0) {
+                region->start = strtoull(value, NULL, 16);
+                hasStart = true;
+            } else if(keyLength == 4 && memcmp(cur, "size", 4) == 0) {
+                region->size = strtoull(value, NULL, 16);
+                hasSize = true;
+            } else if(keyLength == 11 && memcmp(cur, "permissions", 11) == 0) {
+                for(const char* p = value; p < entryEnd; ++p) {
+                    if(*p == 'r') {
+                        region->permissions |= MAPPED_REGION_READ;
+                    } else if(*p == 'w') {
+                        region->permissions |= MAPPED_REGION_WRITE;
+                    } else if(*p == 'x') {
+                        region->permissions |= MAPPED_REGION_EXECUTE;
+                    }
+                }
+            }
+        }
+        cur = entryEnd + 1;
+    }
+    return hasStart && hasSize;
+}
+
+static void region_map_append(RegionMap* map, const MappedRegion* region) {
+    if(map->count == map->capacity) {
+        map->capacity = map->capacity ? map->capacity * 2 : 256;
+        map->regions = realloc(map->regions, map->capacity * sizeof(MappedRegion));
+    }
+    map->regions[map->count++] = *region;
+}
+
+int region_map_scan(DebugProxyHandle* debugProxy, RegionMap* map, IdeviceFfiError** errOut) {
+    map->count = 0;
+    map->valid = false;
+    map->truncated = false;
+    map->queryCount = 0;
+    
+    uint64_t addr = 0;
+    int ret = 0;
+    char* info = 0;
+    size_t infoCapacity = 0;
+    bool reachedTop = false;
+    while(map->queryCount < REGION_MAP_MAX_QUERIES) {
+        char command[48];
+        char packet[52];
+        int commandLength = snprintf(command, sizeof(command), "qMemoryRegionInfo:%llx", (unsigned long long)addr);
+        size_t packetLength = rsp_build_packet(packet, command, commandLength);
+        IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, (const uint8_t*)packet, packetLength);
+        if(err) {
+            *errOut = err;
+            ret = -1;
+            break;
+        }
+        char* reply = 0;
+        size_t replyLength = 0;
+        ret = rsp_read_reply(debugProxy, &reply, &replyLength, errOut);
+        if(ret) {
+            break;
+        }
+        ++map->queryCount;
+        
+        const char* payload = reply + 1;
+        size_t payloadLength = replyLength - 4;
+        size_t expandedLength = rsp_expanded_length(payload, payloadLength);
+        if(expandedLength > infoCapacity) {
+            infoCapacity = expandedLength;
+            info = realloc(info, infoCapacity);
+        }
+        int64_t infoLength = rsp_decode_payload((uint8_t*)info, infoCapacity, payload, payloadLength, payload + payloadLength + 1, false);
+        free(reply);
+        
+        MappedRegion region;
+        if(infoLength <= 0 || !region_map_parse_info(info, (size_t)infoLength, &region) || region.size == 0) {
+            // on the first query it means no support, later the walk can't go on past this address
+            if(map->queryCount == 1) {
+                ret = -3;
+            }
+            break;
+        }
+        if(region.permissions) {
+            region_map_append(map, &region);
+        }
+        uint64_t next = region.start + region.size;
+        if(next <= addr || next == UINT64_MAX) {
+            // reached the top of the address space. debugserver ends its last gap at ~0 instead of
+            // wrapping around to 0, a query at ~0 would only get a region of size 0 back
+            reachedTop = true;
+            break;
+        }
+        addr = next;
+    }
+    free(info);
+    map->truncated = ret == 0 && !reachedTop;
+    map->valid = ret == 0 && !map->truncated;
+    return ret;
+}
+
+const MappedRegion* region_map_lookup(const RegionMap* map, uint64_t addr) {
+    // first region that ends after addr
+    size_t low = 0;
+    size_t high = map->count;
+    while(low < high) {
+        size_t mid = (low + high) / 2;
+        const MappedRegion* region = &map->regions[mid];
+        if(region->start + region->size <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if(low < map->count && map->regions[low].start <= addr) {
+        return &map->regions[low];
+    }
+    return 0;
+}
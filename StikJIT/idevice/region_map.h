@@ -0,0 +1,48 @@
+//
+//  region_map.h
+//  StikJIT
+//
+//  Sorted map of the debugged process's mapped regions, built with one
+//  qMemoryRegionInfo walk and looked up with a binary search.
+//
+
+#ifndef REGION_MAP_H
+#define REGION_MAP_H
+#include "idevice.h"
+
+#define MAPPED_REGION_READ (1 << 0)
+#define MAPPED_REGION_WRITE (1 << 1)
+#define MAPPED_REGION_EXECUTE (1 << 2)
+
+typedef struct MappedRegion {
+    uint64_t start;
+    uint64_t size;
+    // MAPPED_REGION_* flags
+    uint32_t permissions;
+} MappedRegion;
+
+// sorted, non-overlapping regions; unmapped gaps are left out
+typedef struct RegionMap {
+    MappedRegion* regions;
+    size_t count;
+    size_t capacity;
+    // false until scanned and again once the mappings may have changed
+    bool valid;
+    // the last scan stopped short of the top of the address space, at the query limit or on a
+    // reply it couldn't use, so regions above the last one are missing. such a map isn't valid
+    bool truncated;
+    // qMemoryRegionInfo round trips the last scan took
+    uint64_t queryCount;
+} RegionMap;
+
+void region_map_free(RegionMap* map);
+// rebuilds map by walking the address space from 0 with qMemoryRegionInfo.
+// returns 0 on success, -1 if the connection failed (*errOut is set), -2 if debugserver closed it,
+// -3 if debugserver doesn't answer qMemoryRegionInfo. a walk cut short still returns 0 with map->truncated set
+int region_map_scan(DebugProxyHandle* debugProxy, RegionMap* map, IdeviceFfiError** errOut);
+// region containing addr, NULL if addr isn't mapped
+const MappedRegion* region_map_lookup(const RegionMap* map, uint64_t addr);
+// parses a "start:...;size:...;permissions:...;" reply, returns false if it has no start or size
+bool region_map_parse_info(const char* reply, size_t length, MappedRegion* region);
+
+#endif /* REGION_MAP_H */
@@ -0,0 +1,1250 @@
+//
+//  rsp.c
+//  StikJIT
+//
+//  Helpers for talking debugserver's remote serial protocol in bulk.
+//
+
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rsp.h"
+#include "prepared_pages.h"
+#include "debug_session.h"
+
+// shortest possible packet is an empty reply: $#00
+#define RSP_MIN_PACKET_SIZE 4
+// number of $M commands kept in flight. It starts at RSP_WRITE_WINDOW_INITIAL and follows
+// the measured bandwidth-delay product of the link within [RSP_WRITE_WINDOW_MIN, RSP_WRITE_WINDOW_MAX].
+// Starting with a full window, rather than a small probe, keeps fast links from being throttled
+// by a first round trip measured on an almost empty queue
+#define RSP_WRITE_WINDOW_INITIAL 1024
+#define RSP_WRITE_WINDOW_MIN 256
+#define RSP_WRITE_WINDOW_MAX 8192
+// batches whose send time is remembered to take round trip samples
+#define RSP_WRITE_RTT_SAMPLES 64
+// replies are read back in bulk into this buffer instead of one allocated string per "OK"
+#define RSP_WRITE_DRAIN_BUFFER_SIZE 65536
+
+void rsp_drain_init(RspReplyDrain* drain, uint32_t capacity) {
+    drain->buffer = malloc(capacity);
+    drain->capacity = capacity;
+    drain->onError = 0;
+    drain->onErrorUserData = 0;
+    rsp_drain_reset(drain);
+}
+
+void rsp_drain_reset(RspReplyDrain* drain) {
+    drain->length = 0;
+    drain->replyCount = 0;
+    drain->okCount = 0;
+    drain->bytesReceived = 0;
+    drain->firstErrorIndex = -1;
+    drain->firstError[0] = 0;
+}
+
+void rsp_drain_free(RspReplyDrain* drain) {
+    free(drain->buffer);
+    drain->buffer = 0;
+    drain->capacity = 0;
+}
+
+// parses every complete packet in the buffer, keeps the incomplete tail for the next read
+static uint32_t rsp_drain_scan(RspReplyDrain* drain) {
+    char* cur = drain->buffer;
+    char* end = drain->buffer + drain->length;
+    uint32_t parsed = 0;
+    while(cur < end) {
+        if(*cur != '$') {
+            // acks and garbage between packets
+            ++cur;
+            continue;
+        }
+        char* hash = memchr(cur, '#', end - cur);
+        if(!hash || end - hash < 3) {
+            break;
+        }
+        char* payload = cur + 1;
+        size_t payloadLength = hash - payload;
+        if(payloadLength == 2 && payload[0] == 'O' && payload[1] == 'K') {
+            ++drain->okCount;
+        } else {
+            if(drain->firstErrorIndex < 0) {
+                drain->firstErrorIndex = drain->replyCount;
+                size_t copyLength = payloadLength < sizeof(drain->firstError) - 1 ? payloadLength : sizeof(drain->firstError) - 1;
+                memcpy(drain->firstError, payload, copyLength);
+                drain->firstError[copyLength] = 0;
+            }
+            if(drain->onError) {
+                drain->onError(drain->onErrorUserData, drain->replyCount, payload, payloadLength);
+            }
+        }
+        ++drain->replyCount;
+        ++parsed;
+        cur = hash + 3;
+    }
+    drain->length = (uint32_t)(end - cur);
+    memmove(drain->buffer, cur, drain->length);
+    return parsed;
+}
+
+int rsp_drain_replies(DebugProxyHandle* debugProxy, RspReplyDrain* drain, uint32_t replyCount, IdeviceFfiError** errOut) {
+    uint32_t remaining = replyCount;
+    while(remaining > 0) {
+        // every outstanding reply is at least RSP_MIN_PACKET_SIZE bytes, so asking for no more than
+        // that can't consume anything that belongs to a later request
+        uint64_t wanted = (uint64_t)remaining * RSP_MIN_PACKET_SIZE;
+        wanted = wanted > drain->length ? wanted - drain->length : 1;
+        if(wanted > drain->capacity - drain->length) {
+            wanted = drain->capacity - drain->length;
+        }
+        char* chunk = 0;
+        IdeviceFfiError* err = debug_proxy_read(debugProxy, (uintptr_t)wanted, &chunk);
+        if(err) {
+            *errOut = err;
+            idevice_string_free(chunk);
+            return -1;
+        }
+        size_t chunkLength = chunk ? strlen(chunk) : 0;
+        if(chunkLength == 0) {
+            idevice_string_free(chunk);
+            return -2;
+        }
+        memcpy(drain->buffer + drain->length, chunk, chunkLength);
+        drain->length += (uint32_t)chunkLength;
+        drain->bytesReceived += chunkLength;
+        idevice_string_free(chunk);
+        
+        uint32_t parsed = rsp_drain_scan(drain);
+        remaining = parsed >= remaining ? 0 : remaining - parsed;
+    }
+    return 0;
+}
+
+static const char rspHexDigits[] = "0123456789abcdef";
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+
+static size_t rsp_hex_encode_simd(char* out, const uint8_t* data, size_t length, uint32_t* sum) {
+    const uint8x16_t table = vld1q_u8((const uint8_t*)rspHexDigits);
+    const uint8x16_t lowMask = vdupq_n_u8(0xf);
+    uint32_t total = 0;
+    size_t i = 0;
+    for(; i + 16 <= length; i += 16) {
+        uint8x16_t in = vld1q_u8(data + i);
+        uint8x16x2_t hex;
+        hex.val[0] = vqtbl1q_u8(table, vshrq_n_u8(in, 4));
+        hex.val[1] = vqtbl1q_u8(table, vandq_u8(in, lowMask));
+        // vst2 interleaves high and low nibble characters
+        vst2q_u8((uint8_t*)out + 2 * i, hex);
+        total += vaddlvq_u8(hex.val[0]) + vaddlvq_u8(hex.val[1]);
+    }
+    *sum += total;
+    return i;
+}
+
+static size_t rsp_checksum_simd(const char* data, size_t length, uint32_t* sum) {
+    uint32_t total = 0;
+    size_t i = 0;
+    for(; i + 16 <= length; i += 16) {
+        total += vaddlvq_u8(vld1q_u8((const uint8_t*)data + i));
+    }
+    *sum += total;
+    return i;
+}
+
+// nibble values of 16 hex characters, false if any of them isn't a hex digit
+static inline bool rsp_hex_values(uint8x16_t chars, uint8x16_t* values) {
+    uint8x16_t digit = vsubq_u8(chars, vdupq_n_u8('0'));
+    uint8x16_t letter = vsubq_u8(vorrq_u8(chars, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t isDigit = vcltq_u8(digit, vdupq_n_u8(10));
+    uint8x16_t isLetter = vcltq_u8(letter, vdupq_n_u8(6));
+    *values = vbslq_u8(isDigit, digit, vaddq_u8(letter, vdupq_n_u8(10)));
+    return vminvq_u8(vorrq_u8(isDigit, isLetter)) == 0xff;
+}
+
+static size_t rsp_hex_decode_simd(uint8_t* out, const char* hex, size_t length, uint32_t* sum) {
+    uint32_t total = 0;
+    size_t i = 0;
+    for(; i + 32 <= length; i += 32) {
+        // vld2 splits high and low nibble characters apart
+        uint8x16x2_t in = vld2q_u8((const uint8_t*)hex + i);
+        uint8x16_t high, low;
+        if(!rsp_hex_values(in.val[0], &high) || !rsp_hex_values(in.val[1], &low)) {
+            // let the scalar loop find the bad character
+            break;
+        }
+        vst1q_u8(out + i / 2, vorrq_u8(vshlq_n_u8(high, 4), low));
+        total += vaddlvq_u8(in.val[0]) + vaddlvq_u8(in.val[1]);
+    }
+    *sum += total;
+    return i;
+}
+
+#elif defined(__AVX2__)
+#include <immintrin.h>
+
+static size_t rsp_hex_encode_simd(char* out, const uint8_t* data, size_t length, uint32_t* sum) {
+    const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)rspHexDigits));
+    const __m256i lowMask = _mm256_set1_epi8(0xf);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 32 <= length; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i high = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(in, 4), lowMask));
+        __m256i low = _mm256_shuffle_epi8(table, _mm256_and_si256(in, lowMask));
+        // unpack works per 128-bit lane, put the lanes back in order before storing
+        __m256i first = _mm256_unpacklo_epi8(high, low);
+        __m256i second = _mm256_unpackhi_epi8(high, low);
+        _mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(high, _mm256_setzero_si256()));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(low, _mm256_setzero_si256()));
+    }
+    __m128i folded = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    *sum += (uint32_t)(_mm_cvtsi128_si64(folded) + _mm_extract_epi64(folded, 1));
+    return i;
+}
+
+static size_t rsp_checksum_simd(const char* data, size_t length, uint32_t* sum) {
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 32 <= length; i += 32) {
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(data + i)), _mm256_setzero_si256()));
+    }
+    __m128i folded = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    *sum += (uint32_t)(_mm_cvtsi128_si64(folded) + _mm_extract_epi64(folded, 1));
+    return i;
+}
+
+// nibble values of 32 hex characters, *valid has 0xff in every lane that was a hex digit
+static inline __m256i rsp_hex_values(__m256i chars, __m256i* valid) {
+    __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    // unsigned x <= n is min(x, n) == x
+    __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    __m256i isLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+    *valid = _mm256_or_si256(isDigit, isLetter);
+    return _mm256_blendv_epi8(_mm256_add_epi8(letter, _mm256_set1_epi8(10)), digit, isDigit);
+}
+
+static size_t rsp_hex_decode_simd(uint8_t* out, const char* hex, size_t length, uint32_t* sum) {
+    // each 16-bit lane becomes high * 16 + low
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 64 <= length; i += 64) {
+        __m256i first = _mm256_loadu_si256((const __m256i*)(hex + i));
+        __m256i second = _mm256_loadu_si256((const __m256i*)(hex + i + 32));
+        __m256i firstValid, secondValid;
+        __m256i firstValues = rsp_hex_values(first, &firstValid);
+        __m256i secondValues = rsp_hex_values(second, &secondValid);
+        if(_mm256_movemask_epi8(_mm256_and_si256(firstValid, secondValid)) != -1) {
+            // let the scalar loop find the bad character
+            break;
+        }
+        __m256i packed = _mm256_packus_epi16(_mm256_maddubs_epi16(firstValues, weights), _mm256_maddubs_epi16(secondValues, weights));
+        // pack works per 128-bit lane, put the lanes back in order before storing
+        _mm256_storeu_si256((__m256i*)(out + i / 2), _mm256_permute4x64_epi64(packed, 0xd8));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(first, _mm256_setzero_si256()));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(second, _mm256_setzero_si256()));
+    }
+    __m128i folded = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    *sum += (uint32_t)(_mm_cvtsi128_si64(folded) + _mm_extract_epi64(folded, 1));
+    return i;
+}
+
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+
+static size_t rsp_hex_encode_simd(char* out, const uint8_t* data, size_t length, uint32_t* sum) {
+    const __m128i table = _mm_loadu_si128((const __m128i*)rspHexDigits);
+    const __m128i lowMask = _mm_set1_epi8(0xf);
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i high = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(in, 4), lowMask));
+        __m128i low = _mm_shuffle_epi8(table, _mm_and_si128(in, lowMask));
+        _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128((__m128i*)(out + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+        total = _mm_add_epi64(total, _mm_sad_epu8(high, _mm_setzero_si128()));
+        total = _mm_add_epi64(total, _mm_sad_epu8(low, _mm_setzero_si128()));
+    }
+    *sum += (uint32_t)(_mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+    return i;
+}
+
+static size_t rsp_checksum_simd(const char* data, size_t length, uint32_t* sum) {
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= length; i += 16) {
+        total = _mm_add_epi64(total, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(data + i)), _mm_setzero_si128()));
+    }
+    *sum += (uint32_t)(_mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+    return i;
+}
+
+// nibble values of 16 hex characters, *valid has 0xff in every lane that was a hex digit
+static inline __m128i rsp_hex_values(__m128i chars, __m128i* valid) {
+    __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    // unsigned x <= n is min(x, n) == x
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+    *valid = _mm_or_si128(isDigit, isLetter);
+    return _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_andnot_si128(isDigit, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+static size_t rsp_hex_decode_simd(uint8_t* out, const char* hex, size_t length, uint32_t* sum) {
+    // each 16-bit lane becomes high * 16 + low
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 32 <= length; i += 32) {
+        __m128i first = _mm_loadu_si128((const __m128i*)(hex + i));
+        __m128i second = _mm_loadu_si128((const __m128i*)(hex + i + 16));
+        __m128i firstValid, secondValid;
+        __m128i firstValues = rsp_hex_values(first, &firstValid);
+        __m128i secondValues = rsp_hex_values(second, &secondValid);
+        if(_mm_movemask_epi8(_mm_and_si128(firstValid, secondValid)) != 0xffff) {
+            // let the scalar loop find the bad character
+            break;
+        }
+        _mm_storeu_si128((__m128i*)(out + i / 2), _mm_packus_epi16(_mm_maddubs_epi16(firstValues, weights), _mm_maddubs_epi16(secondValues, weights)));
+        total = _mm_add_epi64(total, _mm_sad_epu8(first, _mm_setzero_si128()));
+        total = _mm_add_epi64(total, _mm_sad_epu8(second, _mm_setzero_si128()));
+    }
+    *sum += (uint32_t)(_mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+    return i;
+}
+
+#else
+
+static size_t rsp_hex_encode_simd(char* out, const uint8_t* data, size_t length, uint32_t* sum) {
+    (void)out;
+    (void)data;
+    (void)length;
+    (void)sum;
+    return 0;
+}
+
+static size_t rsp_checksum_simd(const char* data, size_t length, uint32_t* sum) {
+    (void)data;
+    (void)length;
+    (void)sum;
+    return 0;
+}
+
+static size_t rsp_hex_decode_simd(uint8_t* out, const char* hex, size_t length, uint32_t* sum) {
+    (void)out;
+    (void)hex;
+    (void)length;
+    (void)sum;
+    return 0;
+}
+
+#endif
+
+uint8_t rsp_hex_encode(char* out, const uint8_t* data, size_t length) {
+    uint32_t sum = 0;
+    // vector kernel handles whole blocks, the scalar loop picks up the tail
+    size_t i = rsp_hex_encode_simd(out, data, length, &sum);
+    for(; i < length; ++i) {
+        char high = rspHexDigits[data[i] >> 4];
+        char low = rspHexDigits[data[i] & 0xf];
+        out[2 * i] = high;
+        out[2 * i + 1] = low;
+        sum += (uint8_t)high + (uint8_t)low;
+    }
+    return (uint8_t)sum;
+}
+
+uint8_t rsp_checksum(const char* data, size_t length) {
+    uint32_t sum = 0;
+    size_t i = rsp_checksum_simd(data, length, &sum);
+    for(; i < length; ++i) {
+        sum += (uint8_t)data[i];
+    }
+    return (uint8_t)sum;
+}
+
+static inline int rsp_hex_value(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// decodes hex pairs and adds the characters to *sum. returns the number of characters decoded,
+// which stops short of length at the first pair that isn't hex
+static size_t rsp_hex_decode_sum(uint8_t* out, const char* hex, size_t length, uint32_t* sum) {
+    // the kernel loads a block before storing its half-size result, so out may equal hex
+    size_t i = rsp_hex_decode_simd(out, hex, length, sum);
+    for(; i + 1 < length; i += 2) {
+        int high = rsp_hex_value(hex[i]);
+        int low = rsp_hex_value(hex[i + 1]);
+        if(high < 0 || low < 0) {
+            break;
+        }
+        out[i / 2] = (uint8_t)(high << 4 | low);
+        *sum += (uint8_t)hex[i] + (uint8_t)hex[i + 1];
+    }
+    return i;
+}
+
+bool rsp_hex_decode(uint8_t* out, const char* hex, size_t length) {
+    uint32_t sum = 0;
+    return rsp_hex_decode_sum(out, hex, length & ~(size_t)1, &sum) == (length & ~(size_t)1);
+}
+
+size_t rsp_expanded_length(const char* payload, size_t length) {
+    size_t expanded = length;
+    const char* cur = payload;
+    const char* end = payload + length;
+    while((cur = memchr(cur, '*', end - cur)) && end - cur >= 2) {
+        // "*n" stands for n - 29 more copies of the previous character. counts start at ' ' (3 copies),
+        // anything lower is malformed and would shrink the length, so it's left out of the bound
+        uint8_t count = (uint8_t)cur[1];
+        if(count >= ' ') {
+            expanded += count - 29 - 2;
+        }
+        cur += 2;
+    }
+    return expanded;
+}
+
+typedef struct RspDecodeOutput {
+    uint8_t* data;
+    size_t capacity;
+    size_t length;
+    // hex mode: high nibble still waiting for its low half, -1 if none
+    int pending;
+} RspDecodeOutput;
+
+// appends a run of literal characters
+static int rsp_decode_literal(RspDecodeOutput* output, const char* text, size_t length, bool hex, uint32_t* sum) {
+    if(!hex) {
+        if(length > output->capacity - output->length) {
+            return RSP_DECODE_OVERFLOW;
+        }
+        memcpy(output->data + output->length, text, length);
+        output->length += length;
+        *sum += rsp_checksum(text, length);
+        return 0;
+    }
+    if(output->pending >= 0 && length > 0) {
+        int low = rsp_hex_value(text[0]);
+        if(low < 0) {
+            return RSP_DECODE_MALFORMED;
+        }
+        if(output->length >= output->capacity) {
+            return RSP_DECODE_OVERFLOW;
+        }
+        output->data[output->length++] = (uint8_t)(output->pending << 4 | low);
+        output->pending = -1;
+        *sum += (uint8_t)text[0];
+        ++text;
+        --length;
+    }
+    size_t pairLength = length & ~(size_t)1;
+    if(pairLength / 2 > output->capacity - output->length) {
+        return RSP_DECODE_OVERFLOW;
+    }
+    if(rsp_hex_decode_sum(output->data + output->length, text, pairLength, sum) != pairLength) {
+        return RSP_DECODE_MALFORMED;
+    }
+    output->length += pairLength / 2;
+    if(length & 1) {
+        // an odd run leaves half a byte for whatever follows
+        output->pending = rsp_hex_value(text[pairLength]);
+        if(output->pending < 0) {
+            return RSP_DECODE_MALFORMED;
+        }
+        *sum += (uint8_t)text[pairLength];
+    }
+    return 0;
+}
+
+// appends count more copies of c
+static int rsp_decode_repeat(RspDecodeOutput* output, uint8_t c, size_t count, bool hex) {
+    if(!hex) {
+        if(count > output->capacity - output->length) {
+            return RSP_DECODE_OVERFLOW;
+        }
+        memset(output->data + output->length, c, count);
+        output->length += count;
+        return 0;
+    }
+    int value = rsp_hex_value((char)c);
+    if(value < 0) {
+        return RSP_DECODE_MALFORMED;
+    }
+    if(output->pending >= 0 && count > 0) {
+        if(output->length >= output->capacity) {
+            return RSP_DECODE_OVERFLOW;
+        }
+        output->data[output->length++] = (uint8_t)(output->pending << 4 | value);
+        output->pending = -1;
+        --count;
+    }
+    if(count / 2 > output->capacity - output->length) {
+        return RSP_DECODE_OVERFLOW;
+    }
+    memset(output->data + output->length, value << 4 | value, count / 2);
+    output->length += count / 2;
+    if(count & 1) {
+        output->pending = value;
+    }
+    return 0;
+}
+
+int64_t rsp_decode_payload(uint8_t* out, size_t capacity, const char* payload, size_t length, const char* checksum, bool hex) {
+    RspDecodeOutput output = { .data = out, .capacity = capacity, .length = 0, .pending = -1 };
+    uint32_t sum = 0;
+    // last character produced, the one a following '*' repeats
+    int last = -1;
+    const char* cur = payload;
+    const char* end = payload + length;
+    int ret = 0;
+    while(ret == 0 && cur < end) {
+        if(*cur == '*') {
+            uint8_t countChar = end - cur >= 2 ? (uint8_t)cur[1] : 0;
+            if(last < 0 || countChar < ' ' || countChar > 126) {
+                return RSP_DECODE_MALFORMED;
+            }
+            ret = rsp_decode_repeat(&output, (uint8_t)last, countChar - 29, hex);
+            sum += '*' + countChar;
+            cur += 2;
+            continue;
+        }
+        if(!hex && *cur == '}') {
+            if(end - cur < 2) {
+                return RSP_DECODE_MALFORMED;
+            }
+            char unescaped = cur[1] ^ 0x20;
+            ret = rsp_decode_literal(&output, &unescaped, 1, false, &sum);
+            // the checksum covers the escaped form
+            sum += '}' + (uint8_t)cur[1] - (uint8_t)unescaped;
+            last = (uint8_t)unescaped;
+            cur += 2;
+            continue;
+        }
+        // everything up to the next '*' (or '}' outside hex) is copied or decoded as one block
+        const char* stop = memchr(cur, '*', end - cur);
+        if(!stop) {
+            stop = end;
+        }
+        if(!hex) {
+            const char* escape = memchr(cur, '}', stop - cur);
+            if(escape) {
+                stop = escape;
+            }
+        }
+        ret = rsp_decode_literal(&output, cur, stop - cur, hex, &sum);
+        last = (uint8_t)stop[-1];
+        cur = stop;
+    }
+    if(ret) {
+        return ret;
+    }
+    if(output.pending >= 0) {
+        return RSP_DECODE_MALFORMED;
+    }
+    if(checksum) {
+        int high = rsp_hex_value(checksum[0]);
+        int low = rsp_hex_value(checksum[1]);
+        if(high < 0 || low < 0 || (uint8_t)(high << 4 | low) != (uint8_t)sum) {
+            return RSP_DECODE_BAD_CHECKSUM;
+        }
+    }
+    return (int64_t)output.length;
+}
+
+size_t rsp_build_packet(char* out, const char* body, size_t length) {
+    out[0] = '$';
+    memcpy(out + 1, body, length);
+    uint8_t sum = rsp_checksum(body, length);
+    out[length + 1] = '#';
+    out[length + 2] = rspHexDigits[sum >> 4];
+    out[length + 3] = rspHexDigits[sum & 0xf];
+    return length + 4;
+}
+
+void rsp_reader_init(RspPacketReader* reader, size_t capacity) {
+    reader->buffer = malloc(capacity);
+    reader->capacity = capacity;
+    reader->length = 0;
+    reader->consumed = 0;
+    reader->bytesReceived = 0;
+}
+
+void rsp_reader_free(RspPacketReader* reader) {
+    free(reader->buffer);
+    reader->buffer = 0;
+    reader->capacity = 0;
+    reader->length = 0;
+    reader->consumed = 0;
+}
+
+int rsp_reader_next(DebugProxyHandle* debugProxy, RspPacketReader* reader, const char** payload, size_t* payloadLength, IdeviceFfiError** errOut) {
+    reader->length -= reader->consumed;
+    memmove(reader->buffer, reader->buffer + reader->consumed, reader->length);
+    reader->consumed = 0;
+    while(true) {
+        char* start = memchr(reader->buffer, '$', reader->length);
+        if(!start) {
+            // only acks so far
+            reader->length = 0;
+        } else {
+            char* hash = memchr(start, '#', reader->buffer + reader->length - start);
+            if(hash && reader->buffer + reader->length - hash >= 3) {
+                *payload = start + 1;
+                *payloadLength = hash - start - 1;
+                reader->consumed = hash + 3 - reader->buffer;
+                return 0;
+            }
+        }
+        if(reader->capacity - reader->length < 1024) {
+            reader->capacity *= 2;
+            reader->buffer = realloc(reader->buffer, reader->capacity);
+        }
+        char* chunk = 0;
+        IdeviceFfiError* err = debug_proxy_read(debugProxy, reader->capacity - reader->length, &chunk);
+        size_t chunkLength = chunk ? strlen(chunk) : 0;
+        if(err || chunkLength == 0) {
+            idevice_string_free(chunk);
+            if(err) {
+                *errOut = err;
+                return -1;
+            }
+            return -2;
+        }
+        memcpy(reader->buffer + reader->length, chunk, chunkLength);
+        reader->length += chunkLength;
+        reader->bytesReceived += chunkLength;
+        idevice_string_free(chunk);
+    }
+}
+
+int rsp_read_reply(DebugProxyHandle* debugProxy, char** packetOut, size_t* packetLengthOut, IdeviceFfiError** errOut) {
+    size_t capacity = 4096;
+    size_t length = 0;
+    char* buffer = malloc(capacity);
+    *packetOut = 0;
+    *packetLengthOut = 0;
+    while(true) {
+        // drop acks in front of the packet
+        char* start = memchr(buffer, '$', length);
+        if(!start) {
+            length = 0;
+        } else if(start != buffer) {
+            length -= start - buffer;
+            memmove(buffer, start, length);
+        }
+        char* hash = length ? memchr(buffer, '#', length) : 0;
+        if(hash && buffer + length - hash >= 3) {
+            *packetOut = buffer;
+            *packetLengthOut = hash + 3 - buffer;
+            return 0;
+        }
+        if(capacity - length < 1024) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+        char* chunk = 0;
+        IdeviceFfiError* err = debug_proxy_read(debugProxy, capacity - length, &chunk);
+        size_t chunkLength = chunk ? strlen(chunk) : 0;
+        if(err || chunkLength == 0) {
+            idevice_string_free(chunk);
+            free(buffer);
+            if(err) {
+                *errOut = err;
+                return -1;
+            }
+            return -2;
+        }
+        memcpy(buffer + length, chunk, chunkLength);
+        length += chunkLength;
+        idevice_string_free(chunk);
+    }
+}
+
+size_t rsp_mem_write_packet_size(size_t length) {
+    // "$M" + 16 address digits + ',' + 16 length digits + ':' + data + "#xx"
+    return 2 + 16 + 1 + 16 + 1 + 2 * length + 3;
+}
+
+size_t rsp_build_mem_write_packet(char* out, uint64_t addr, const uint8_t* data, size_t length) {
+    int headerLength = snprintf(out, 40, "$M%llx,%zx:", (unsigned long long)addr, length);
+    uint8_t sum = rsp_checksum(out + 1, headerLength - 1);
+    sum += rsp_hex_encode(out + headerLength, data, length);
+    char* end = out + headerLength + 2 * length;
+    end[0] = '#';
+    end[1] = rspHexDigits[sum >> 4];
+    end[2] = rspHexDigits[sum & 0xf];
+    return headerLength + 2 * length + 3;
+}
+
+static inline bool rsp_needs_escape(uint8_t byte) {
+    return byte == '#' || byte == '$' || byte == '}' || byte == '*';
+}
+
+size_t rsp_build_binary_write_packet(char* out, uint64_t packetSize, uint64_t addr, const uint8_t* data, size_t length, size_t* consumed) {
+    // "$X" + 16 address digits + ',' + 16 length digits + ':' + "#xx"
+    const uint64_t overhead = 2 + 16 + 1 + 16 + 1 + 3;
+    uint64_t budget = packetSize > overhead + 2 ? packetSize - overhead : 2;
+    // find how much data fits once escaped, the header has to state that length up front
+    size_t dataLength = 0;
+    uint64_t escapedLength = 0;
+    while(dataLength < length) {
+        uint64_t byteLength = rsp_needs_escape(data[dataLength]) ? 2 : 1;
+        if(escapedLength + byteLength > budget) {
+            break;
+        }
+        escapedLength += byteLength;
+        ++dataLength;
+    }
+    
+    int headerLength = snprintf(out, 40, "$X%llx,%zx:", (unsigned long long)addr, dataLength);
+    uint8_t sum = rsp_checksum(out + 1, headerLength - 1);
+    char* cur = out + headerLength;
+    for(size_t i = 0; i < dataLength; ++i) {
+        uint8_t byte = data[i];
+        if(rsp_needs_escape(byte)) {
+            *cur++ = '}';
+            sum += '}';
+            byte ^= 0x20;
+        }
+        *cur++ = (char)byte;
+        sum += byte;
+    }
+    cur[0] = '#';
+    cur[1] = rspHexDigits[sum >> 4];
+    cur[2] = rspHexDigits[sum & 0xf];
+    *consumed = dataLength;
+    return cur + 3 - out;
+}
+
+// number of hex digits needed to print value, at least 1
+static inline uint32_t rsp_hex_digit_count(uint64_t value) {
+    return value ? (67 - __builtin_clzll(value)) / 4 : 1;
+}
+
+void rsp_page_touch_init(RspPageTouchGenerator* generator, const RspPageRun* runs, size_t runCount, uint64_t pageSize) {
+    generator->runs = runs;
+    generator->runCount = runCount;
+    generator->runIndex = 0;
+    generator->pageSize = pageSize;
+    generator->remaining = 0;
+    for(size_t i = 0; i < runCount; ++i) {
+        generator->remaining += runs[i].pageCount;
+    }
+    generator->nextAddr = runCount ? runs[0].start : 0;
+    generator->runRemaining = runCount ? runs[0].pageCount : 0;
+}
+
+size_t rsp_page_touch_fill(RspPageTouchGenerator* generator, char* out, uint32_t maxCommands, uint32_t* commandCountOut) {
+    // checksum of every byte except the address digits: 'M' ',' '1' ':' '6' '9'
+    const uint8_t fixedSum = (uint8_t)('M' + ',' + '1' + ':' + '6' + '9');
+    uint32_t commandCount = 0;
+    char* cur = out;
+    while(commandCount < maxCommands && generator->remaining > 0) {
+        if(generator->runRemaining == 0) {
+            const RspPageRun* run = &generator->runs[++generator->runIndex];
+            generator->nextAddr = run->start;
+            generator->runRemaining = run->pageCount;
+            continue;
+        }
+        // addresses use as few digits as possible, so commands get longer as the address grows
+        uint64_t addr = generator->nextAddr;
+        uint32_t digitCount = rsp_hex_digit_count(addr);
+        uint8_t sum = fixedSum;
+        cur[0] = '$';
+        cur[1] = 'M';
+        for(char* digit = cur + 1 + digitCount; digit > cur + 1; --digit) {
+            *digit = rspHexDigits[addr & 0xf];
+            sum += (uint8_t)*digit;
+            addr >>= 4;
+        }
+        cur += 2 + digitCount;
+        memcpy(cur, ",1:69#", 6);
+        cur[6] = rspHexDigits[sum >> 4];
+        cur[7] = rspHexDigits[sum & 0xf];
+        cur += 8;
+        
+        generator->nextAddr += generator->pageSize;
+        --generator->runRemaining;
+        --generator->remaining;
+        ++commandCount;
+    }
+    *commandCountOut = commandCount;
+    return cur - out;
+}
+
+typedef struct RspPrepareErrorContext {
+    RspMemoryRegion* regions;
+    const RspPageRun* runs;
+    size_t runCount;
+} RspPrepareErrorContext;
+
+// replies come back in command order, walk the runs to find which page was refused
+static void rsp_prepare_on_error(void* userData, uint64_t replyIndex, const char* reply, size_t replyLength) {
+    RspPrepareErrorContext* errorContext = userData;
+    for(size_t i = 0; i < errorContext->runCount; ++i) {
+        const RspPageRun* run = &errorContext->runs[i];
+        if(replyIndex >= run->pageCount) {
+            replyIndex -= run->pageCount;
+            continue;
+        }
+        RspMemoryRegion* region = &errorContext->regions[run->regionIndex];
+        if(region->failedPage < 0) {
+            region->failedPage = (int64_t)(run->firstPage + replyIndex);
+            size_t copyLength = replyLength < sizeof(region->error) - 1 ? replyLength : sizeof(region->error) - 1;
+            memcpy(region->error, reply, copyLength);
+            region->error[copyLength] = 0;
+        }
+        return;
+    }
+}
+
+// splits the regions into runs of pages that still need a write
+static size_t rsp_prepare_build_runs(PreparedPages* prepared, const RspMemoryRegion* regions, size_t regionCount, uint64_t pageSize, RspPageRun** runsOut, uint64_t* skippedOut) {
+    size_t runCount = 0;
+    size_t runCapacity = regionCount ? regionCount : 1;
+    RspPageRun* runs = malloc(runCapacity * sizeof(RspPageRun));
+    PageRange* gaps = 0;
+    size_t gapCapacity = 0;
+    uint64_t skipped = 0;
+    for(size_t i = 0; i < regionCount; ++i) {
+        uint64_t pageCount = rsp_region_page_count(&regions[i], pageSize);
+        if(pageCount == 0) {
+            continue;
+        }
+        uint64_t firstPageNumber = regions[i].start / pageSize;
+        size_t gapCount = 0;
+        if(prepared) {
+            skipped += prepared_pages_missing(prepared, pageSize, firstPageNumber, firstPageNumber + pageCount, &gaps, &gapCount, &gapCapacity);
+        } else {
+            if(!gapCapacity) {
+                gapCapacity = 1;
+                gaps = malloc(sizeof(PageRange));
+            }
+            gaps[gapCount++] = (PageRange){ firstPageNumber, firstPageNumber + pageCount };
+        }
+        for(size_t j = 0; j < gapCount; ++j) {
+            if(runCount == runCapacity) {
+                runCapacity *= 2;
+                runs = realloc(runs, runCapacity * sizeof(RspPageRun));
+            }
+            uint64_t firstPage = gaps[j].start - firstPageNumber;
+            runs[runCount++] = (RspPageRun){
+                .start = regions[i].start + firstPage * pageSize,
+                .pageCount = gaps[j].end - gaps[j].start,
+                .regionIndex = i,
+                .firstPage = firstPage
+            };
+        }
+    }
+    free(gaps);
+    *runsOut = runs;
+    *skippedOut = skipped;
+    return runCount;
+}
+
+uint64_t rsp_now_micros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Sizes the write window from what the link actually does: the lowest round trip seen
+// approximates the idle latency, the reply rate the throughput, and twice their product
+// keeps the pipe full without queueing much more than one extra round trip in debugserver.
+typedef struct RspWindowTuner {
+    uint32_t window;
+    struct {
+        uint64_t endCommand;
+        uint64_t sentAt;
+    } batches[RSP_WRITE_RTT_SAMPLES];
+    uint32_t batchHead;
+    uint32_t batchCount;
+    uint64_t minRtt;
+    uint64_t lastRtt;
+    // replies per second, exponentially averaged
+    double replyRate;
+    uint64_t lastSampleTime;
+    uint64_t lastSampleAcked;
+} RspWindowTuner;
+
+static void rsp_tuner_on_send(RspWindowTuner* tuner, uint64_t endCommand) {
+    uint64_t now = rsp_now_micros();
+    if(tuner->lastSampleTime == 0) {
+        tuner->lastSampleTime = now;
+    }
+    if(tuner->batchCount == RSP_WRITE_RTT_SAMPLES) {
+        return;
+    }
+    uint32_t slot = (tuner->batchHead + tuner->batchCount) % RSP_WRITE_RTT_SAMPLES;
+    tuner->batches[slot].endCommand = endCommand;
+    tuner->batches[slot].sentAt = now;
+    ++tuner->batchCount;
+}
+
+static void rsp_tuner_on_ack(RspWindowTuner* tuner, uint64_t ackedCount) {
+    uint64_t now = rsp_now_micros();
+    int sampled = 0;
+    while(tuner->batchCount && tuner->batches[tuner->batchHead].endCommand <= ackedCount) {
+        uint64_t rtt = now - tuner->batches[tuner->batchHead].sentAt;
+        tuner->lastRtt = rtt;
+        if(tuner->minRtt == 0 || rtt < tuner->minRtt) {
+            tuner->minRtt = rtt;
+        }
+        tuner->batchHead = (tuner->batchHead + 1) % RSP_WRITE_RTT_SAMPLES;
+        --tuner->batchCount;
+        sampled = 1;
+    }
+    if(!sampled || now <= tuner->lastSampleTime) {
+        return;
+    }
+    
+    double rate = (double)(ackedCount - tuner->lastSampleAcked) * 1000000.0 / (double)(now - tuner->lastSampleTime);
+    tuner->replyRate = tuner->replyRate > 0 ? tuner->replyRate * 0.75 + rate * 0.25 : rate;
+    tuner->lastSampleTime = now;
+    tuner->lastSampleAcked = ackedCount;
+    
+    double target = 2.0 * tuner->replyRate * (double)tuner->minRtt / 1000000.0;
+    if(target < RSP_WRITE_WINDOW_MIN) {
+        target = RSP_WRITE_WINDOW_MIN;
+    } else if(target > RSP_WRITE_WINDOW_MAX) {
+        target = RSP_WRITE_WINDOW_MAX;
+    }
+    // move halfway each time so a single odd sample can't swing the window
+    tuner->window = (uint32_t)((tuner->window + (uint32_t)target) / 2);
+}
+
+int rsp_prepare_memory_regions(DebugProxyHandle* debugProxy, RspMemoryRegion* regions, size_t regionCount, uint64_t pageSize, RspPrepareStats* stats, IdeviceFfiError** errOut) {
+    for(size_t i = 0; i < regionCount; ++i) {
+        regions[i].failedPage = -1;
+        regions[i].error[0] = 0;
+    }
+    DebugSession* session = debug_session_get(debugProxy);
+    PreparedPages* prepared = session ? &session->preparedPages : 0;
+    RspPageRun* runs = 0;
+    uint64_t skippedCount = 0;
+    size_t runCount = rsp_prepare_build_runs(prepared, regions, regionCount, pageSize, &runs, &skippedCount);
+    
+    // commands are generated just ahead of the sender into one window-sized buffer,
+    // so memory use doesn't depend on the region size and the first send happens right away
+    RspPageTouchGenerator generator;
+    rsp_page_touch_init(&generator, runs, runCount, pageSize);
+    uint64_t commandCount = generator.remaining;
+    char* commandBuffer = malloc(RSP_WRITE_WINDOW_MAX * RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH);
+    RspPrepareErrorContext errorContext = { regions, runs, runCount };
+    RspReplyDrain drain;
+    rsp_drain_init(&drain, RSP_WRITE_DRAIN_BUFFER_SIZE);
+    drain.onError = rsp_prepare_on_error;
+    drain.onErrorUserData = &errorContext;
+    RspWindowTuner tuner = { .window = RSP_WRITE_WINDOW_INITIAL };
+    
+    // keep the link busy: top the window up as soon as a quarter of it was answered
+    // instead of waiting for a whole batch to be answered
+    int result = 0;
+    uint64_t sentCount = 0;
+    uint64_t sentBytes = 0;
+    uint64_t ackedCount = 0;
+    while(ackedCount < commandCount) {
+        uint32_t inFlight = (uint32_t)(sentCount - ackedCount);
+        uint32_t refillThreshold = tuner.window - tuner.window / 4;
+        if(sentCount < commandCount && inFlight <= refillThreshold) {
+            uint32_t commandsToSend = 0;
+            size_t bytesToSend = rsp_page_touch_fill(&generator, commandBuffer, tuner.window - inFlight, &commandsToSend);
+            IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, (const uint8_t *)commandBuffer, bytesToSend);
+            if(err) {
+                *errOut = err;
+                result = -1;
+                break;
+            }
+            sentCount += commandsToSend;
+            sentBytes += bytesToSend;
+            rsp_tuner_on_send(&tuner, sentCount);
+            continue;
+        }
+        
+        // drain back down to the refill threshold, or everything once the last command went out
+        uint32_t repliesToDrain = sentCount < commandCount ? inFlight - refillThreshold : inFlight;
+        result = rsp_drain_replies(debugProxy, &drain, repliesToDrain, errOut);
+        if(result) {
+            break;
+        }
+        ackedCount += repliesToDrain;
+        rsp_tuner_on_ack(&tuner, ackedCount);
+    }
+    
+    if(prepared) {
+        prepared->skippedTotal += skippedCount;
+        if(result == 0) {
+            // pages up to a region's first refused page are known good
+            for(size_t i = 0; i < regionCount; ++i) {
+                uint64_t firstPageNumber = regions[i].start / pageSize;
+                uint64_t goodPages = regions[i].failedPage < 0 ? rsp_region_page_count(&regions[i], pageSize) : (uint64_t)regions[i].failedPage;
+                prepared_pages_add(prepared, pageSize, firstPageNumber, firstPageNumber + goodPages);
+            }
+        }
+    }
+    if(stats) {
+        stats->commandCount = sentCount;
+        stats->skippedCount = skippedCount;
+        stats->bytesSent = sentBytes;
+        stats->bytesReceived = drain.bytesReceived;
+        stats->window = tuner.window;
+        stats->minRttMicros = tuner.minRtt;
+    }
+    rsp_drain_free(&drain);
+    free(commandBuffer);
+    free(runs);
+    return result;
+}
+
+// payload packets are up to PacketSize bytes each, a few in flight are enough to hide the round trip
+#define RSP_PAYLOAD_WINDOW 8
+
+int rsp_write_memory(DebugProxyHandle* debugProxy, uint64_t addr, const uint8_t* data, size_t length, bool allowBinary, RspWriteResult* result, IdeviceFfiError** errOut) {
+    DebugSession* session = debug_session_get(debugProxy);
+    uint64_t packetSize = session ? session->packetSize : DEBUG_SESSION_DEFAULT_PACKET_SIZE;
+    uint64_t hexChunk = debug_session_max_hex_payload(session);
+    bool binary = allowBinary && (!session || session->binaryWrite != 0);
+    // until debugserver answered an X packet we don't know if it understands them
+    bool probing = binary && (!session || session->binaryWrite < 0);
+    
+    memset(result, 0, sizeof(RspWriteResult));
+    result->failedOffset = -1;
+    char* packet = malloc(rsp_mem_write_packet_size(hexChunk) > packetSize ? rsp_mem_write_packet_size(hexChunk) : packetSize);
+    // data offset of each packet still in flight, to tell which write a refusal belongs to
+    size_t packetOffsets[RSP_PAYLOAD_WINDOW];
+    RspReplyDrain drain;
+    rsp_drain_init(&drain, RSP_WRITE_DRAIN_BUFFER_SIZE);
+    
+    // every reply frees a slot for the next packet, so the window never runs dry waiting for the slowest one
+    int ret = 0;
+    size_t offset = 0;
+    uint64_t sentCount = 0;
+    uint64_t ackedCount = 0;
+    while(ret == 0 && (offset < length || ackedCount < sentCount)) {
+        uint32_t inFlight = (uint32_t)(sentCount - ackedCount);
+        uint32_t window = probing ? 1 : RSP_PAYLOAD_WINDOW;
+        if(offset < length && inFlight < window) {
+            size_t consumed = 0;
+            size_t packetLength = 0;
+            if(binary) {
+                packetLength = rsp_build_binary_write_packet(packet, packetSize, addr + offset, data + offset, length - offset, &consumed);
+            } else {
+                consumed = length - offset < hexChunk ? length - offset : hexChunk;
+                packetLength = rsp_build_mem_write_packet(packet, addr + offset, data + offset, consumed);
+            }
+            IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, (const uint8_t*)packet, packetLength);
+            if(err) {
+                *errOut = err;
+                ret = -1;
+                break;
+            }
+            packetOffsets[sentCount % RSP_PAYLOAD_WINDOW] = offset;
+            offset += consumed;
+            ++sentCount;
+            result->bytesSent += packetLength;
+            continue;
+        }
+        
+        ret = rsp_drain_replies(debugProxy, &drain, 1, errOut);
+        if(ret) {
+            break;
+        }
+        uint64_t replyIndex = ackedCount++;
+        if(probing) {
+            probing = false;
+            bool rejected = drain.firstErrorIndex >= 0 && drain.firstError[0] == 0;
+            if(session) {
+                session->binaryWrite = rejected ? 0 : 1;
+            }
+            if(rejected) {
+                // empty reply: X isn't supported, send the same data again as M packets
+                binary = false;
+                offset = packetOffsets[replyIndex % RSP_PAYLOAD_WINDOW];
+                result->packetCount += sentCount;
+                result->bytesReceived += drain.bytesReceived;
+                rsp_drain_reset(&drain);
+                sentCount = ackedCount = 0;
+                continue;
+            }
+        }
+        if(drain.firstErrorIndex >= 0) {
+            result->failedOffset = (int64_t)packetOffsets[drain.firstErrorIndex % RSP_PAYLOAD_WINDOW];
+            memcpy(result->error, drain.firstError, sizeof(result->error));
+            ret = -3;
+            // the packets sent after the refused one are answered too, read those replies so the
+            // next command on the connection gets its own
+            int drainRet = rsp_drain_replies(debugProxy, &drain, (uint32_t)(sentCount - ackedCount), errOut);
+            if(drainRet) {
+                ret = drainRet;
+            }
+            break;
+        }
+    }
+    
+    result->packetCount += sentCount;
+    result->bytesReceived += drain.bytesReceived;
+    result->binary = binary;
+    rsp_drain_free(&drain);
+    free(packet);
+    return ret;
+}
+
+// m replies are up to PacketSize bytes each, a few in flight are enough to hide the round trip
+#define RSP_READ_WINDOW 4
+
+int rsp_read_memory(DebugProxyHandle* debugProxy, uint64_t addr, uint64_t length, RspReadSinkFunc sink, void* userData, RspReadResult* result, IdeviceFfiError** errOut) {
+    DebugSession* session = debug_session_get(debugProxy);
+    uint64_t chunk = debug_session_max_hex_payload(session);
+    // room for a whole reply plus the start of the next one
+    size_t capacity = (size_t)(2 * chunk + 64) * 2;
+    char* buffer = malloc(capacity);
+    size_t buffered = 0;
+    uint8_t* data = malloc((size_t)chunk);
+    
+    memset(result, 0, sizeof(RspReadResult));
+    result->failedOffset = -1;
+    int ret = 0;
+    uint64_t requested = 0;
+    uint64_t received = 0;
+    uint32_t inFlight = 0;
+    while(ret == 0 && received < length) {
+        if(requested < length && inFlight < RSP_READ_WINDOW) {
+            uint64_t readLength = length - requested < chunk ? length - requested : chunk;
+            char packet[64];
+            int packetLength = snprintf(packet, sizeof(packet) - 3, "$m%llx,%llx", (unsigned long long)(addr + requested), (unsigned long long)readLength);
+            uint8_t sum = rsp_checksum(packet + 1, packetLength - 1);
+            packet[packetLength] = '#';
+            packet[packetLength + 1] = rspHexDigits[sum >> 4];
+            packet[packetLength + 2] = rspHexDigits[sum & 0xf];
+            IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, (const uint8_t*)packet, packetLength + 3);
+            if(err) {
+                *errOut = err;
+                ret = -1;
+                break;
+            }
+            requested += readLength;
+            ++inFlight;
+            ++result->packetCount;
+            result->bytesSent += packetLength + 3;
+            continue;
+        }
+        
+        // nothing but our replies can arrive, ask for up to what they add up to if all succeed
+        uint64_t expected = 2 * (requested - received) + 4 * inFlight;
+        size_t wanted = expected > buffered ? (size_t)(expected - buffered) : 1;
+        if(wanted > capacity - buffered) {
+            wanted = capacity - buffered;
+        }
+        char* chunkData = 0;
+        IdeviceFfiError* err = debug_proxy_read(debugProxy, wanted, &chunkData);
+        if(err) {
+            idevice_string_free(chunkData);
+            *errOut = err;
+            ret = -1;
+            break;
+        }
+        size_t chunkLength = chunkData ? strlen(chunkData) : 0;
+        if(chunkLength == 0) {
+            idevice_string_free(chunkData);
+            ret = -2;
+            break;
+        }
+        memcpy(buffer + buffered, chunkData, chunkLength);
+        buffered += chunkLength;
+        result->bytesReceived += chunkLength;
+        idevice_string_free(chunkData);
+        
+        // hand every complete reply to the sink
+        char* cur = buffer;
+        char* end = buffer + buffered;
+        while(ret == 0 && cur < end) {
+            if(*cur != '$') {
+                ++cur;
+                continue;
+            }
+            char* hash = memchr(cur, '#', end - cur);
+            if(!hash || end - hash < 3) {
+                break;
+            }
+            char* payload = cur + 1;
+            size_t payloadLength = hash - payload;
+            uint64_t expectedLength = length - received < chunk ? length - received : chunk;
+            cur = hash + 3;
+            --inFlight;
+            if(payloadLength > 0 && payloadLength <= 3 && payload[0] == 'E') {
+                result->failedOffset = (int64_t)received;
+                memcpy(result->error, payload, payloadLength);
+                result->error[payloadLength] = 0;
+                ret = -3;
+                break;
+            }
+            // debugserver run-length encodes repeated digits, so the reply is expanded into its own buffer
+            int64_t decoded = rsp_decode_payload(data, (size_t)expectedLength, payload, payloadLength, hash + 1, true);
+            if(decoded < 0) {
+                ret = -4;
+                break;
+            }
+            size_t decodedLength = (size_t)decoded;
+            if(!sink(userData, received, data, decodedLength)) {
+                ret = -4;
+                break;
+            }
+            received += decodedLength;
+            result->bytesRead = received;
+            if(decodedLength < expectedLength) {
+                // the rest of the range isn't readable
+                result->failedOffset = (int64_t)received;
+                ret = -3;
+                break;
+            }
+        }
+        buffered = end - cur;
+        memmove(buffer, cur, buffered);
+    }
+    
+    // replies to reads still in flight have to be consumed before the connection can be used again
+    if(ret == -3 || ret == -4) {
+        while(inFlight > 0) {
+            char* hash = memchr(buffer, '#', buffered);
+            if(hash && buffer + buffered - hash >= 3) {
+                buffered = buffer + buffered - (hash + 3);
+                memmove(buffer, hash + 3, buffered);
+                --inFlight;
+                continue;
+            }
+            char* chunkData = 0;
+            IdeviceFfiError* err = debug_proxy_read(debugProxy, capacity - buffered, &chunkData);
+            size_t chunkLength = chunkData ? strlen(chunkData) : 0;
+            if(err || chunkLength == 0 || chunkLength > capacity - buffered) {
+                idevice_string_free(chunkData);
+                if(err) {
+                    idevice_error_free(err);
+                }
+                break;
+            }
+            memcpy(buffer + buffered, chunkData, chunkLength);
+            buffered += chunkLength;
+            idevice_string_free(chunkData);
+        }
+    }
+    free(buffer);
+    free(data);
+    return ret;
+}
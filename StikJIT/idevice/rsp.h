@@ -0,0 +1,191 @@
+//
+//  rsp.h
+//  StikJIT
+//
+//  Helpers for talking debugserver's remote serial protocol in bulk.
+//
+
+#ifndef RSP_H
+#define RSP_H
+#include "idevice.h"
+
+// monotonic clock in microseconds, for timing round trips and traps
+uint64_t rsp_now_micros(void);
+
+typedef void (*RspReplyErrorFunc)(void* userData, uint64_t replyIndex, const char* reply, size_t replyLength);
+
+// Collects many small replies (e.g. the "OK"s answering a batch of $M writes)
+// into one reusable buffer and scans them in place.
+typedef struct RspReplyDrain {
+    char* buffer;
+    uint32_t capacity;
+    // bytes of a partially received packet carried over to the next read
+    uint32_t length;
+    uint64_t replyCount;
+    uint64_t okCount;
+    uint64_t bytesReceived;
+    // index of the first non-OK reply, -1 if every reply was OK
+    int64_t firstErrorIndex;
+    char firstError[8];
+    // optional, called for every non-OK reply
+    RspReplyErrorFunc onError;
+    void* onErrorUserData;
+} RspReplyDrain;
+
+void rsp_drain_init(RspReplyDrain* drain, uint32_t capacity);
+void rsp_drain_reset(RspReplyDrain* drain);
+void rsp_drain_free(RspReplyDrain* drain);
+// reads until `replyCount` more replies were parsed. Never reads past the last of them.
+// returns 0 on success, -1 if the read failed (*errOut is set), -2 if the connection was closed
+int rsp_drain_replies(DebugProxyHandle* debugProxy, RspReplyDrain* drain, uint32_t replyCount, IdeviceFfiError** errOut);
+
+// hex encodes `length` bytes into `out` (2 * length chars, lowercase) and returns the
+// mod-256 sum of the produced characters so callers can finish a packet checksum in the same pass
+uint8_t rsp_hex_encode(char* out, const uint8_t* data, size_t length);
+// decodes `length` hex chars from `hex` into `out` (length / 2 bytes); out may equal hex to decode in place.
+// returns false if a non hex character was found
+bool rsp_hex_decode(uint8_t* out, const char* hex, size_t length);
+// mod-256 sum of `length` bytes, i.e. the RSP checksum of a packet body
+uint8_t rsp_checksum(const char* data, size_t length);
+// writes "$<body>#xx" into out, which must hold length + 4 bytes. returns the number of bytes written
+size_t rsp_build_packet(char* out, const char* body, size_t length);
+
+#define RSP_DECODE_BAD_CHECKSUM -1
+#define RSP_DECODE_MALFORMED -2
+#define RSP_DECODE_OVERFLOW -3
+
+// length of payload once its run-length encoding ("c*n" is c repeated n - 29 more times) is expanded,
+// an upper bound on what rsp_decode_payload produces with hex set to false
+size_t rsp_expanded_length(const char* payload, size_t length);
+// decodes the payload of a "$<payload>#xx" reply in one pass: expands run-length encoding, undoes
+// '}' escapes (unless hex is set) and, if hex is set, turns the hex digits into bytes while the
+// checksum is summed along the way. checksum points at the two digits after '#', or NULL to skip the check.
+// returns the decoded length, or RSP_DECODE_BAD_CHECKSUM, RSP_DECODE_MALFORMED or RSP_DECODE_OVERFLOW
+int64_t rsp_decode_payload(uint8_t* out, size_t capacity, const char* payload, size_t length, const char* checksum, bool hex);
+// Reads a stream of packets, keeping bytes that arrived past one packet for the next call.
+typedef struct RspPacketReader {
+    char* buffer;
+    size_t capacity;
+    size_t length;
+    // bytes at the front of buffer belonging to the packet returned last
+    size_t consumed;
+    uint64_t bytesReceived;
+} RspPacketReader;
+
+void rsp_reader_init(RspPacketReader* reader, size_t capacity);
+void rsp_reader_free(RspPacketReader* reader);
+// waits for the next packet. *payload points at its still encoded payload, followed by '#' and the
+// two checksum digits, and stays valid until the next call.
+// returns 0 on success, -1 if the read failed (*errOut is set), -2 if the connection was closed
+int rsp_reader_next(DebugProxyHandle* debugProxy, RspPacketReader* reader, const char** payload, size_t* payloadLength, IdeviceFfiError** errOut);
+
+// reads the reply to the only outstanding command. *packetOut is a malloc'd buffer starting with
+// "$<payload>#xx" of *packetLengthOut bytes, acks in front of it are dropped.
+// returns 0 on success, -1 if the read failed (*errOut is set), -2 if the connection was closed
+int rsp_read_reply(DebugProxyHandle* debugProxy, char** packetOut, size_t* packetLengthOut, IdeviceFfiError** errOut);
+// writes "$M<addr>,<length>:<hex data>#xx" into `out`, which must hold rsp_mem_write_packet_size(length) bytes.
+// returns the number of bytes written
+size_t rsp_build_mem_write_packet(char* out, uint64_t addr, const uint8_t* data, size_t length);
+size_t rsp_mem_write_packet_size(size_t length);
+// writes "$X<addr>,<length>:<escaped data>#xx" carrying as much of data as fits in packetSize bytes.
+// '#', '$', '}' and '*' are sent as '}' followed by the byte xor 0x20.
+// `out` must hold packetSize bytes. returns the number of bytes written, *consumed is the data length carried
+size_t rsp_build_binary_write_packet(char* out, uint64_t packetSize, uint64_t addr, const uint8_t* data, size_t length, size_t* consumed);
+
+// longest "$M<addr>,1:69#xx" command, with a 16 digit address
+#define RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH 26
+
+typedef struct RspMemoryRegion {
+    uint64_t start;
+    uint64_t size;
+    // set by rsp_prepare_memory_regions: first page debugserver refused to write, -1 if none
+    int64_t failedPage;
+    char error[8];
+} RspMemoryRegion;
+
+// consecutive pages of one region that still need a write
+typedef struct RspPageRun {
+    uint64_t start;
+    uint64_t pageCount;
+    size_t regionIndex;
+    // index of the run's first page within its region
+    uint64_t firstPage;
+} RspPageRun;
+
+// Lazily produces one-byte "$M<addr>,1:69#xx" writes touching every page of a list of runs,
+// as one continuous stream.
+typedef struct RspPageTouchGenerator {
+    const RspPageRun* runs;
+    size_t runCount;
+    size_t runIndex;
+    uint64_t pageSize;
+    uint64_t nextAddr;
+    // commands not generated yet for the current run and for all runs
+    uint64_t runRemaining;
+    uint64_t remaining;
+} RspPageTouchGenerator;
+
+static inline uint64_t rsp_region_page_count(const RspMemoryRegion* region, uint64_t pageSize) {
+    return (region->size + pageSize - 1) / pageSize;
+}
+
+void rsp_page_touch_init(RspPageTouchGenerator* generator, const RspPageRun* runs, size_t runCount, uint64_t pageSize);
+// writes up to maxCommands commands into out, which must hold maxCommands * RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH bytes.
+// returns the number of bytes written
+size_t rsp_page_touch_fill(RspPageTouchGenerator* generator, char* out, uint32_t maxCommands, uint32_t* commandCountOut);
+
+typedef struct RspPrepareStats {
+    uint64_t commandCount;
+    // pages already prepared earlier in this debug session, no command was sent for them
+    uint64_t skippedCount;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    // write window the sender settled on and the lowest round trip it measured
+    uint32_t window;
+    uint64_t minRttMicros;
+} RspPrepareStats;
+
+// touches every page of every region with a pipelined stream of $M writes.
+// pages debugserver refuses are recorded on their region, they don't stop the stream.
+// if the proxy has a DebugSession, pages it already prepared are skipped and newly prepared ones are remembered.
+// returns 0 on success, -1 if the connection failed (*errOut is set), -2 if debugserver closed it
+int rsp_prepare_memory_regions(DebugProxyHandle* debugProxy, RspMemoryRegion* regions, size_t regionCount, uint64_t pageSize, RspPrepareStats* stats, IdeviceFfiError** errOut);
+
+typedef struct RspWriteResult {
+    uint64_t packetCount;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    // whether the data went out as binary X packets or fell back to hex M packets
+    bool binary;
+    // offset of the first byte debugserver refused to write, -1 if none
+    int64_t failedOffset;
+    char error[8];
+} RspWriteResult;
+
+// writes data to addr with pipelined packets sized from the session's PacketSize.
+// binary X packets are used when allowed and debugserver accepts them, hex M packets otherwise.
+// returns 0 on success, -1 if the connection failed (*errOut is set), -2 if debugserver closed it,
+// -3 if debugserver refused a write (see result->failedOffset)
+int rsp_write_memory(DebugProxyHandle* debugProxy, uint64_t addr, const uint8_t* data, size_t length, bool allowBinary, RspWriteResult* result, IdeviceFfiError** errOut);
+
+// receives decoded memory in order, returns false to abort the read
+typedef bool (*RspReadSinkFunc)(void* userData, uint64_t offset, const uint8_t* data, size_t length);
+
+typedef struct RspReadResult {
+    uint64_t bytesRead;
+    uint64_t packetCount;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    // offset where reading stopped early because debugserver refused or cut a read short, -1 if it didn't
+    int64_t failedOffset;
+    char error[8];
+} RspReadResult;
+
+// reads [addr, addr + length) with pipelined m packets sized from the session's PacketSize.
+// replies are decoded in place in one receive buffer and handed to sink, so memory use doesn't
+// depend on length.
+// returns 0 on success, -1 if the connection failed (*errOut is set), -2 if debugserver closed it,
+// -3 if debugserver refused a read (see result->failedOffset), -4 if sink aborted or a reply was malformed
+int rsp_read_memory(DebugProxyHandle* debugProxy, uint64_t addr, uint64_t length, RspReadSinkFunc sink, void* userData, RspReadResult* result, IdeviceFfiError** errOut);
+
+#endif /* RSP_H */
@@ -0,0 +1,104 @@
+//
+//  stop_reply.c
+//  StikJIT
+//
+//  Parses debugserver's T/S/W/X stop replies into a fixed struct without allocating.
+//
+
+#include <string.h>
+
+#include "stop_reply.h"
+
+static inline int stop_hex_value(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// big endian hex number such as a thread id or register number, stops at the first non hex character
+static uint64_t stop_hex_number(const char* cur, const char* end, const char** next) {
+    uint64_t value = 0;
+    int digit;
+    while(cur < end && (digit = stop_hex_value(*cur)) >= 0) {
+        value = value << 4 | (uint64_t)digit;
+        ++cur;
+    }
+    *next = cur;
+    return value;
+}
+
+uint64_t stop_reply_le_value(const char* hex, size_t length) {
+    uint64_t value = 0;
+    if(length > 16) {
+        length = 16;
+    }
+    for(size_t i = 0; i + 1 < length; i += 2) {
+        int high = stop_hex_value(hex[i]);
+        int low = stop_hex_value(hex[i + 1]);
+        value |= (uint64_t)((high << 4 | low) & 0xff) << (i * 4);
+    }
+    return value;
+}
+
+bool stop_reply_parse(const char* text, size_t length, StopReply* stop) {
+    if(length < 3 || !strchr("TSWX", text[0]) || stop_hex_value(text[1]) < 0 || stop_hex_value(text[2]) < 0) {
+        return false;
+    }
+    stop->kind = text[0];
+    stop->signal = (uint8_t)(stop_hex_value(text[1]) << 4 | stop_hex_value(text[2]));
+    stop->hasThread = false;
+    stop->thread = 0;
+    stop->exceptionType = 0;
+    stop->registerCount = 0;
+    if(stop->kind != 'T') {
+        // S/W/X carry nothing else that matters here
+        return true;
+    }
+    
+    const char* cur = text + 3;
+    const char* end = text + length;
+    while(cur < end) {
+        const char* entryEnd = memchr(cur, ';', end - cur);
+        if(!entryEnd) {
+            entryEnd = end;
+        }
+        const char* colon = memchr(cur, ':', entryEnd - cur);
+        if(colon) {
+            size_t keyLength = colon - cur;
+            const char* value = colon + 1;
+            const char* numberEnd;
+            uint64_t registerNumber = stop_hex_number(cur, colon, &numberEnd);
+            if(numberEnd == colon && keyLength <= 4) {
+                // "nn:value" is an expedited register
+                if(stop->registerCount < STOP_REPLY_MAX_REGISTERS) {
+                    StopRegister* reg = &stop->registers[stop->registerCount++];
+                    reg->number = (uint16_t)registerNumber;
+                    reg->size = (uint16_t)((entryEnd - value) / 2);
+                    reg->value = reg->size <= 8 ? stop_reply_le_value(value, entryEnd - value) : 0;
+                }
+            } else if(keyLength == 6 && memcmp(cur, "thread", 6) == 0) {
+                stop->thread = stop_hex_number(value, entryEnd, &numberEnd);
+                stop->hasThread = true;
+            } else if(keyLength == 6 && memcmp(cur, "metype", 6) == 0) {
+                stop->exceptionType = (uint32_t)stop_hex_number(value, entryEnd, &numberEnd);
+            }
+        }
+        cur = entryEnd + 1;
+    }
+    return true;
+}
+
+bool stop_reply_register(const StopReply* stop, uint16_t number, uint64_t* value) {
+    for(uint32_t i = 0; i < stop->registerCount; ++i) {
+        if(stop->registers[i].number == number && stop->registers[i].size <= 8) {
+            *value = stop->registers[i].value;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,44 @@
+//
+//  stop_reply.h
+//  StikJIT
+//
+//  Parses debugserver's T/S/W/X stop replies into a fixed struct without allocating.
+//
+
+#ifndef STOP_REPLY_H
+#define STOP_REPLY_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// debugserver expedites the general purpose registers (34 on arm64), anything past this is dropped
+#define STOP_REPLY_MAX_REGISTERS 64
+
+typedef struct StopRegister {
+    uint16_t number;
+    // bytes the register has, values of registers wider than 8 bytes aren't kept
+    uint16_t size;
+    uint64_t value;
+} StopRegister;
+
+typedef struct StopReply {
+    // 'T' or 'S' when the process stopped, 'W' when it exited, 'X' when a signal terminated it
+    char kind;
+    // signal number for T/S/X, exit status for W
+    uint8_t signal;
+    bool hasThread;
+    uint64_t thread;
+    // mach exception type from metype, 0 if there is none
+    uint32_t exceptionType;
+    uint32_t registerCount;
+    StopRegister registers[STOP_REPLY_MAX_REGISTERS];
+} StopReply;
+
+// parses an already run-length expanded stop reply, returns false if text isn't one
+bool stop_reply_parse(const char* text, size_t length, StopReply* stop);
+// looks up an expedited register, returns false if the reply didn't carry it
+bool stop_reply_register(const StopReply* stop, uint16_t number, uint64_t* value);
+// value of up to 16 hex digits of target (little endian) byte order, as register values are sent
+uint64_t stop_reply_le_value(const char* hex, size_t length);
+
+#endif /* STOP_REPLY_H */
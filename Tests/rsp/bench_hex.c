@@ -0,0 +1,73 @@
+//
+//  bench_hex.c
+//  StikJIT host tests
+//
+//  Throughput of the rsp.c hex kernels against the byte-at-a-time reference, in MB of
+//  binary data per second, for packet-sized and bulk buffers.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "fake_debugserver.h"
+#include "hex_reference.h"
+#include "test_util.h"
+
+typedef enum BenchKernel {
+    BENCH_ENCODE,
+    BENCH_DECODE,
+    BENCH_CHECKSUM,
+} BenchKernel;
+
+static const char* const benchKernelNames[] = { "encode", "decode", "checksum" };
+
+// MB/s processing totalBytes of binary data in blocks of length
+static double bench_kernel(BenchKernel kernel, bool reference, size_t length, uint64_t totalBytes, uint8_t* data, char* hex, uint64_t* sink) {
+    uint64_t rounds = totalBytes / length;
+    uint64_t start = fake_now_micros();
+    for(uint64_t round = 0; round < rounds; ++round) {
+        switch(kernel) {
+            case BENCH_ENCODE:
+                *sink += reference ? hex_reference_encode(hex, data, length) : rsp_hex_encode(hex, data, length);
+                break;
+            case BENCH_DECODE:
+                *sink += reference ? hex_reference_decode(data, hex, 2 * length) : rsp_hex_decode(data, hex, 2 * length);
+                *sink += data[round % length];
+                break;
+            case BENCH_CHECKSUM:
+                // a packet of hex carries length bytes in 2 * length characters
+                *sink += reference ? hex_reference_checksum(hex, 2 * length) : rsp_checksum(hex, 2 * length);
+                break;
+        }
+    }
+    double seconds = (double)(fake_now_micros() - start) / 1000000.0;
+    return (double)(rounds * length) / seconds / 1000000.0;
+}
+
+int main(int argc, char** argv) {
+    if(!hex_kernel_supported()) {
+        printf("bench_hex (%s): CPU lacks the instructions, skipped\n", HEX_KERNEL_NAME);
+        return HEX_SKIP_EXIT_CODE;
+    }
+    uint64_t totalBytes = test_is_quick(argc, argv) ? (4 << 20) : (512 << 20);
+    size_t lengths[] = { 64, 1024, 65536 };
+    uint8_t* data = malloc(65536);
+    char* hex = malloc(2 * 65536);
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    hex_random_fill(data, 65536, &state);
+    hex_reference_encode(hex, data, 65536);
+    uint64_t sink = 0;
+
+    printf("%s kernel\n%-9s %8s %14s %14s %8s\n", HEX_KERNEL_NAME, "", "bytes", "reference MB/s", "rsp.c MB/s", "speedup");
+    for(int kernel = BENCH_ENCODE; kernel <= BENCH_CHECKSUM; ++kernel) {
+        for(size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+            double reference = bench_kernel((BenchKernel)kernel, true, lengths[i], totalBytes, data, hex, &sink);
+            double kernelSpeed = bench_kernel((BenchKernel)kernel, false, lengths[i], totalBytes, data, hex, &sink);
+            printf("%-9s %8zu %14.0f %14.0f %7.1fx\n", benchKernelNames[kernel], lengths[i], reference, kernelSpeed, kernelSpeed / reference);
+        }
+    }
+    printf("(%llu)\n", (unsigned long long)sink);
+    free(hex);
+    free(data);
+    return test_finish("bench_hex");
+}
@@ -0,0 +1,69 @@
+//
+//  bench_page_touch.c
+//  StikJIT host tests
+//
+//  Cost of building page touch commands: rsp_page_touch_fill against snprintf of each
+//  payload followed by rsp_build_packet, 1024 commands per call like a full write window.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define BENCH_PAGE_SIZE 0x4000ULL
+#define BENCH_CHUNK 1024
+
+static size_t bench_snprintf_fill(uint64_t* nextAddr, char* out, uint32_t count) {
+    char* cur = out;
+    for(uint32_t i = 0; i < count; ++i) {
+        char payload[32];
+        int length = snprintf(payload, sizeof(payload), "M%llx,1:69", (unsigned long long)*nextAddr);
+        cur += rsp_build_packet(cur, payload, (size_t)length);
+        *nextAddr += BENCH_PAGE_SIZE;
+    }
+    return cur - out;
+}
+
+// nanoseconds per command, folding the output into *sink so nothing is optimized away
+static double bench_builder(bool generator, uint64_t start, uint64_t commandCount, uint64_t* sink) {
+    char* out = malloc(BENCH_CHUNK * RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH);
+    RspPageRun run = { .start = start, .pageCount = commandCount };
+    RspPageTouchGenerator touch;
+    rsp_page_touch_init(&touch, &run, 1, BENCH_PAGE_SIZE);
+    uint64_t nextAddr = start;
+    uint64_t begin = fake_now_micros();
+    for(uint64_t done = 0; done < commandCount; done += BENCH_CHUNK) {
+        uint32_t count = commandCount - done < BENCH_CHUNK ? (uint32_t)(commandCount - done) : BENCH_CHUNK;
+        size_t length;
+        if(generator) {
+            length = rsp_page_touch_fill(&touch, out, count, &count);
+        } else {
+            length = bench_snprintf_fill(&nextAddr, out, count);
+        }
+        *sink += length + (uint8_t)out[length - 1];
+    }
+    double elapsed = (double)(fake_now_micros() - begin);
+    free(out);
+    return elapsed * 1000.0 / (double)commandCount;
+}
+
+int main(int argc, char** argv) {
+    uint64_t commandCount = test_is_quick(argc, argv) ? 200000 : 20000000;
+    uint64_t starts[] = { 0x100000000ULL, 1ULL << 36, 0xfffffffc00000000ULL };
+    uint64_t sink = 0;
+    printf("%-20s %12s %12s %8s\n", "first address", "snprintf ns", "fill ns", "speedup");
+    for(size_t i = 0; i < sizeof(starts) / sizeof(starts[0]); ++i) {
+        // both builders must agree on the bytes before their speed means anything
+        uint64_t referenceSink = 0;
+        uint64_t generatorSink = 0;
+        double reference = bench_builder(false, starts[i], commandCount, &referenceSink);
+        double fill = bench_builder(true, starts[i], commandCount, &generatorSink);
+        CHECK_EQ_U64(generatorSink, referenceSink);
+        sink += generatorSink;
+        printf("0x%-18llx %12.1f %12.1f %7.1fx\n", (unsigned long long)starts[i], reference, fill, reference / fill);
+    }
+    printf("(%llu bytes)\n", (unsigned long long)sink);
+    return test_finish("bench_page_touch");
+}
@@ -0,0 +1,155 @@
+//
+//  bench_prepare.c
+//  StikJIT host tests
+//
+//  Time to touch every page of a JIT region over shaped links: one $M per round trip,
+//  1024 writes then waiting for all of their replies (the old handleJITPageWrite), a sliding
+//  window fixed at 1024 writes, and rsp_prepare_memory_regions' adaptive sliding window.
+//  Run without arguments for the full table, ctest runs it with --quick.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define BENCH_PAGE_SIZE 0x4000
+#define BENCH_REGION_START 0x100000000ULL
+#define BENCH_BATCH_SIZE 1024
+
+typedef enum BenchSender {
+    BENCH_LOCK_STEP,
+    BENCH_BATCH,
+    BENCH_FIXED_WINDOW,
+    BENCH_WINDOW,
+} BenchSender;
+
+static const char* const benchSenderNames[] = { "lock-step", "batch 1024", "window 1024", "adaptive" };
+
+// sends commands batchSize at a time, waiting for every reply of a batch before the next one
+static int bench_send_batches(DebugProxyHandle* debugProxy, uint64_t pageCount, uint32_t batchSize) {
+    RspPageRun run = { .start = BENCH_REGION_START, .pageCount = pageCount };
+    RspPageTouchGenerator generator;
+    rsp_page_touch_init(&generator, &run, 1, BENCH_PAGE_SIZE);
+    char* commands = malloc((size_t)batchSize * RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH);
+    RspReplyDrain drain;
+    rsp_drain_init(&drain, 65536);
+    int ret = 0;
+    while(ret == 0 && generator.remaining > 0) {
+        uint32_t commandCount = 0;
+        size_t length = rsp_page_touch_fill(&generator, commands, batchSize, &commandCount);
+        IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, (const uint8_t*)commands, length);
+        if(!err) {
+            ret = rsp_drain_replies(debugProxy, &drain, commandCount, &err);
+        } else {
+            ret = -1;
+        }
+        idevice_error_free(err);
+    }
+    if(drain.firstErrorIndex >= 0) {
+        ret = -3;
+    }
+    rsp_drain_free(&drain);
+    free(commands);
+    return ret;
+}
+
+// keeps window commands in flight, topping them up once a quarter was answered like
+// rsp_prepare_memory_regions does, but without ever resizing the window
+static int bench_send_window(DebugProxyHandle* debugProxy, uint64_t pageCount, uint32_t window) {
+    RspPageRun run = { .start = BENCH_REGION_START, .pageCount = pageCount };
+    RspPageTouchGenerator generator;
+    rsp_page_touch_init(&generator, &run, 1, BENCH_PAGE_SIZE);
+    char* commands = malloc((size_t)window * RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH);
+    RspReplyDrain drain;
+    rsp_drain_init(&drain, 65536);
+    uint32_t refillThreshold = window - window / 4;
+    uint64_t sentCount = 0;
+    uint64_t ackedCount = 0;
+    int ret = 0;
+    while(ret == 0 && ackedCount < pageCount) {
+        uint32_t inFlight = (uint32_t)(sentCount - ackedCount);
+        if(sentCount < pageCount && inFlight <= refillThreshold) {
+            uint32_t commandCount = 0;
+            size_t length = rsp_page_touch_fill(&generator, commands, window - inFlight, &commandCount);
+            IdeviceFfiError* err = debug_proxy_send_raw(debugProxy, (const uint8_t*)commands, length);
+            if(err) {
+                idevice_error_free(err);
+                ret = -1;
+            }
+            sentCount += commandCount;
+            continue;
+        }
+        uint32_t repliesToDrain = sentCount < pageCount ? inFlight - refillThreshold : inFlight;
+        IdeviceFfiError* err = 0;
+        ret = rsp_drain_replies(debugProxy, &drain, repliesToDrain, &err);
+        idevice_error_free(err);
+        ackedCount += repliesToDrain;
+    }
+    if(drain.firstErrorIndex >= 0) {
+        ret = -3;
+    }
+    rsp_drain_free(&drain);
+    free(commands);
+    return ret;
+}
+
+// seconds it took to touch pageCount pages
+static double bench_run(const FakeLink* link, BenchSender sender, uint64_t pageCount, RspPrepareStats* stats) {
+    FakeMapping mapping = { .start = BENCH_REGION_START, .size = pageCount * BENCH_PAGE_SIZE, .readable = true, .writable = true };
+    FakeDebugserverConfig config = { .link = *link, .mappings = &mapping, .mappingCount = 1 };
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+
+    uint64_t start = fake_now_micros();
+    int ret = 0;
+    if(sender == BENCH_WINDOW) {
+        RspMemoryRegion region = { .start = BENCH_REGION_START, .size = pageCount * BENCH_PAGE_SIZE };
+        IdeviceFfiError* err = 0;
+        ret = rsp_prepare_memory_regions(debugProxy, &region, 1, BENCH_PAGE_SIZE, stats, &err);
+        idevice_error_free(err);
+        CHECK(region.failedPage == -1);
+    } else if(sender == BENCH_FIXED_WINDOW) {
+        ret = bench_send_window(debugProxy, pageCount, BENCH_BATCH_SIZE);
+    } else {
+        ret = bench_send_batches(debugProxy, pageCount, sender == BENCH_LOCK_STEP ? 1 : BENCH_BATCH_SIZE);
+    }
+    double seconds = (double)(fake_now_micros() - start) / 1000000.0;
+    CHECK(ret == 0);
+
+    debug_proxy_free(debugProxy);
+    FakeDebugserverStats serverStats;
+    fake_debugserver_stop(server, &serverStats, 0, 0);
+    fake_debugserver_free(server);
+    CHECK_EQ_U64(serverStats.memoryWriteCount, pageCount);
+    return seconds;
+}
+
+int main(int argc, char** argv) {
+    bool quick = test_is_quick(argc, argv);
+    uint64_t pageCount = quick ? 2000 : 40000;
+    printf("%-14s %-15s %8s %9s %10s %s\n", "link", "sender", "pages", "seconds", "pages/s", "window / min rtt");
+    for(size_t i = 0; i < fakeLinkProfileCount; ++i) {
+        const struct FakeLinkProfile* profile = &fakeLinkProfiles[i];
+        if(quick && profile->link.roundTripMicros > 5000) {
+            continue;
+        }
+        for(int sender = BENCH_LOCK_STEP; sender <= BENCH_WINDOW; ++sender) {
+            // one round trip per page, keep it to about a second
+            uint64_t pages = pageCount;
+            if(sender == BENCH_LOCK_STEP && profile->link.roundTripMicros) {
+                uint64_t affordable = 1000000 / profile->link.roundTripMicros;
+                pages = affordable < 20 ? 20 : affordable < pageCount ? affordable : pageCount;
+            }
+            RspPrepareStats stats = {0};
+            double seconds = bench_run(&profile->link, (BenchSender)sender, pages, &stats);
+            printf("%-14s %-15s %8llu %9.3f %10.0f", profile->name, benchSenderNames[sender], (unsigned long long)pages, seconds, (double)pages / seconds);
+            if(sender == BENCH_WINDOW) {
+                printf(" %u / %llu us", stats.window, (unsigned long long)stats.minRttMicros);
+            }
+            printf("\n");
+        }
+    }
+    return test_finish("bench_prepare");
+}
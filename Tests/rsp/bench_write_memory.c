@@ -0,0 +1,81 @@
+//
+//  bench_write_memory.c
+//  StikJIT host tests
+//
+//  Time to write a block of memory over shaped links with rsp_write_memory, as hex M packets
+//  and as binary X packets, both sized from debugserver's PacketSize.
+//  Run without arguments for the full table, ctest runs it with --quick.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "debug_session.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define BENCH_BASE 0x100000000ULL
+// what debugserver advertises on iOS
+#define BENCH_PACKET_SIZE 0x20000
+
+// seconds it took to write length bytes, the data is checked against what debugserver stored
+static double bench_run(const FakeLink* link, bool binary, const uint8_t* data, size_t length, RspWriteResult* result) {
+    uint8_t* memory = calloc(1, length);
+    FakeMapping mapping = { .start = BENCH_BASE, .size = length, .bytes = memory, .readable = true, .writable = true };
+    FakeDebugserverConfig config = { .link = *link, .packetSize = BENCH_PACKET_SIZE, .binaryWrite = true, .mappings = &mapping, .mappingCount = 1 };
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    DebugSession* session = debug_session_open(debugProxy);
+    IdeviceFfiError* err = debug_session_negotiate(session);
+    idevice_error_free(err);
+    err = 0;
+    // the X probe is a one time cost per session, leave it out of the timing
+    session->binaryWrite = binary ? 1 : 0;
+
+    uint64_t begin = fake_now_micros();
+    int ret = rsp_write_memory(debugProxy, BENCH_BASE, data, length, binary, result, &err);
+    double seconds = (double)(fake_now_micros() - begin) / 1000000.0;
+    idevice_error_free(err);
+    CHECK(ret == 0);
+    CHECK(result->binary == binary);
+    CHECK(memcmp(memory, data, length) == 0);
+
+    debug_session_close(debugProxy);
+    debug_proxy_free(debugProxy);
+    fake_debugserver_stop(server, 0, 0, 0);
+    fake_debugserver_free(server);
+    free(memory);
+    return seconds;
+}
+
+int main(int argc, char** argv) {
+    bool quick = test_is_quick(argc, argv);
+    size_t length = quick ? 0x40000 : 0x400000;
+    uint8_t* data = malloc(length);
+    uint32_t seed = 1;
+    for(size_t i = 0; i < length; ++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    printf("%-14s %-7s %8s %9s %9s %12s %8s\n", "link", "packets", "count", "seconds", "MB/s", "bytes sent", "speedup");
+    for(size_t i = 0; i < fakeLinkProfileCount; ++i) {
+        const struct FakeLinkProfile* profile = &fakeLinkProfiles[i];
+        if(quick && profile->link.roundTripMicros > 5000) {
+            continue;
+        }
+        double hexSeconds = 0;
+        for(int binary = 0; binary <= 1; ++binary) {
+            RspWriteResult result;
+            double seconds = bench_run(&profile->link, binary, data, length, &result);
+            printf("%-14s %-7s %8llu %9.3f %9.2f %12llu", profile->name, binary ? "X" : "M", (unsigned long long)result.packetCount, seconds, (double)length / seconds / 1000000.0, (unsigned long long)result.bytesSent);
+            if(binary) {
+                printf(" %7.2fx", hexSeconds / seconds);
+            } else {
+                hexSeconds = seconds;
+            }
+            printf("\n");
+        }
+    }
+    free(data);
+    return test_finish("bench_write_memory");
+}
@@ -0,0 +1,130 @@
+//
+//  fake_debug_proxy.c
+//  StikJIT host tests
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fake_debug_proxy.h"
+#include "rsp.h"
+
+// the real reads never return more than this at once either
+#define FAKE_DEBUG_PROXY_MAX_READ (1 << 20)
+
+struct DebugProxyHandle {
+    int fd;
+};
+
+DebugProxyHandle* fake_debug_proxy_new(int fd) {
+    DebugProxyHandle* handle = calloc(1, sizeof(DebugProxyHandle));
+    handle->fd = fd;
+    return handle;
+}
+
+void debug_proxy_free(DebugProxyHandle* handle) {
+    if(!handle) {
+        return;
+    }
+    close(handle->fd);
+    free(handle);
+}
+
+static IdeviceFfiError* fake_error(const char* message) {
+    IdeviceFfiError* err = malloc(sizeof(IdeviceFfiError));
+    err->code = -1;
+    err->message = strdup(message);
+    return err;
+}
+
+void idevice_error_free(IdeviceFfiError* err) {
+    if(!err) {
+        return;
+    }
+    free((char*)err->message);
+    free(err);
+}
+
+void idevice_string_free(char* string) {
+    free(string);
+}
+
+IdeviceFfiError* debug_proxy_send_raw(DebugProxyHandle* handle, const uint8_t* data, uintptr_t len) {
+    while(len > 0) {
+        ssize_t written = write(handle->fd, data, len);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return fake_error(strerror(errno));
+        }
+        data += written;
+        len -= (uintptr_t)written;
+    }
+    return 0;
+}
+
+IdeviceFfiError* debug_proxy_read(DebugProxyHandle* handle, uintptr_t len, char** response) {
+    size_t wanted = len < FAKE_DEBUG_PROXY_MAX_READ ? len : FAKE_DEBUG_PROXY_MAX_READ;
+    char* buffer = malloc(wanted + 1);
+    ssize_t received;
+    do {
+        received = read(handle->fd, buffer, wanted);
+    } while(received < 0 && errno == EINTR);
+    if(received < 0) {
+        free(buffer);
+        *response = 0;
+        return fake_error(strerror(errno));
+    }
+    if(received == 0) {
+        // closed
+        free(buffer);
+        *response = 0;
+        return 0;
+    }
+    buffer[received] = 0;
+    *response = buffer;
+    return 0;
+}
+
+DebugserverCommandHandle* debugserver_command_new(const char* name, const char* const* argv, uintptr_t argv_count) {
+    // the helpers under test never pass arguments
+    (void)argv;
+    (void)argv_count;
+    DebugserverCommandHandle* command = calloc(1, sizeof(DebugserverCommandHandle));
+    command->name = strdup(name);
+    return command;
+}
+
+void debugserver_command_free(DebugserverCommandHandle* command) {
+    if(!command) {
+        return;
+    }
+    free(command->name);
+    free(command);
+}
+
+IdeviceFfiError* debug_proxy_send_command(DebugProxyHandle* handle, DebugserverCommandHandle* command, char** response) {
+    size_t length = strlen(command->name);
+    char* packet = malloc(length + 4);
+    size_t packetLength = rsp_build_packet(packet, command->name, length);
+    IdeviceFfiError* err = debug_proxy_send_raw(handle, (const uint8_t*)packet, packetLength);
+    free(packet);
+    *response = 0;
+    if(err) {
+        return err;
+    }
+    char* reply = 0;
+    size_t replyLength = 0;
+    int ret = rsp_read_reply(handle, &reply, &replyLength, &err);
+    if(ret) {
+        return err ? err : fake_error("closed");
+    }
+    // the payload between '$' and '#'
+    reply[replyLength - 3] = 0;
+    *response = strdup(reply + 1);
+    free(reply);
+    return 0;
+}
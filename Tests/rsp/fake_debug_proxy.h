@@ -0,0 +1,16 @@
+//
+//  fake_debug_proxy.h
+//  StikJIT host tests
+//
+//  The DebugProxyHandle FFI functions the protocol helpers use, over a plain socket.
+//  Like the real ones, reads hand data back as NUL-terminated C strings.
+//
+
+#ifndef FAKE_DEBUG_PROXY_H
+#define FAKE_DEBUG_PROXY_H
+#include "idevice.h"
+
+// takes ownership of fd, debug_proxy_free closes it
+DebugProxyHandle* fake_debug_proxy_new(int fd);
+
+#endif /* FAKE_DEBUG_PROXY_H */
@@ -0,0 +1,586 @@
+//
+//  fake_debugserver.c
+//  StikJIT host tests
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fake_debugserver.h"
+#include "fake_debug_proxy.h"
+
+const struct FakeLinkProfile fakeLinkProfiles[] = {
+    { "loopback", { 0, 0, 0 } },
+    { "usb 1ms", { 1000, 30000000, 4 } },
+    { "service bound", { 1000, 0, 25 } },
+    { "wifi 5ms", { 5000, 5000000, 4 } },
+    { "wifi 20ms", { 20000, 2000000, 4 } },
+    { "vpn 50ms", { 50000, 1000000, 4 } },
+};
+const size_t fakeLinkProfileCount = sizeof(fakeLinkProfiles) / sizeof(fakeLinkProfiles[0]);
+
+typedef struct FakeReply {
+    double due;
+    char* data;
+    size_t length;
+} FakeReply;
+
+struct FakeDebugserver {
+    FakeDebugserverConfig config;
+    int fd;
+    pthread_t thread;
+    FakeDebugserverStats stats;
+    FakeWrite* writes;
+    size_t writeCount;
+    size_t writeCapacity;
+    char* input;
+    size_t inputLength;
+    size_t inputCapacity;
+    // replies waiting for their simulated delivery time, in order
+    FakeReply* replies;
+    size_t replyHead;
+    size_t replyCount;
+    size_t replyCapacity;
+    char* output;
+    size_t outputLength;
+    size_t outputSent;
+    size_t outputCapacity;
+    // when each direction of the link and debugserver itself are free again
+    double uplinkFree;
+    double serverFree;
+    double downlinkFree;
+    uint64_t nextEndlessRegion;
+    // the scripted process: its registers now, the next stop a resume reaches, and a snapshot
+    // of the registers at every resume
+    uint64_t registers[FAKE_REGISTER_COUNT];
+    size_t nextStop;
+    uint64_t* resumeRegisters;
+    size_t resumeRegistersCapacity;
+    // O packet going out ahead of the reply being handled
+    const char* consoleOutput;
+};
+
+static const char fakeHexDigits[] = "0123456789abcdef";
+
+uint64_t fake_now_micros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void* fake_grow(void* buffer, size_t* capacity, size_t needed, size_t elementSize) {
+    if(needed <= *capacity) {
+        return buffer;
+    }
+    while(*capacity < needed) {
+        *capacity = *capacity ? *capacity * 2 : 4096;
+    }
+    return realloc(buffer, *capacity * elementSize);
+}
+
+static int fake_hex_value(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// mapping containing addr with the wanted permission, NULL if there is none
+static FakeMapping* fake_find_mapping(FakeDebugserver* server, uint64_t addr, bool write) {
+    for(size_t i = 0; i < server->config.mappingCount; ++i) {
+        FakeMapping* mapping = &server->config.mappings[i];
+        if(addr - mapping->start < mapping->size) {
+            return (write ? mapping->writable : mapping->readable) ? mapping : 0;
+        }
+    }
+    return 0;
+}
+
+// length of the accessible prefix of [addr, addr + length), copying into or out of data when it's given
+static uint64_t fake_access(FakeDebugserver* server, uint64_t addr, uint64_t length, bool write, uint8_t* data) {
+    uint64_t done = 0;
+    while(done < length) {
+        FakeMapping* mapping = fake_find_mapping(server, addr + done, write);
+        if(!mapping) {
+            break;
+        }
+        uint64_t offset = addr + done - mapping->start;
+        uint64_t chunk = mapping->size - offset < length - done ? mapping->size - offset : length - done;
+        if(data && mapping->bytes) {
+            if(write) {
+                memcpy(mapping->bytes + offset, data + done, (size_t)chunk);
+            } else {
+                memcpy(data + done, mapping->bytes + offset, (size_t)chunk);
+            }
+        } else if(data && !write) {
+            memset(data + done, 0, (size_t)chunk);
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+static void fake_record_write(FakeDebugserver* server, uint64_t addr, uint64_t length, bool binary) {
+    ++server->stats.memoryWriteCount;
+    if(!server->config.recordWrites) {
+        return;
+    }
+    server->writes = fake_grow(server->writes, &server->writeCapacity, server->writeCount + 1, sizeof(FakeWrite));
+    server->writes[server->writeCount++] = (FakeWrite){ addr, length, binary };
+}
+
+static char* fake_write_memory(FakeDebugserver* server, uint64_t addr, uint8_t* data, uint64_t length, bool binary) {
+    fake_record_write(server, addr, length, binary);
+    if(fake_access(server, addr, length, true, 0) != length) {
+        return strdup("E03");
+    }
+    fake_access(server, addr, length, true, data);
+    return strdup("OK");
+}
+
+// "M<addr>,<length>:<hex>"
+static char* fake_handle_hex_write(FakeDebugserver* server, const char* payload, size_t length) {
+    char* end = 0;
+    uint64_t addr = strtoull(payload + 1, &end, 16);
+    uint64_t dataLength = strtoull(end + 1, &end, 16);
+    const char* hex = end + 1;
+    if(*end != ':' || (size_t)(payload + length - hex) != 2 * dataLength) {
+        return strdup("E01");
+    }
+    uint8_t* data = malloc(dataLength ? dataLength : 1);
+    for(uint64_t i = 0; i < dataLength; ++i) {
+        int high = fake_hex_value(hex[2 * i]);
+        int low = fake_hex_value(hex[2 * i + 1]);
+        if(high < 0 || low < 0) {
+            free(data);
+            return strdup("E01");
+        }
+        data[i] = (uint8_t)(high << 4 | low);
+    }
+    char* reply = fake_write_memory(server, addr, data, dataLength, false);
+    free(data);
+    return reply;
+}
+
+// "X<addr>,<length>:<escaped binary>"
+static char* fake_handle_binary_write(FakeDebugserver* server, const char* payload, size_t length) {
+    if(!server->config.binaryWrite) {
+        return strdup("");
+    }
+    char* end = 0;
+    uint64_t addr = strtoull(payload + 1, &end, 16);
+    uint64_t dataLength = strtoull(end + 1, &end, 16);
+    if(*end != ':') {
+        return strdup("E01");
+    }
+    const char* cur = end + 1;
+    const char* payloadEnd = payload + length;
+    uint8_t* data = malloc(payloadEnd - cur + 1);
+    uint64_t decoded = 0;
+    while(cur < payloadEnd) {
+        if(*cur == '}' && cur + 1 < payloadEnd) {
+            data[decoded++] = (uint8_t)cur[1] ^ 0x20;
+            cur += 2;
+        } else {
+            data[decoded++] = (uint8_t)*cur++;
+        }
+    }
+    if(decoded != dataLength) {
+        ++server->stats.badLengthCount;
+        free(data);
+        return strdup("E01");
+    }
+    char* reply = fake_write_memory(server, addr, data, dataLength, true);
+    free(data);
+    return reply;
+}
+
+// "m<addr>,<length>": the readable prefix, like debugserver does
+static char* fake_handle_read(FakeDebugserver* server, const char* payload) {
+    ++server->stats.memoryReadCount;
+    char* end = 0;
+    uint64_t addr = strtoull(payload + 1, &end, 16);
+    uint64_t length = strtoull(end + 1, NULL, 16);
+    uint64_t readable = fake_access(server, addr, length, false, 0);
+    if(readable == 0) {
+        return strdup("E08");
+    }
+    uint8_t* data = malloc((size_t)readable);
+    fake_access(server, addr, readable, false, data);
+    char* reply = malloc(2 * readable + 1);
+    for(uint64_t i = 0; i < readable; ++i) {
+        reply[2 * i] = fakeHexDigits[data[i] >> 4];
+        reply[2 * i + 1] = fakeHexDigits[data[i] & 0xf];
+    }
+    reply[2 * readable] = 0;
+    free(data);
+    return reply;
+}
+
+static char* fake_handle_region_info(FakeDebugserver* server, const char* payload) {
+    ++server->stats.regionInfoCount;
+    if(server->config.regionInfoFailAt && server->stats.regionInfoCount >= server->config.regionInfoFailAt) {
+        return strdup("E01");
+    }
+    uint64_t addr = strtoull(payload + strlen("qMemoryRegionInfo:"), NULL, 16);
+    char* reply = malloc(128);
+    if(server->config.endlessRegions) {
+        uint64_t start = server->nextEndlessRegion;
+        server->nextEndlessRegion += 0x1000;
+        snprintf(reply, 128, "start:%llx;size:1000;permissions:rw;", (unsigned long long)start);
+        return reply;
+    }
+    for(size_t i = 0; i < server->config.mappingCount; ++i) {
+        const FakeMapping* mapping = &server->config.mappings[i];
+        if(addr - mapping->start < mapping->size) {
+            snprintf(reply, 128, "start:%llx;size:%llx;permissions:%s%s;", (unsigned long long)mapping->start, (unsigned long long)mapping->size, mapping->readable ? "r" : "", mapping->writable ? "w" : "");
+            return reply;
+        }
+        if(mapping->start > addr) {
+            // the gap up to the next mapping
+            snprintf(reply, 128, "start:%llx;size:%llx;", (unsigned long long)addr, (unsigned long long)(mapping->start - addr));
+            return reply;
+        }
+    }
+    // the gap up to the top of the address space, which debugserver ends at ~0 instead of wrapping
+    snprintf(reply, 128, "start:%llx;size:%llx;", (unsigned long long)addr, (unsigned long long)(~0ULL - addr));
+    return reply;
+}
+
+// "c": snapshot the registers, move to the next scripted stop and answer with its reply
+static char* fake_handle_resume(FakeDebugserver* server) {
+    size_t index = (size_t)server->stats.resumeCount++;
+    server->resumeRegisters = fake_grow(server->resumeRegisters, &server->resumeRegistersCapacity, (index + 1) * FAKE_REGISTER_COUNT, sizeof(uint64_t));
+    memcpy(server->resumeRegisters + index * FAKE_REGISTER_COUNT, server->registers, sizeof(server->registers));
+    if(server->nextStop == server->config.stopCount) {
+        return strdup("W00");
+    }
+    const FakeStop* stop = &server->config.stops[server->nextStop++];
+    memcpy(server->registers, stop->registers, sizeof(server->registers));
+    server->consoleOutput = stop->output;
+    return strdup(stop->reply);
+}
+
+// "p<n>;thread:<tid>;": the register's 8 bytes, little endian
+static char* fake_handle_register_read(FakeDebugserver* server, const char* payload) {
+    ++server->stats.registerReadCount;
+    unsigned long number = strtoul(payload + 1, NULL, 16);
+    if(number >= FAKE_REGISTER_COUNT) {
+        return strdup("E45");
+    }
+    char* reply = malloc(17);
+    for(int i = 0; i < 8; ++i) {
+        uint8_t byte = (uint8_t)(server->registers[number] >> (8 * i));
+        reply[2 * i] = fakeHexDigits[byte >> 4];
+        reply[2 * i + 1] = fakeHexDigits[byte & 0xf];
+    }
+    reply[16] = 0;
+    return reply;
+}
+
+// "P<n>=<little endian hex>;thread:<tid>;"
+static char* fake_handle_register_write(FakeDebugserver* server, const char* payload) {
+    ++server->stats.registerWriteCount;
+    char* end = 0;
+    unsigned long number = strtoul(payload + 1, &end, 16);
+    if(server->config.refuseRegisterWrites || *end != '=' || number >= FAKE_REGISTER_COUNT) {
+        return strdup("E01");
+    }
+    uint64_t value = 0;
+    for(int i = 0; i < 8; ++i) {
+        int high = fake_hex_value(end[1 + 2 * i]);
+        int low = fake_hex_value(end[2 + 2 * i]);
+        if(high < 0 || low < 0) {
+            return strdup("E01");
+        }
+        value |= (uint64_t)(high << 4 | low) << (8 * i);
+    }
+    server->registers[number] = value;
+    return strdup("OK");
+}
+
+static char* fake_handle_packet(FakeDebugserver* server, const char* payload, size_t length) {
+    if(length >= 10 && memcmp(payload, "qSupported", 10) == 0) {
+        char* reply = malloc(96);
+        if(server->config.packetSize) {
+            snprintf(reply, 96, "PacketSize=%llx;qXfer:features:read+", (unsigned long long)server->config.packetSize);
+        } else {
+            snprintf(reply, 96, "qXfer:features:read+");
+        }
+        return reply;
+    }
+    if(length == 15 && memcmp(payload, "QStartNoAckMode", 15) == 0) {
+        return strdup("OK");
+    }
+    if(length > 18 && memcmp(payload, "qMemoryRegionInfo:", 18) == 0) {
+        return fake_handle_region_info(server, payload);
+    }
+    if(length > 2 && memcmp(payload, "_M", 2) == 0 && server->config.allocateAddress) {
+        ++server->stats.allocateCount;
+        char* reply = malloc(24);
+        snprintf(reply, 24, "%llx", (unsigned long long)server->config.allocateAddress);
+        return reply;
+    }
+    switch(length ? payload[0] : 0) {
+        case 'c':
+            return fake_handle_resume(server);
+        case 'p':
+            return fake_handle_register_read(server, payload);
+        case 'P':
+            return fake_handle_register_write(server, payload);
+        case 'D':
+            ++server->stats.detachCount;
+            return strdup("OK");
+        case 'M':
+            return fake_handle_hex_write(server, payload, length);
+        case 'X':
+            return fake_handle_binary_write(server, payload, length);
+        case 'm':
+            return fake_handle_read(server, payload);
+    }
+    // unsupported
+    return strdup("");
+}
+
+// "$<payload>#xx", run-length encoded if configured: c followed by "*n" stands for n - 29 more copies of c
+static char* fake_frame(FakeDebugserver* server, const char* payload, size_t* lengthOut) {
+    size_t length = strlen(payload);
+    char* packet = malloc(length + 4);
+    size_t cur = 1;
+    packet[0] = '$';
+    for(size_t i = 0; i < length;) {
+        char c = payload[i];
+        size_t extra = 0;
+        if(server->config.runLengthEncode) {
+            while(i + 1 + extra < length && payload[i + 1 + extra] == c && extra < 97) {
+                ++extra;
+            }
+        }
+        packet[cur++] = c;
+        if(extra >= 3) {
+            // '#' and '$' can't be a count
+            if(extra == 6 || extra == 7) {
+                extra = 5;
+            }
+            packet[cur++] = '*';
+            packet[cur++] = (char)(extra + 29);
+            i += 1 + extra;
+        } else {
+            ++i;
+        }
+    }
+    uint8_t sum = 0;
+    for(size_t i = 1; i < cur; ++i) {
+        sum += (uint8_t)packet[i];
+    }
+    packet[cur++] = '#';
+    packet[cur++] = fakeHexDigits[sum >> 4];
+    packet[cur++] = fakeHexDigits[sum & 0xf];
+    *lengthOut = cur;
+    return packet;
+}
+
+// time a transfer of bytes started at start is done, with the link busy until then
+static double fake_transfer(double* linkFree, double start, size_t bytes, uint64_t bytesPerSecond) {
+    double begin = start > *linkFree ? start : *linkFree;
+    *linkFree = begin + (bytesPerSecond ? (double)bytes * 1000000.0 / (double)bytesPerSecond : 0);
+    return *linkFree;
+}
+
+static void fake_parse_input(FakeDebugserver* server, double now) {
+    const FakeLink* link = &server->config.link;
+    size_t cur = 0;
+    while(cur < server->inputLength) {
+        if(server->input[cur] != '$') {
+            // acks and interrupts
+            ++cur;
+            continue;
+        }
+        char* hash = memchr(server->input + cur, '#', server->inputLength - cur);
+        if(!hash || server->input + server->inputLength - hash < 3) {
+            break;
+        }
+        const char* payload = server->input + cur + 1;
+        size_t payloadLength = hash - payload;
+        size_t packetLength = payloadLength + 4;
+        uint8_t sum = 0;
+        for(size_t i = 0; i < payloadLength; ++i) {
+            sum += (uint8_t)payload[i];
+        }
+        if(fake_hex_value(hash[1]) != sum >> 4 || fake_hex_value(hash[2]) != (sum & 0xf)) {
+            ++server->stats.badChecksumCount;
+        }
+        ++server->stats.packetCount;
+        if(packetLength > server->stats.maxPacketLength) {
+            server->stats.maxPacketLength = packetLength;
+        }
+
+        char* reply = fake_handle_packet(server, payload, payloadLength);
+        size_t replyLength = 0;
+        char* framed = fake_frame(server, reply, &replyLength);
+        free(reply);
+        if(server->consoleOutput) {
+            // "O<hex>" in front of the reply, in the same delivery
+            size_t outputLength = strlen(server->consoleOutput);
+            char* output = malloc(2 * outputLength + 2);
+            output[0] = 'O';
+            for(size_t i = 0; i < outputLength; ++i) {
+                output[1 + 2 * i] = fakeHexDigits[(uint8_t)server->consoleOutput[i] >> 4];
+                output[2 + 2 * i] = fakeHexDigits[server->consoleOutput[i] & 0xf];
+            }
+            output[1 + 2 * outputLength] = 0;
+            size_t framedOutputLength = 0;
+            char* framedOutput = fake_frame(server, output, &framedOutputLength);
+            free(output);
+            framedOutput = realloc(framedOutput, framedOutputLength + replyLength);
+            memcpy(framedOutput + framedOutputLength, framed, replyLength);
+            free(framed);
+            framed = framedOutput;
+            replyLength += framedOutputLength;
+            server->consoleOutput = 0;
+        }
+        double arrival = fake_transfer(&server->uplinkFree, now, packetLength, link->bytesPerSecond) + link->roundTripMicros / 2.0;
+        double done = (arrival > server->serverFree ? arrival : server->serverFree) + link->serviceMicros;
+        server->serverFree = done;
+        double due = fake_transfer(&server->downlinkFree, done, replyLength, link->bytesPerSecond) + link->roundTripMicros / 2.0;
+        server->replies = fake_grow(server->replies, &server->replyCapacity, server->replyCount + 1, sizeof(FakeReply));
+        server->replies[server->replyCount++] = (FakeReply){ due, framed, replyLength };
+        cur = hash + 3 - server->input;
+    }
+    server->inputLength -= cur;
+    memmove(server->input, server->input + cur, server->inputLength);
+}
+
+static void* fake_debugserver_run(void* userData) {
+    FakeDebugserver* server = userData;
+    while(true) {
+        double now = (double)fake_now_micros();
+        while(server->replyHead < server->replyCount && server->replies[server->replyHead].due <= now) {
+            FakeReply* reply = &server->replies[server->replyHead++];
+            server->output = fake_grow(server->output, &server->outputCapacity, server->outputLength + reply->length, 1);
+            memcpy(server->output + server->outputLength, reply->data, reply->length);
+            server->outputLength += reply->length;
+            free(reply->data);
+        }
+        if(server->replyHead == server->replyCount) {
+            server->replyHead = server->replyCount = 0;
+        }
+
+        fd_set readSet;
+        fd_set writeSet;
+        FD_ZERO(&readSet);
+        FD_ZERO(&writeSet);
+        FD_SET(server->fd, &readSet);
+        if(server->outputSent < server->outputLength) {
+            FD_SET(server->fd, &writeSet);
+        }
+        struct timeval timeout;
+        struct timeval* timeoutPtr = 0;
+        if(server->replyHead < server->replyCount) {
+            double wait = server->replies[server->replyHead].due - now;
+            uint64_t waitMicros = wait > 0 ? (uint64_t)wait : 0;
+            timeout.tv_sec = (time_t)(waitMicros / 1000000);
+            timeout.tv_usec = (suseconds_t)(waitMicros % 1000000);
+            timeoutPtr = &timeout;
+        }
+        if(select(server->fd + 1, &readSet, &writeSet, 0, timeoutPtr) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if(FD_ISSET(server->fd, &readSet)) {
+            server->input = fake_grow(server->input, &server->inputCapacity, server->inputLength + 65536, 1);
+            ssize_t received = read(server->fd, server->input + server->inputLength, 65536);
+            if(received == 0 || (received < 0 && errno != EAGAIN && errno != EINTR)) {
+                // the proxy was freed
+                break;
+            }
+            if(received > 0) {
+                server->inputLength += (size_t)received;
+                server->stats.bytesReceived += (uint64_t)received;
+                fake_parse_input(server, (double)fake_now_micros());
+            }
+        }
+        if(FD_ISSET(server->fd, &writeSet)) {
+            ssize_t written = write(server->fd, server->output + server->outputSent, server->outputLength - server->outputSent);
+            if(written > 0) {
+                server->outputSent += (size_t)written;
+                server->stats.bytesSent += (uint64_t)written;
+                if(server->outputSent == server->outputLength) {
+                    server->outputSent = server->outputLength = 0;
+                }
+            } else if(written < 0 && errno != EAGAIN && errno != EINTR) {
+                break;
+            }
+        }
+    }
+    for(size_t i = server->replyHead; i < server->replyCount; ++i) {
+        free(server->replies[i].data);
+    }
+    server->replyHead = server->replyCount = 0;
+    return 0;
+}
+
+FakeDebugserver* fake_debugserver_start(const FakeDebugserverConfig* config, DebugProxyHandle** debugProxyOut) {
+    // a proxy freed mid reply must not kill the test
+    signal(SIGPIPE, SIG_IGN);
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        return 0;
+    }
+    int bufferSize = 1 << 20;
+    for(int i = 0; i < 2; ++i) {
+        setsockopt(fds[i], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+        setsockopt(fds[i], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    }
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    FakeDebugserver* server = calloc(1, sizeof(FakeDebugserver));
+    server->config = *config;
+    server->fd = fds[1];
+    *debugProxyOut = fake_debug_proxy_new(fds[0]);
+    pthread_create(&server->thread, 0, fake_debugserver_run, server);
+    return server;
+}
+
+void fake_debugserver_stop(FakeDebugserver* server, FakeDebugserverStats* statsOut, const FakeWrite** writesOut, size_t* writeCountOut) {
+    pthread_join(server->thread, 0);
+    close(server->fd);
+    server->fd = -1;
+    if(statsOut) {
+        *statsOut = server->stats;
+    }
+    if(writesOut) {
+        *writesOut = server->writes;
+        *writeCountOut = server->writeCount;
+    }
+}
+
+const uint64_t* fake_debugserver_resume_registers(const FakeDebugserver* server, size_t index) {
+    if(index >= server->stats.resumeCount) {
+        return 0;
+    }
+    return server->resumeRegisters + index * FAKE_REGISTER_COUNT;
+}
+
+void fake_debugserver_free(FakeDebugserver* server) {
+    free(server->resumeRegisters);
+    free(server->writes);
+    free(server->input);
+    free(server->replies);
+    free(server->output);
+    free(server);
+}
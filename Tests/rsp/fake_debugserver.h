@@ -0,0 +1,117 @@
+//
+//  fake_debugserver.h
+//  StikJIT host tests
+//
+//  In-process stand-in for debugserver behind a DebugProxyHandle. It serves the other end of a
+//  socketpair on its own thread, keeps a small memory model and can shape the link with a round
+//  trip, a bandwidth limit and a per-packet service time.
+//
+
+#ifndef FAKE_DEBUGSERVER_H
+#define FAKE_DEBUGSERVER_H
+#include <pthread.h>
+#include "idevice.h"
+
+// x0-x30, sp and pc
+#define FAKE_REGISTER_COUNT 33
+
+typedef struct FakeLink {
+    // added to every packet, half on the way in and half on the way out
+    uint64_t roundTripMicros;
+    // bytes per second in each direction, 0 for unlimited
+    uint64_t bytesPerSecond;
+    // time debugserver spends on each packet, packets are served one at a time
+    uint64_t serviceMicros;
+} FakeLink;
+
+typedef struct FakeMapping {
+    uint64_t start;
+    uint64_t size;
+    // contents, NULL to accept writes without keeping them (reads then return zeros)
+    uint8_t* bytes;
+    bool readable;
+    bool writable;
+} FakeMapping;
+
+// where a resumed process stops next
+typedef struct FakeStop {
+    // console output sent as an O packet ahead of the stop reply, NULL for none
+    const char* output;
+    // stop reply payload, e.g. "T05thread:1f03;20:0040000001000000;"
+    const char* reply;
+    // what p reads while stopped here, by register number (pc is 32)
+    uint64_t registers[FAKE_REGISTER_COUNT];
+} FakeStop;
+
+typedef struct FakeDebugserverConfig {
+    FakeLink link;
+    // advertised in the qSupported reply, 0 leaves PacketSize out
+    uint64_t packetSize;
+    // whether X packets are understood, otherwise they get an empty reply
+    bool binaryWrite;
+    // run-length encode replies the way debugserver does
+    bool runLengthEncode;
+    // sorted, non-overlapping
+    FakeMapping* mappings;
+    size_t mappingCount;
+    // qMemoryRegionInfo answers with one more page-sized region every time, so a walk never ends
+    bool endlessRegions;
+    // qMemoryRegionInfo query (counting from 1) from which on it is answered with an error, 0 for never
+    uint64_t regionInfoFailAt;
+    // keep the address and length of every M and X write
+    bool recordWrites;
+    // a stopped process, each c resumes it into the next of these. after the last one it exits with W00
+    const FakeStop* stops;
+    size_t stopCount;
+    // address _M allocations are placed at, 0 to leave _M unsupported
+    uint64_t allocateAddress;
+    // P writes are answered with an error
+    bool refuseRegisterWrites;
+} FakeDebugserverConfig;
+
+typedef struct FakeWrite {
+    uint64_t addr;
+    uint64_t length;
+    bool binary;
+} FakeWrite;
+
+typedef struct FakeDebugserverStats {
+    uint64_t packetCount;
+    uint64_t bytesReceived;
+    uint64_t bytesSent;
+    uint64_t badChecksumCount;
+    // X packets whose unescaped data didn't match their stated length
+    uint64_t badLengthCount;
+    // longest packet received, framing included
+    uint64_t maxPacketLength;
+    uint64_t memoryWriteCount;
+    uint64_t memoryReadCount;
+    uint64_t regionInfoCount;
+    uint64_t resumeCount;
+    uint64_t registerReadCount;
+    uint64_t registerWriteCount;
+    uint64_t allocateCount;
+    uint64_t detachCount;
+} FakeDebugserverStats;
+
+typedef struct FakeDebugserver FakeDebugserver;
+
+// starts serving, *debugProxyOut talks to it until debug_proxy_free
+FakeDebugserver* fake_debugserver_start(const FakeDebugserverConfig* config, DebugProxyHandle** debugProxyOut);
+// waits for the proxy to be freed, then returns what the server saw. writes stay valid until fake_debugserver_free
+void fake_debugserver_stop(FakeDebugserver* server, FakeDebugserverStats* statsOut, const FakeWrite** writesOut, size_t* writeCountOut);
+void fake_debugserver_free(FakeDebugserver* server);
+// registers the process had when it was resumed for the index-th time (from 0), NULL if it wasn't.
+// valid after fake_debugserver_stop until fake_debugserver_free
+const uint64_t* fake_debugserver_resume_registers(const FakeDebugserver* server, size_t index);
+
+// round trip, bandwidth and service time of a few typical links
+extern const struct FakeLinkProfile {
+    const char* name;
+    FakeLink link;
+} fakeLinkProfiles[];
+extern const size_t fakeLinkProfileCount;
+
+uint64_t fake_now_micros(void);
+
+#endif /* FAKE_DEBUGSERVER_H */
@@ -0,0 +1,96 @@
+//
+//  hex_reference.h
+//  StikJIT host tests
+//
+//  Byte-at-a-time versions of the rsp.c hex kernels for the tests and benchmarks to compare
+//  against, and the name of the vector kernel rsp.c was built with.
+//
+
+#ifndef HEX_REFERENCE_H
+#define HEX_REFERENCE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define HEX_KERNEL_NAME "neon"
+#elif defined(__AVX2__)
+#define HEX_KERNEL_NAME "avx2"
+#elif defined(__SSSE3__)
+#define HEX_KERNEL_NAME "ssse3"
+#else
+#define HEX_KERNEL_NAME "scalar"
+#endif
+
+// exit code ctest reports as skipped
+#define HEX_SKIP_EXIT_CODE 77
+
+// true if this CPU can run the kernel the variant was built with
+static inline bool hex_kernel_supported(void) {
+#if defined(__x86_64__) && defined(__AVX2__) && !defined(__ARM_NEON)
+    return __builtin_cpu_supports("avx2");
+#elif defined(__x86_64__) && defined(__SSSE3__) && !defined(__ARM_NEON)
+    return __builtin_cpu_supports("ssse3");
+#else
+    return true;
+#endif
+}
+
+static const char hexReferenceDigits[] = "0123456789abcdef";
+
+static inline uint8_t hex_reference_encode(char* out, const uint8_t* data, size_t length) {
+    uint8_t sum = 0;
+    for(size_t i = 0; i < length; ++i) {
+        out[2 * i] = hexReferenceDigits[data[i] >> 4];
+        out[2 * i + 1] = hexReferenceDigits[data[i] & 0xf];
+        sum += (uint8_t)out[2 * i] + (uint8_t)out[2 * i + 1];
+    }
+    return sum;
+}
+
+static inline uint8_t hex_reference_checksum(const char* data, size_t length) {
+    uint8_t sum = 0;
+    for(size_t i = 0; i < length; ++i) {
+        sum += (uint8_t)data[i];
+    }
+    return sum;
+}
+
+static inline int hex_reference_value(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static inline bool hex_reference_decode(uint8_t* out, const char* hex, size_t length) {
+    for(size_t i = 0; i + 1 < length; i += 2) {
+        int high = hex_reference_value(hex[i]);
+        int low = hex_reference_value(hex[i + 1]);
+        if(high < 0 || low < 0) {
+            return false;
+        }
+        out[i / 2] = (uint8_t)(high << 4 | low);
+    }
+    return true;
+}
+
+// xorshift64, deterministic so a failure reproduces
+static inline uint64_t hex_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static inline void hex_random_fill(uint8_t* out, size_t length, uint64_t* state) {
+    for(size_t i = 0; i < length; ++i) {
+        out[i] = (uint8_t)hex_random(state);
+    }
+}
+
+#endif /* HEX_REFERENCE_H */
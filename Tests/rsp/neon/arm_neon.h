@@ -0,0 +1,102 @@
+//
+//  arm_neon.h
+//  StikJIT host tests
+//
+//  Portable stand-in for the few NEON intrinsics rsp.c uses, lane by lane, so the NEON
+//  kernels can be checked on hosts without an arm64 compiler. Only put on the include path
+//  of the emulated test variant; arm64 hosts build against the real header.
+//
+
+#ifndef STIKJIT_TEST_ARM_NEON_H
+#define STIKJIT_TEST_ARM_NEON_H
+#include <stdint.h>
+
+typedef struct { uint8_t lane[16]; } uint8x16_t;
+typedef struct { uint8x16_t val[2]; } uint8x16x2_t;
+
+static inline uint8x16_t vld1q_u8(const uint8_t* p) {
+    uint8x16_t r;
+    for(int i = 0; i < 16; ++i) r.lane[i] = p[i];
+    return r;
+}
+
+static inline void vst1q_u8(uint8_t* p, uint8x16_t a) {
+    for(int i = 0; i < 16; ++i) p[i] = a.lane[i];
+}
+
+static inline uint8x16x2_t vld2q_u8(const uint8_t* p) {
+    uint8x16x2_t r;
+    for(int i = 0; i < 16; ++i) {
+        r.val[0].lane[i] = p[2 * i];
+        r.val[1].lane[i] = p[2 * i + 1];
+    }
+    return r;
+}
+
+static inline void vst2q_u8(uint8_t* p, uint8x16x2_t a) {
+    for(int i = 0; i < 16; ++i) {
+        p[2 * i] = a.val[0].lane[i];
+        p[2 * i + 1] = a.val[1].lane[i];
+    }
+}
+
+static inline uint8x16_t vdupq_n_u8(uint8_t value) {
+    uint8x16_t r;
+    for(int i = 0; i < 16; ++i) r.lane[i] = value;
+    return r;
+}
+
+// out of range indices select zero
+static inline uint8x16_t vqtbl1q_u8(uint8x16_t table, uint8x16_t index) {
+    uint8x16_t r;
+    for(int i = 0; i < 16; ++i) r.lane[i] = index.lane[i] < 16 ? table.lane[index.lane[i]] : 0;
+    return r;
+}
+
+#define STIKJIT_NEON_BINARY(name, expression) \
+static inline uint8x16_t name(uint8x16_t a, uint8x16_t b) { \
+    uint8x16_t r; \
+    for(int i = 0; i < 16; ++i) r.lane[i] = (uint8_t)(expression); \
+    return r; \
+}
+
+STIKJIT_NEON_BINARY(vandq_u8, a.lane[i] & b.lane[i])
+STIKJIT_NEON_BINARY(vorrq_u8, a.lane[i] | b.lane[i])
+STIKJIT_NEON_BINARY(vaddq_u8, a.lane[i] + b.lane[i])
+STIKJIT_NEON_BINARY(vsubq_u8, a.lane[i] - b.lane[i])
+STIKJIT_NEON_BINARY(vcltq_u8, a.lane[i] < b.lane[i] ? 0xff : 0)
+
+#undef STIKJIT_NEON_BINARY
+
+static inline uint8x16_t vshrq_n_u8(uint8x16_t a, int shift) {
+    uint8x16_t r;
+    for(int i = 0; i < 16; ++i) r.lane[i] = (uint8_t)(a.lane[i] >> shift);
+    return r;
+}
+
+static inline uint8x16_t vshlq_n_u8(uint8x16_t a, int shift) {
+    uint8x16_t r;
+    for(int i = 0; i < 16; ++i) r.lane[i] = (uint8_t)(a.lane[i] << shift);
+    return r;
+}
+
+// bitwise select: bits set in mask come from a, the others from b
+static inline uint8x16_t vbslq_u8(uint8x16_t mask, uint8x16_t a, uint8x16_t b) {
+    uint8x16_t r;
+    for(int i = 0; i < 16; ++i) r.lane[i] = (uint8_t)((mask.lane[i] & a.lane[i]) | (~mask.lane[i] & b.lane[i]));
+    return r;
+}
+
+static inline uint16_t vaddlvq_u8(uint8x16_t a) {
+    uint16_t sum = 0;
+    for(int i = 0; i < 16; ++i) sum += a.lane[i];
+    return sum;
+}
+
+static inline uint8_t vminvq_u8(uint8x16_t a) {
+    uint8_t min = a.lane[0];
+    for(int i = 1; i < 16; ++i) min = a.lane[i] < min ? a.lane[i] : min;
+    return min;
+}
+
+#endif /* STIKJIT_TEST_ARM_NEON_H */
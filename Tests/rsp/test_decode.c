@@ -0,0 +1,173 @@
+//
+//  test_decode.c
+//  StikJIT host tests
+//
+//  rsp_decode_payload and rsp_expanded_length on hand-written payloads: run-length encoding in
+//  text and hex replies, '}' escapes, runs that leave half a byte over, malformed counts and
+//  checksums. Then every run length the fake debugserver's encoder produces, the ones it has to
+//  split because their count would be '#' or '$' included, is read back through rsp_read_memory.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "debug_session.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define TEST_BASE 0x100000000ULL
+
+static const char testHexDigits[] = "0123456789abcdef";
+
+// decodes payload with its correct checksum, out must hold capacity bytes
+static int64_t test_decode(const char* payload, size_t length, bool hex, uint8_t* out, size_t capacity) {
+    uint8_t sum = 0;
+    for(size_t i = 0; i < length; ++i) {
+        sum += (uint8_t)payload[i];
+    }
+    char checksum[2] = { testHexDigits[sum >> 4], testHexDigits[sum & 0xf] };
+    return rsp_decode_payload(out, capacity, payload, length, checksum, hex);
+}
+
+// decodes a text payload and compares it with expected, the expanded length must bound it
+static void check_text(const char* payload, size_t length, const char* expected, size_t expectedLength) {
+    uint8_t out[256];
+    int64_t decoded = test_decode(payload, length, false, out, sizeof(out));
+    CHECK_EQ_U64(decoded, expectedLength);
+    CHECK(decoded < 0 || memcmp(out, expected, expectedLength) == 0);
+    CHECK(rsp_expanded_length(payload, length) >= expectedLength);
+}
+
+static void check_hex(const char* payload, const uint8_t* expected, size_t expectedLength) {
+    uint8_t out[256];
+    int64_t decoded = test_decode(payload, strlen(payload), true, out, sizeof(out));
+    CHECK_EQ_U64(decoded, expectedLength);
+    CHECK(decoded < 0 || memcmp(out, expected, expectedLength) == 0);
+}
+
+static void check_malformed(const char* payload, size_t length, bool hex) {
+    uint8_t out[256];
+    CHECK_EQ_U64(test_decode(payload, length, hex, out, sizeof(out)), (uint64_t)(int64_t)RSP_DECODE_MALFORMED);
+}
+
+static void test_run_length(void) {
+    // ' ' is the shortest run, 3 more copies; '~' the longest, 97
+    check_text("a* ", 3, "aaaa", 4);
+    check_text("xa*%b", 5, "xaaaaaaaaab", 11);
+    check_text("0*\"1*!", 6, "00000011111", 11);
+    char longRun[100];
+    memset(longRun, 'z', sizeof(longRun));
+    check_text("z*~zz", 5, longRun, 100);
+    // the runs debugserver splits because their count would frame the packet: 7 copies as 6 + 1
+    check_text("q*\"q", 4, "qqqqqqq", 7);
+    CHECK_EQ_U64(rsp_expanded_length("q*\"q", 4), 7);
+
+    // a repeat of an escaped character repeats the unescaped one
+    check_text("}\x03*\"", 4, "######", 6);
+
+    uint8_t zeros[3] = {0};
+    check_hex("0*\"", zeros, 3);
+    // runs in hex don't have to end on a byte boundary
+    check_hex("1*!f", (const uint8_t[]){ 0x11, 0x11, 0x1f }, 3);
+    check_hex("ab*\"c", (const uint8_t[]){ 0xab, 0xbb, 0xbb, 0xbc }, 4);
+    check_hex("a*!a*!", (const uint8_t[]){ 0xaa, 0xaa, 0xaa, 0xaa, 0xaa }, 5);
+}
+
+static void test_escapes(void) {
+    check_text("a}\x03" "b", 4, "a#b", 3);
+    check_text("}\x04}]}\x0a", 6, "$}*", 3);
+    // the checksum covers the escaped form
+    uint8_t out[16];
+    const char* payload = "}\x03";
+    char wrongChecksum[2] = { testHexDigits[('#' >> 4) & 0xf], testHexDigits['#' & 0xf] };
+    CHECK_EQ_U64(rsp_decode_payload(out, sizeof(out), payload, 2, wrongChecksum, false), (uint64_t)(int64_t)RSP_DECODE_BAD_CHECKSUM);
+    // hex replies have no escapes, and an escape needs a character after it
+    check_malformed("}\x03", 2, true);
+    check_malformed("a}", 2, false);
+}
+
+static void test_malformed(void) {
+    // half a byte left over
+    check_malformed("abc", 3, true);
+    check_malformed("a*!", 3, true);
+    check_malformed("g0", 2, true);
+    // nothing to repeat, no count, counts below ' ' or past '~'
+    check_malformed("*$", 2, false);
+    check_malformed("a*", 2, false);
+    check_malformed("a*\x1f", 3, false);
+    check_malformed("a*\x01", 3, false);
+    check_malformed("a*\x7f", 3, false);
+    // a count below ' ' doesn't make the bound wrap around
+    CHECK_EQ_U64(rsp_expanded_length("a*\x01", 3), 3);
+    CHECK_EQ_U64(rsp_expanded_length("a*\x1d" "b*\x1d", 6), 6);
+
+    uint8_t out[4];
+    CHECK_EQ_U64(test_decode("a*~", 3, false, out, sizeof(out)), (uint64_t)(int64_t)RSP_DECODE_OVERFLOW);
+    CHECK_EQ_U64(test_decode("0011223344", 10, true, out, sizeof(out)), (uint64_t)(int64_t)RSP_DECODE_OVERFLOW);
+}
+
+static void test_checksum(void) {
+    uint8_t out[16];
+    CHECK_EQ_U64(rsp_decode_payload(out, sizeof(out), "OK", 2, "9a", false), 2);
+    CHECK_EQ_U64(rsp_decode_payload(out, sizeof(out), "OK", 2, "9b", false), (uint64_t)(int64_t)RSP_DECODE_BAD_CHECKSUM);
+    CHECK_EQ_U64(rsp_decode_payload(out, sizeof(out), "OK", 2, "zz", false), (uint64_t)(int64_t)RSP_DECODE_BAD_CHECKSUM);
+    CHECK_EQ_U64(rsp_decode_payload(out, sizeof(out), "OK", 2, NULL, false), 2);
+    // the count characters are part of the sum
+    CHECK_EQ_U64(test_decode("0*\"", 3, true, out, sizeof(out)), 3);
+    CHECK_EQ_U64(rsp_decode_payload(out, sizeof(out), "0*\"", 3, "30", true), (uint64_t)(int64_t)RSP_DECODE_BAD_CHECKSUM);
+}
+
+static bool test_copy_sink(void* userData, uint64_t offset, const uint8_t* data, size_t length) {
+    memcpy((uint8_t*)userData + offset, data, length);
+    return true;
+}
+
+// memory whose hex form has a run of every length from 1 to 120, read through a run-length encoding debugserver
+static void test_fake_run_lengths(void) {
+    char nibbles[120 * 121 / 2 + 1];
+    size_t nibbleCount = 0;
+    for(size_t run = 1; run <= 120; ++run) {
+        memset(nibbles + nibbleCount, run & 1 ? 'a' : '5', run);
+        nibbleCount += run;
+    }
+    nibbles[nibbleCount++] = '0';
+    size_t length = nibbleCount / 2;
+    uint8_t* memory = malloc(length);
+    CHECK(rsp_hex_decode(memory, nibbles, nibbleCount));
+
+    FakeMapping mapping = { .start = TEST_BASE, .size = length, .bytes = memory, .readable = true };
+    uint64_t bytesSent[2];
+    for(int runLengthEncode = 0; runLengthEncode <= 1; ++runLengthEncode) {
+        FakeDebugserverConfig config = { .packetSize = 0x10000, .runLengthEncode = runLengthEncode, .mappings = &mapping, .mappingCount = 1 };
+        DebugProxyHandle* debugProxy = 0;
+        FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+        DebugSession* session = debug_session_open(debugProxy);
+        IdeviceFfiError* err = debug_session_negotiate(session);
+        CHECK(err == 0);
+        uint8_t* out = calloc(1, length);
+        RspReadResult result;
+        int ret = rsp_read_memory(debugProxy, TEST_BASE, length, test_copy_sink, out, &result, &err);
+        CHECK(ret == 0);
+        CHECK_EQ_U64(result.packetCount, 1);
+        CHECK(memcmp(out, memory, length) == 0);
+        debug_session_close(debugProxy);
+        debug_proxy_free(debugProxy);
+        FakeDebugserverStats serverStats;
+        fake_debugserver_stop(server, &serverStats, 0, 0);
+        fake_debugserver_free(server);
+        bytesSent[runLengthEncode] = serverStats.bytesSent;
+        free(out);
+    }
+    // the encoded reply really was encoded
+    CHECK(bytesSent[1] < bytesSent[0] / 4);
+    free(memory);
+}
+
+int main(void) {
+    test_run_length();
+    test_escapes();
+    test_malformed();
+    test_checksum();
+    test_fake_run_lengths();
+    return test_finish("test_decode");
+}
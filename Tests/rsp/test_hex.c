@@ -0,0 +1,156 @@
+//
+//  test_hex.c
+//  StikJIT host tests
+//
+//  rsp_hex_encode, rsp_hex_decode, rsp_checksum and hex rsp_decode_payload against the
+//  byte-at-a-time reference, for every length 0..257 at unaligned source and destination
+//  offsets. Built once per kernel rsp.c can compile to.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "hex_reference.h"
+#include "test_util.h"
+
+#define TEST_MAX_LENGTH 257
+#define TEST_MAX_OFFSET 7
+// bytes after an output that must stay untouched
+#define TEST_GUARD 64
+#define TEST_GUARD_BYTE 0xa5
+
+static bool test_guard_intact(const uint8_t* guard) {
+    for(size_t i = 0; i < TEST_GUARD; ++i) {
+        if(guard[i] != TEST_GUARD_BYTE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_encode_and_checksum(void) {
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    uint8_t data[TEST_MAX_LENGTH + TEST_MAX_OFFSET];
+    char expected[2 * TEST_MAX_LENGTH];
+    uint8_t out[2 * TEST_MAX_LENGTH + TEST_MAX_OFFSET + TEST_GUARD];
+    for(size_t length = 0; length <= TEST_MAX_LENGTH; ++length) {
+        for(size_t offset = 0; offset <= TEST_MAX_OFFSET; ++offset) {
+            hex_random_fill(data, sizeof(data), &state);
+            const uint8_t* source = data + offset;
+            uint8_t expectedSum = hex_reference_encode(expected, source, length);
+
+            memset(out, TEST_GUARD_BYTE, sizeof(out));
+            char* destination = (char*)out + (TEST_MAX_OFFSET - offset);
+            uint8_t sum = rsp_hex_encode(destination, source, length);
+            if(sum != expectedSum || memcmp(destination, expected, 2 * length) != 0 || !test_guard_intact((uint8_t*)destination + 2 * length)) {
+                fprintf(stderr, "encode mismatch: length %zu offset %zu\n", length, offset);
+                ++testFailureCount;
+            }
+            // the checksum kernel sums raw bytes, high bit set included
+            if(rsp_checksum((const char*)source, length) != hex_reference_checksum((const char*)source, length)) {
+                fprintf(stderr, "checksum mismatch: length %zu offset %zu\n", length, offset);
+                ++testFailureCount;
+            }
+        }
+    }
+}
+
+// lowercase, uppercase or mixed hex of data
+static void test_make_hex(char* out, const uint8_t* data, size_t length, int letterCase, uint64_t* state) {
+    hex_reference_encode(out, data, length);
+    for(size_t i = 0; i < 2 * length; ++i) {
+        if(out[i] >= 'a' && (letterCase == 1 || (letterCase == 2 && (hex_random(state) & 1)))) {
+            out[i] -= 0x20;
+        }
+    }
+}
+
+static void test_decode(void) {
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    uint8_t data[TEST_MAX_LENGTH];
+    char hex[2 * TEST_MAX_LENGTH + TEST_MAX_OFFSET + 1];
+    uint8_t out[TEST_MAX_LENGTH + TEST_MAX_OFFSET + TEST_GUARD];
+    uint8_t inPlace[2 * TEST_MAX_LENGTH + TEST_MAX_OFFSET];
+    for(size_t length = 0; length <= TEST_MAX_LENGTH; ++length) {
+        for(size_t offset = 0; offset <= TEST_MAX_OFFSET; ++offset) {
+            hex_random_fill(data, length, &state);
+            char* source = hex + offset;
+            test_make_hex(source, data, length, (int)(offset % 3), &state);
+
+            memset(out, TEST_GUARD_BYTE, sizeof(out));
+            uint8_t* destination = out + (TEST_MAX_OFFSET - offset);
+            bool ok = rsp_hex_decode(destination, source, 2 * length);
+            if(!ok || memcmp(destination, data, length) != 0 || !test_guard_intact(destination + length)) {
+                fprintf(stderr, "decode mismatch: length %zu offset %zu\n", length, offset);
+                ++testFailureCount;
+            }
+            // a trailing odd character is ignored
+            source[2 * length] = '7';
+            CHECK(rsp_hex_decode(destination, source, 2 * length + 1));
+
+            // in place, as rsp_read_memory decodes replies
+            memcpy(inPlace + offset, source, 2 * length);
+            ok = rsp_hex_decode(inPlace + offset, (const char*)inPlace + offset, 2 * length);
+            if(!ok || memcmp(inPlace + offset, data, length) != 0) {
+                fprintf(stderr, "in place decode mismatch: length %zu offset %zu\n", length, offset);
+                ++testFailureCount;
+            }
+        }
+    }
+}
+
+// one bad character anywhere in the input must be caught, whichever block it lands in
+static void test_decode_rejects(void) {
+    // neighbours of the digit and letter ranges, and bytes that equal a hex letter once 0x20 is or'ed in
+    const char bad[] = { '/', ':', '@', 'G', '`', 'g', ' ', 0, (char)0xc1, (char)0xe6, (char)0x80 };
+    uint64_t state = 0xd1b54a32d192ed03ULL;
+    uint8_t data[TEST_MAX_LENGTH];
+    char hex[2 * TEST_MAX_LENGTH];
+    uint8_t out[TEST_MAX_LENGTH];
+    for(size_t length = 1; length <= TEST_MAX_LENGTH; ++length) {
+        hex_random_fill(data, length, &state);
+        test_make_hex(hex, data, length, 2, &state);
+        for(size_t position = 0; position < 2 * length; ++position) {
+            char saved = hex[position];
+            hex[position] = bad[(length + position) % sizeof(bad)];
+            if(rsp_hex_decode(out, hex, 2 * length)) {
+                fprintf(stderr, "decode accepted 0x%02x at %zu of %zu\n", (uint8_t)hex[position], position, 2 * length);
+                ++testFailureCount;
+            }
+            hex[position] = saved;
+        }
+    }
+}
+
+// the hex path of rsp_decode_payload sums the checksum while the kernel decodes
+static void test_decode_payload(void) {
+    uint64_t state = 0x94d049bb133111ebULL;
+    uint8_t data[TEST_MAX_LENGTH];
+    char hex[2 * TEST_MAX_LENGTH];
+    uint8_t out[TEST_MAX_LENGTH];
+    for(size_t length = 0; length <= TEST_MAX_LENGTH; ++length) {
+        hex_random_fill(data, length, &state);
+        uint8_t sum = hex_reference_encode(hex, data, length);
+        char checksum[3];
+        snprintf(checksum, sizeof(checksum), "%02x", sum);
+        int64_t decoded = rsp_decode_payload(out, sizeof(out), hex, 2 * length, checksum, true);
+        CHECK_EQ_U64(decoded, length);
+        CHECK(decoded != (int64_t)length || memcmp(out, data, length) == 0);
+
+        snprintf(checksum, sizeof(checksum), "%02x", (uint8_t)(sum + 1));
+        CHECK(rsp_decode_payload(out, sizeof(out), hex, 2 * length, checksum, true) == RSP_DECODE_BAD_CHECKSUM);
+    }
+}
+
+int main(void) {
+    if(!hex_kernel_supported()) {
+        printf("test_hex (%s): CPU lacks the instructions, skipped\n", HEX_KERNEL_NAME);
+        return HEX_SKIP_EXIT_CODE;
+    }
+    printf("test_hex: %s kernel\n", HEX_KERNEL_NAME);
+    test_encode_and_checksum();
+    test_decode();
+    test_decode_rejects();
+    test_decode_payload();
+    return test_finish("test_hex");
+}
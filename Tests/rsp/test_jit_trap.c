@@ -0,0 +1,383 @@
+//
+//  test_jit_trap.c
+//  StikJIT host tests
+//
+//  jit_trap_loop against a fake debugserver running a scripted process: prepare traps with
+//  expedited and read registers, allocation through _M, stepping over the brk with P, detaching
+//  with D, exits, traps the loop leaves to the script and a refused register write. Then the stop
+//  replies and register cache the loop relies on, and which replies may replace the cached stop.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "jit_trap.h"
+#include "debug_session.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define TEST_THREAD 0x1f03
+#define TEST_PAGE_SIZE 0x4000
+// two trap sites, then a word that isn't a brk
+#define TEST_CODE_BASE 0x100000000ULL
+#define TEST_SITE_A (TEST_CODE_BASE + 0x10)
+#define TEST_SITE_B (TEST_CODE_BASE + 0x20)
+#define TEST_NOT_A_TRAP (TEST_CODE_BASE + 0x30)
+#define TEST_JIT_BASE 0x200000000ULL
+#define TEST_ALLOCATE_BASE 0x300000000ULL
+
+#define TEST_X0 0
+#define TEST_X1 1
+#define TEST_X16 16
+#define TEST_PC 32
+
+typedef struct TestProcess {
+    uint8_t code[0x40];
+    uint8_t* jit;
+    uint8_t* allocation;
+    FakeMapping mappings[3];
+} TestProcess;
+
+static void test_process_init(TestProcess* process) {
+    memset(process->code, 0, sizeof(process->code));
+    const uint64_t sites[] = { TEST_SITE_A, TEST_SITE_B };
+    for(size_t i = 0; i < 2; ++i) {
+        uint8_t* site = process->code + (sites[i] - TEST_CODE_BASE);
+        for(int byte = 0; byte < 4; ++byte) {
+            site[byte] = (uint8_t)(JIT_TRAP_INSTRUCTION >> (8 * byte));
+        }
+    }
+    process->jit = calloc(1, 0x8000);
+    process->allocation = calloc(1, 0x4000);
+    process->mappings[0] = (FakeMapping){ .start = TEST_CODE_BASE, .size = sizeof(process->code), .bytes = process->code, .readable = true };
+    process->mappings[1] = (FakeMapping){ .start = TEST_JIT_BASE, .size = 0x8000, .bytes = process->jit, .readable = true, .writable = true };
+    process->mappings[2] = (FakeMapping){ .start = TEST_ALLOCATE_BASE, .size = 0x4000, .bytes = process->allocation, .readable = true, .writable = true };
+}
+
+static void test_process_free(TestProcess* process) {
+    free(process->allocation);
+    free(process->jit);
+}
+
+// little endian hex of a register value, as stop replies and p carry it
+static void test_le_hex(char* out, uint64_t value) {
+    for(int i = 0; i < 8; ++i) {
+        snprintf(out + 2 * i, 3, "%02x", (unsigned)(value >> (8 * i)) & 0xff);
+    }
+}
+
+// "T05thread:1f03;" with pc and x16 expedited when expedite is set
+static void test_trap_reply(char* out, size_t outSize, bool expedite, uint64_t pc, uint64_t command) {
+    if(!expedite) {
+        snprintf(out, outSize, "T05thread:%x;metype:6;", TEST_THREAD);
+        return;
+    }
+    char pcHex[17];
+    char commandHex[17];
+    test_le_hex(pcHex, pc);
+    test_le_hex(commandHex, command);
+    snprintf(out, outSize, "T05thread:%x;10:%s;20:%s;metype:6;", TEST_THREAD, commandHex, pcHex);
+}
+
+typedef struct TestLoop {
+    DebugProxyHandle* debugProxy;
+    FakeDebugserver* server;
+    DebugSession* session;
+    JitTrapStats stats;
+    StopReply stop;
+    char stopText[256];
+    int outcome;
+} TestLoop;
+
+static int test_loop_run(TestLoop* loop, FakeDebugserverConfig* config) {
+    loop->server = fake_debugserver_start(config, &loop->debugProxy);
+    loop->session = debug_session_open(loop->debugProxy);
+    IdeviceFfiError* err = debug_session_negotiate(loop->session);
+    CHECK(err == 0);
+    loop->outcome = -1;
+    int ret = jit_trap_loop(loop->debugProxy, TEST_PAGE_SIZE, &loop->stats, &loop->stop, loop->stopText, sizeof(loop->stopText), &loop->outcome, &err);
+    CHECK(err == 0);
+    idevice_error_free(err);
+    return ret;
+}
+
+static void test_loop_end(TestLoop* loop, FakeDebugserverStats* serverStats) {
+    debug_session_close(loop->debugProxy);
+    debug_proxy_free(loop->debugProxy);
+    fake_debugserver_stop(loop->server, serverStats, 0, 0);
+}
+
+// prepare with expedited registers, prepare with an allocation behind console output, then a
+// detach whose registers all have to be read
+static void test_prepare_and_detach(void) {
+    TestProcess process;
+    test_process_init(&process);
+    char replies[3][128];
+    test_trap_reply(replies[0], sizeof(replies[0]), true, TEST_SITE_A, JIT_TRAP_COMMAND_PREPARE_REGION);
+    test_trap_reply(replies[1], sizeof(replies[1]), true, TEST_SITE_A, JIT_TRAP_COMMAND_PREPARE_REGION);
+    test_trap_reply(replies[2], sizeof(replies[2]), false, 0, 0);
+    FakeStop stops[3] = {
+        { .reply = replies[0] },
+        { .output = "preparing\n", .reply = replies[1] },
+        { .reply = replies[2] },
+    };
+    stops[0].registers[TEST_X0] = TEST_JIT_BASE;
+    stops[0].registers[TEST_X1] = 0x8000;
+    stops[0].registers[TEST_X16] = JIT_TRAP_COMMAND_PREPARE_REGION;
+    stops[0].registers[TEST_PC] = TEST_SITE_A;
+    stops[1].registers[TEST_X1] = 0x4000;
+    stops[1].registers[TEST_X16] = JIT_TRAP_COMMAND_PREPARE_REGION;
+    stops[1].registers[TEST_PC] = TEST_SITE_A;
+    stops[2].registers[TEST_X16] = JIT_TRAP_COMMAND_DETACH;
+    stops[2].registers[TEST_PC] = TEST_SITE_B;
+    FakeDebugserverConfig config = { .mappings = process.mappings, .mappingCount = 3, .stops = stops, .stopCount = 3, .allocateAddress = TEST_ALLOCATE_BASE };
+
+    TestLoop loop;
+    int ret = test_loop_run(&loop, &config);
+    CHECK(ret == 0);
+    CHECK(loop.outcome == JIT_TRAP_DETACHED);
+    CHECK_EQ_U64(loop.stats.stopCount, 3);
+    CHECK_EQ_U64(loop.stats.trapCount, 3);
+    CHECK_EQ_U64(loop.stats.prepareCount, 2);
+    CHECK_EQ_U64(loop.stats.preparedBytes, 0xc000);
+    // the second stop at site A doesn't read it again
+    CHECK_EQ_U64(loop.stats.instructionReads, 2);
+    CHECK(loop.stats.minMicros <= loop.stats.maxMicros);
+    CHECK(loop.stats.maxMicros <= loop.stats.totalMicros);
+    CHECK(strcmp(loop.stopText, replies[2]) == 0);
+    CHECK(loop.stop.kind == 'T');
+    CHECK_EQ_U64(loop.stop.thread, TEST_THREAD);
+    // the detach dropped the stop, the mappings and the pages the process had
+    CHECK(!loop.session->hasStop);
+    CHECK(!loop.session->regions.valid);
+    CHECK_EQ_U64(loop.session->preparedPages.count, 0);
+
+    FakeDebugserverStats serverStats;
+    test_loop_end(&loop, &serverStats);
+    CHECK_EQ_U64(serverStats.resumeCount, 3);
+    CHECK_EQ_U64(serverStats.allocateCount, 1);
+    CHECK_EQ_U64(serverStats.detachCount, 1);
+    // one page write per page prepared
+    CHECK_EQ_U64(serverStats.memoryWriteCount, 3);
+    // x0 and x1 at the first two stops, pc and x16 at the last
+    CHECK_EQ_U64(serverStats.registerReadCount, 6);
+    // x0 and pc for each prepare, pc for the detach
+    CHECK_EQ_U64(serverStats.registerWriteCount, 5);
+    // each resume continued past the brk with the prepared address in x0
+    const uint64_t* registers = fake_debugserver_resume_registers(loop.server, 1);
+    CHECK(registers != 0);
+    if(registers) {
+        CHECK_EQ_U64(registers[TEST_PC], TEST_SITE_A + 4);
+        CHECK_EQ_U64(registers[TEST_X0], TEST_JIT_BASE);
+    }
+    registers = fake_debugserver_resume_registers(loop.server, 2);
+    CHECK(registers != 0);
+    if(registers) {
+        CHECK_EQ_U64(registers[TEST_PC], TEST_SITE_A + 4);
+        CHECK_EQ_U64(registers[TEST_X0], TEST_ALLOCATE_BASE);
+    }
+    CHECK(fake_debugserver_resume_registers(loop.server, 3) == 0);
+    fake_debugserver_free(loop.server);
+    test_process_free(&process);
+}
+
+// the process exits on the first resume, and is killed by a signal after a trap
+static void test_exit(void) {
+    TestProcess process;
+    test_process_init(&process);
+    FakeDebugserverConfig config = { .mappings = process.mappings, .mappingCount = 3 };
+    TestLoop loop;
+    int ret = test_loop_run(&loop, &config);
+    CHECK(ret == 0);
+    CHECK(loop.outcome == JIT_TRAP_EXITED);
+    CHECK(loop.stop.kind == 'W');
+    CHECK_EQ_U64(loop.stats.stopCount, 1);
+    CHECK_EQ_U64(loop.stats.trapCount, 0);
+    test_loop_end(&loop, 0);
+    fake_debugserver_free(loop.server);
+
+    char reply[128];
+    test_trap_reply(reply, sizeof(reply), true, TEST_SITE_B, JIT_TRAP_COMMAND_PREPARE_REGION);
+    FakeStop stops[2] = { { .reply = reply }, { .reply = "X09" } };
+    stops[0].registers[TEST_X0] = TEST_JIT_BASE;
+    stops[0].registers[TEST_X1] = 0x4000;
+    config.stops = stops;
+    config.stopCount = 2;
+    ret = test_loop_run(&loop, &config);
+    CHECK(ret == 0);
+    CHECK(loop.outcome == JIT_TRAP_EXITED);
+    CHECK(loop.stop.kind == 'X');
+    CHECK_EQ_U64(loop.stop.signal, 9);
+    CHECK_EQ_U64(loop.stats.stopCount, 2);
+    CHECK_EQ_U64(loop.stats.trapCount, 1);
+    CHECK(strcmp(loop.stopText, "X09") == 0);
+    // an exit drops what was prepared in the process
+    CHECK_EQ_U64(loop.session->preparedPages.count, 0);
+    test_loop_end(&loop, 0);
+    fake_debugserver_free(loop.server);
+    test_process_free(&process);
+}
+
+// stops the loop hands back to the script: a trap with an unknown x16, a stop on an instruction
+// that isn't a brk, and a stop without a thread. the process is left stopped where it was
+static void test_unhandled(void) {
+    TestProcess process;
+    test_process_init(&process);
+    char replies[2][128];
+    test_trap_reply(replies[0], sizeof(replies[0]), true, TEST_SITE_A, 7);
+    test_trap_reply(replies[1], sizeof(replies[1]), true, TEST_NOT_A_TRAP, JIT_TRAP_COMMAND_DETACH);
+    const char* expected[] = { replies[0], replies[1], "S05" };
+    for(size_t i = 0; i < 3; ++i) {
+        FakeStop stop = { .reply = expected[i] };
+        FakeDebugserverConfig config = { .mappings = process.mappings, .mappingCount = 3, .stops = &stop, .stopCount = 1 };
+        TestLoop loop;
+        int ret = test_loop_run(&loop, &config);
+        CHECK(ret == 0);
+        CHECK(loop.outcome == JIT_TRAP_UNHANDLED_STOP);
+        CHECK_EQ_U64(loop.stats.stopCount, 1);
+        CHECK_EQ_U64(loop.stats.trapCount, 0);
+        CHECK(strcmp(loop.stopText, expected[i]) == 0);
+        CHECK(loop.session->hasStop);
+        if(i < 2) {
+            // the script's register reads are answered from the stop
+            char value[17];
+            char pcHex[17];
+            test_le_hex(pcHex, i == 0 ? TEST_SITE_A : TEST_NOT_A_TRAP);
+            CHECK(debug_session_cached_register_read(loop.session, "p20;thread:1f03;", value));
+            CHECK(strcmp(value, pcHex) == 0);
+        }
+        FakeDebugserverStats serverStats;
+        test_loop_end(&loop, &serverStats);
+        CHECK_EQ_U64(serverStats.resumeCount, 1);
+        CHECK_EQ_U64(serverStats.registerWriteCount, 0);
+        fake_debugserver_free(loop.server);
+    }
+    test_process_free(&process);
+}
+
+// debugserver refuses the writes finishing a trap, the resume behind them still runs
+static void test_refused_write(void) {
+    TestProcess process;
+    test_process_init(&process);
+    // a prepare with its operands expedited too, so the only requests are the page write and the P writes
+    char prepareReply[192];
+    char operandHex[2][17];
+    test_trap_reply(prepareReply, sizeof(prepareReply), true, TEST_SITE_A, JIT_TRAP_COMMAND_PREPARE_REGION);
+    test_le_hex(operandHex[0], TEST_JIT_BASE);
+    test_le_hex(operandHex[1], 0x4000);
+    size_t length = strlen(prepareReply);
+    snprintf(prepareReply + length, sizeof(prepareReply) - length, "00:%s;01:%s;", operandHex[0], operandHex[1]);
+    char nextReply[128];
+    test_trap_reply(nextReply, sizeof(nextReply), true, TEST_SITE_B, 7);
+    FakeStop stops[2] = { { .reply = prepareReply }, { .reply = nextReply } };
+    FakeDebugserverConfig config = { .mappings = process.mappings, .mappingCount = 3, .stops = stops, .stopCount = 2, .refuseRegisterWrites = true };
+
+    TestLoop loop;
+    int ret = test_loop_run(&loop, &config);
+    CHECK(ret == -3);
+    CHECK_EQ_U64(loop.stats.stopCount, 1);
+    CHECK_EQ_U64(loop.stats.prepareCount, 1);
+    // stopText keeps the trap that failed, the session the stop the process ran into
+    CHECK(strcmp(loop.stopText, prepareReply) == 0);
+    CHECK(loop.session->hasStop);
+    uint64_t pc = 0;
+    CHECK(stop_reply_register(&loop.session->stop, TEST_PC, &pc));
+    CHECK_EQ_U64(pc, TEST_SITE_B);
+    // no reply is left behind on the connection
+    IdeviceFfiError* err = debug_session_negotiate(loop.session);
+    CHECK(err == 0);
+    idevice_error_free(err);
+    FakeDebugserverStats serverStats;
+    test_loop_end(&loop, &serverStats);
+    CHECK_EQ_U64(serverStats.resumeCount, 2);
+    CHECK_EQ_U64(serverStats.registerWriteCount, 2);
+    fake_debugserver_free(loop.server);
+    test_process_free(&process);
+}
+
+static void test_stop_replies(void) {
+    StopReply stop;
+    const char* text = "T05thread:1f03;20:1040000001000000;10:0100000000000000;metype:6;medata:1;";
+    CHECK(stop_reply_parse(text, strlen(text), &stop));
+    CHECK(stop.kind == 'T');
+    CHECK_EQ_U64(stop.signal, 5);
+    CHECK(stop.hasThread);
+    CHECK_EQ_U64(stop.thread, TEST_THREAD);
+    CHECK_EQ_U64(stop.exceptionType, 6);
+    CHECK_EQ_U64(stop.registerCount, 2);
+    uint64_t value = 0;
+    CHECK(stop_reply_register(&stop, TEST_PC, &value));
+    CHECK_EQ_U64(value, 0x100004010);
+    CHECK(stop_reply_register(&stop, TEST_X16, &value));
+    CHECK_EQ_U64(value, 1);
+    CHECK(!stop_reply_register(&stop, TEST_X0, &value));
+
+    CHECK(stop_reply_parse("W00", 3, &stop));
+    CHECK(stop.kind == 'W');
+    CHECK(!stop.hasThread);
+    CHECK(stop_reply_parse("X09", 3, &stop));
+    CHECK(stop.kind == 'X');
+    CHECK_EQ_U64(stop.signal, 9);
+    CHECK(!stop_reply_parse("OK", 2, &stop));
+    CHECK(!stop_reply_parse("E01", 3, &stop));
+    CHECK(!stop_reply_parse("T0", 2, &stop));
+    CHECK(!stop_reply_parse("Tzz", 3, &stop));
+
+    // the register cache a recorded stop seeds, and what drops it
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserverConfig config = {0};
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    DebugSession* session = debug_session_open(debugProxy);
+    debug_session_record_stop(session, text, strlen(text));
+    CHECK(session->hasStop);
+    char hex[17];
+    CHECK(debug_session_cached_register_read(session, "p20;thread:1f03;", hex));
+    CHECK(strcmp(hex, "1040000001000000") == 0);
+    CHECK(!debug_session_cached_register_read(session, "p20;thread:1f04;", hex));
+    CHECK(!debug_session_cached_register_read(session, "p0;thread:1f03;", hex));
+    debug_session_cache_register_read(session, "p0;thread:1f03;", "0000000002000000");
+    CHECK(debug_session_cached_register_read(session, "p0;thread:1f03;", hex));
+    CHECK(strcmp(hex, "0000000002000000") == 0);
+    // a write may be refused, the register is read again
+    debug_session_note_command(session, "P20=1440000001000000;thread:1f03;");
+    CHECK(!debug_session_cached_register_read(session, "p20;thread:1f03;", hex));
+    CHECK(debug_session_cached_register_read(session, "p10;thread:1f03;", hex));
+    debug_session_note_command(session, "c");
+    CHECK(!session->hasStop);
+    CHECK(!debug_session_cached_register_read(session, "p10;thread:1f03;", hex));
+    debug_session_record_stop(session, "OK", 2);
+    CHECK(!session->hasStop);
+
+    // only replies to commands that resume or report the process's stop replace the cached one
+    debug_session_note_reply(session, "?", text, strlen(text));
+    CHECK(session->hasStop);
+    const char* otherThread = "T05thread:1f04;20:0080000001000000;10:0000000000000000;";
+    debug_session_note_reply(session, "qThreadStopInfo1f04", otherThread, strlen(otherThread));
+    debug_session_note_reply(session, "jThreadsInfo", otherThread, strlen(otherThread));
+    CHECK(session->hasStop);
+    CHECK_EQ_U64(session->stop.thread, TEST_THREAD);
+    CHECK(debug_session_cached_register_read(session, "p20", hex));
+    CHECK(strcmp(hex, "1040000001000000") == 0);
+    debug_session_note_reply(session, "p0;thread:1f03;", "0000000003000000", 16);
+    CHECK(debug_session_cached_register_read(session, "p0", hex));
+    CHECK(strcmp(hex, "0000000003000000") == 0);
+    debug_session_note_command(session, "vCont;c:1f04");
+    debug_session_note_reply(session, "vCont;c:1f04", otherThread, strlen(otherThread));
+    CHECK(session->hasStop);
+    CHECK_EQ_U64(session->stop.thread, 0x1f04);
+    CHECK(debug_session_cached_register_read(session, "p20", hex));
+    CHECK(strcmp(hex, "0080000001000000") == 0);
+    debug_session_close(debugProxy);
+    debug_proxy_free(debugProxy);
+    fake_debugserver_stop(server, 0, 0, 0);
+    fake_debugserver_free(server);
+}
+
+int main(void) {
+    test_prepare_and_detach();
+    test_exit();
+    test_unhandled();
+    test_refused_write();
+    test_stop_replies();
+    return test_finish("test_jit_trap");
+}
@@ -0,0 +1,226 @@
+//
+//  test_memory_scan.c
+//  StikJIT host tests
+//
+//  memory_scan against the fake debugserver: matches straddling two m replies are found,
+//  nibble masks and wildcards match what they should, the anchor moves to the rarest byte,
+//  and unreadable pages are skipped a page at a time up to the very top of the address space.
+//
+
+#include <stdlib.h>
+
+#include "memory_scan.h"
+#include "debug_session.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define TEST_BASE 0x100000000ULL
+#define TEST_PAGE_SIZE 0x1000
+// m replies of 0xec bytes, so a region is read in many chunks that don't line up with anything
+#define TEST_PACKET_SIZE 0x200
+
+typedef struct TestScan {
+    DebugProxyHandle* debugProxy;
+    FakeDebugserver* server;
+} TestScan;
+
+static void test_scan_begin(TestScan* scan, FakeMapping* mappings, size_t mappingCount) {
+    FakeDebugserverConfig config = { .packetSize = TEST_PACKET_SIZE, .mappings = mappings, .mappingCount = mappingCount };
+    scan->server = fake_debugserver_start(&config, &scan->debugProxy);
+    DebugSession* session = debug_session_open(scan->debugProxy);
+    IdeviceFfiError* err = debug_session_negotiate(session);
+    CHECK(err == 0);
+}
+
+static void test_scan_end(TestScan* scan) {
+    debug_session_close(scan->debugProxy);
+    debug_proxy_free(scan->debugProxy);
+    fake_debugserver_stop(scan->server, 0, 0, 0);
+    fake_debugserver_free(scan->server);
+}
+
+static int test_run(TestScan* scan, RegionMap* map, const char* patternText, size_t maxHits, ScanResult* result) {
+    ScanPattern pattern;
+    CHECK(scan_pattern_parse(patternText, &pattern));
+    IdeviceFfiError* err = 0;
+    int ret = memory_scan(scan->debugProxy, map, 0, UINT64_MAX, &pattern, TEST_PAGE_SIZE, maxHits, result, &err);
+    CHECK(err == 0);
+    scan_pattern_free(&pattern);
+    return ret;
+}
+
+static void test_parse(void) {
+    ScanPattern pattern;
+    CHECK(scan_pattern_parse("48 8b ?? ? 05 4? ?b", &pattern));
+    CHECK_EQ_U64(pattern.length, 7);
+    const uint8_t bytes[] = { 0x48, 0x8b, 0, 0, 0x05, 0x40, 0x0b };
+    const uint8_t mask[] = { 0xff, 0xff, 0, 0, 0xff, 0xf0, 0x0f };
+    CHECK(memcmp(pattern.bytes, bytes, 7) == 0);
+    CHECK(memcmp(pattern.mask, mask, 7) == 0);
+    CHECK(pattern.anchor == 0);
+
+    // the rarest fixed byte of the sample, wildcards and half-fixed bytes can't be anchors
+    uint8_t sample[64];
+    memset(sample, 0x48, sizeof(sample));
+    memset(sample, 0x8b, 8);
+    sample[9] = 0x05;
+    scan_pattern_choose_anchor(&pattern, sample, sizeof(sample));
+    CHECK(pattern.anchor == 4);
+    memset(sample, 0x05, sizeof(sample));
+    scan_pattern_choose_anchor(&pattern, sample, sizeof(sample));
+    CHECK(pattern.anchor == 0);
+    scan_pattern_free(&pattern);
+
+    CHECK(scan_pattern_parse("?? 4?", &pattern));
+    CHECK(pattern.anchor == -1);
+    scan_pattern_choose_anchor(&pattern, sample, sizeof(sample));
+    CHECK(pattern.anchor == -1);
+    scan_pattern_free(&pattern);
+
+    CHECK(!scan_pattern_parse("", &pattern));
+    CHECK(!scan_pattern_parse("4", &pattern));
+    CHECK(!scan_pattern_parse("48 8bc", &pattern));
+    CHECK(!scan_pattern_parse("4g", &pattern));
+}
+
+// a copy of the pattern across every chunk boundary, one byte further left each time
+static void test_chunk_boundaries(void) {
+    size_t size = 0x10000;
+    uint8_t* memory = calloc(1, size);
+    const uint8_t needle[] = { 0xde, 0xad, 0xbe, 0xef, 0x13, 0x37, 0xc0, 0xde };
+    FakeMapping mapping = { .start = TEST_BASE, .size = size, .bytes = memory, .readable = true };
+    TestScan scan;
+    test_scan_begin(&scan, &mapping, 1);
+    uint64_t chunk = debug_session_max_hex_payload(debug_session_get(scan.debugProxy));
+    CHECK(chunk > 2 * sizeof(needle));
+
+    uint64_t expected[sizeof(needle) + 1];
+    size_t expectedCount = 0;
+    for(size_t split = 0; split <= sizeof(needle); ++split) {
+        uint64_t offset = (split + 1) * chunk - split;
+        memcpy(memory + offset, needle, sizeof(needle));
+        expected[expectedCount++] = TEST_BASE + offset;
+    }
+    MappedRegion region = { .start = TEST_BASE, .size = size, .permissions = MAPPED_REGION_READ };
+    RegionMap map = { .regions = &region, .count = 1, .valid = true };
+    ScanResult result;
+    int ret = test_run(&scan, &map, "de ad be ef 13 37 c0 de", 0, &result);
+    CHECK(ret == 0);
+    CHECK_EQ_U64(result.bytesScanned, size);
+    CHECK_EQ_U64(result.regionCount, 1);
+    CHECK_EQ_U64(result.failedRegionCount, 0);
+    CHECK_EQ_U64(result.hitCount, expectedCount);
+    for(size_t i = 0; i < result.hitCount && i < expectedCount; ++i) {
+        CHECK_EQ_U64(result.hits[i], expected[i]);
+    }
+    free(result.hits);
+
+    // maxHits stops the scan, the connection stays usable for the next one
+    ret = test_run(&scan, &map, "de ad be ef 13 37 c0 de", 3, &result);
+    CHECK(ret == 0);
+    CHECK_EQ_U64(result.hitCount, 3);
+    CHECK(result.bytesScanned < size);
+    free(result.hits);
+    ret = test_run(&scan, &map, "c0 de", 0, &result);
+    CHECK(ret == 0);
+    CHECK_EQ_U64(result.hitCount, expectedCount);
+    free(result.hits);
+
+    test_scan_end(&scan);
+    free(memory);
+}
+
+// wildcards and single fixed nibbles, across a boundary too
+static void test_masked(void) {
+    size_t size = 0x2000;
+    uint8_t* memory = malloc(size);
+    memset(memory, 0x11, size);
+    FakeMapping mapping = { .start = TEST_BASE, .size = size, .bytes = memory, .readable = true };
+    TestScan scan;
+    test_scan_begin(&scan, &mapping, 1);
+    uint64_t chunk = debug_session_max_hex_payload(debug_session_get(scan.debugProxy));
+
+    struct { uint64_t offset; uint8_t bytes[5]; bool matches; } cases[] = {
+        { 0x100, { 0xaa, 0x00, 0x45, 0x0b, 0xcc }, true },
+        { 0x200, { 0xaa, 0xff, 0x4f, 0xfb, 0xcc }, true },
+        { 0x300, { 0xaa, 0x12, 0x54, 0x0b, 0xcc }, false },
+        { 0x400, { 0xaa, 0x12, 0x45, 0x0c, 0xcc }, false },
+        { 0x500, { 0xab, 0x12, 0x45, 0x0b, 0xcc }, false },
+        { 0x600, { 0xaa, 0x12, 0x45, 0x0b, 0xcd }, false },
+        { 2 * chunk - 2, { 0xaa, 0x34, 0x40, 0x3b, 0xcc }, true },
+    };
+    size_t caseCount = sizeof(cases) / sizeof(cases[0]);
+    for(size_t i = 0; i < caseCount; ++i) {
+        memcpy(memory + cases[i].offset, cases[i].bytes, 5);
+    }
+    MappedRegion region = { .start = TEST_BASE, .size = size, .permissions = MAPPED_REGION_READ };
+    RegionMap map = { .regions = &region, .count = 1, .valid = true };
+    ScanResult result;
+    int ret = test_run(&scan, &map, "aa ?? 4? ?b cc", 0, &result);
+    CHECK(ret == 0);
+    size_t matchCount = 0;
+    for(size_t i = 0; i < caseCount; ++i) {
+        bool found = false;
+        for(size_t j = 0; j < result.hitCount; ++j) {
+            found |= result.hits[j] == TEST_BASE + cases[i].offset;
+        }
+        CHECK(found == cases[i].matches);
+        matchCount += cases[i].matches;
+    }
+    CHECK_EQ_U64(result.hitCount, matchCount);
+    free(result.hits);
+
+    // no fully fixed byte, every offset is tried: the cases starting with 0xaa
+    ret = test_run(&scan, &map, "?a ?", 0, &result);
+    CHECK(ret == 0);
+    CHECK_EQ_U64(result.hitCount, 6);
+    free(result.hits);
+
+    test_scan_end(&scan);
+    free(memory);
+}
+
+// the map says readable, debugserver disagrees for a page in the middle and for the end of the
+// address space, where skipping a page would wrap around to 0
+static void test_unreadable(void) {
+    size_t size = 4 * TEST_PAGE_SIZE;
+    uint8_t* first = calloc(1, size);
+    uint8_t* second = calloc(1, size);
+    first[0x10] = 0x5a;
+    second[size - 1] = 0x5a;
+    FakeMapping mappings[] = {
+        { .start = TEST_BASE, .size = size, .bytes = first, .readable = true },
+        { .start = TEST_BASE + size + TEST_PAGE_SIZE, .size = size, .bytes = second, .readable = true },
+    };
+    TestScan scan;
+    test_scan_begin(&scan, mappings, 2);
+    MappedRegion regions[] = {
+        { .start = TEST_BASE, .size = 2 * size + TEST_PAGE_SIZE, .permissions = MAPPED_REGION_READ },
+        { .start = 0xfffffffffffe0000, .size = 0x1ffff, .permissions = MAPPED_REGION_READ },
+    };
+    RegionMap map = { .regions = regions, .count = 2, .valid = true };
+    ScanResult result;
+    int ret = test_run(&scan, &map, "5a", 0, &result);
+    CHECK(ret == 0);
+    CHECK_EQ_U64(result.hitCount, 2);
+    if(result.hitCount == 2) {
+        CHECK_EQ_U64(result.hits[0], TEST_BASE + 0x10);
+        CHECK_EQ_U64(result.hits[1], TEST_BASE + 2 * size + TEST_PAGE_SIZE - 1);
+    }
+    CHECK_EQ_U64(result.regionCount, 2);
+    CHECK_EQ_U64(result.failedRegionCount, 2);
+    CHECK_EQ_U64(result.unreadableBytes, TEST_PAGE_SIZE + 0x1ffff);
+    CHECK_EQ_U64(result.bytesScanned, 2 * size);
+    free(result.hits);
+    test_scan_end(&scan);
+    free(second);
+    free(first);
+}
+
+int main(void) {
+    test_parse();
+    test_chunk_boundaries();
+    test_masked();
+    test_unreadable();
+    return test_finish("test_memory_scan");
+}
@@ -0,0 +1,141 @@
+//
+//  test_page_touch.c
+//  StikJIT host tests
+//
+//  The "$M<addr>,1:69#xx" generator against snprintf + rsp_build_packet, for addresses
+//  up to the last page below 2^64, and a prepare of a mapping at the very top.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define TEST_PAGE_SIZE 0x4000ULL
+#define TEST_TOP_PAGE (0 - TEST_PAGE_SIZE)
+
+static size_t reference_command(char* out, uint64_t addr) {
+    char payload[32];
+    int length = snprintf(payload, sizeof(payload), "M%llx,1:69", (unsigned long long)addr);
+    return rsp_build_packet(out, payload, (size_t)length);
+}
+
+// builds the reference stream for runs, one command after another
+static size_t reference_stream(char* out, const RspPageRun* runs, size_t runCount, uint64_t pageSize) {
+    size_t length = 0;
+    for(size_t i = 0; i < runCount; ++i) {
+        for(uint64_t page = 0; page < runs[i].pageCount; ++page) {
+            length += reference_command(out + length, runs[i].start + page * pageSize);
+        }
+    }
+    return length;
+}
+
+// generates the runs maxCommands at a time and compares the concatenation with the reference
+static void check_runs(const RspPageRun* runs, size_t runCount, uint32_t maxCommands) {
+    uint64_t total = 0;
+    for(size_t i = 0; i < runCount; ++i) {
+        total += runs[i].pageCount;
+    }
+    char* expected = malloc(total * RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH + 1);
+    size_t expectedLength = reference_stream(expected, runs, runCount, TEST_PAGE_SIZE);
+
+    char* actual = malloc(total * RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH + 1);
+    size_t actualLength = 0;
+    uint64_t commandTotal = 0;
+    RspPageTouchGenerator generator;
+    rsp_page_touch_init(&generator, runs, runCount, TEST_PAGE_SIZE);
+    while(generator.remaining > 0) {
+        uint32_t commandCount = 0;
+        size_t length = rsp_page_touch_fill(&generator, actual + actualLength, maxCommands, &commandCount);
+        CHECK(commandCount > 0 && commandCount <= maxCommands);
+        CHECK(length <= (size_t)commandCount * RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH);
+        if(commandCount == 0) {
+            break;
+        }
+        actualLength += length;
+        commandTotal += commandCount;
+    }
+    CHECK_EQ_U64(commandTotal, total);
+    CHECK_EQ_U64(actualLength, expectedLength);
+    CHECK(actualLength == expectedLength && memcmp(actual, expected, expectedLength) == 0);
+    free(actual);
+    free(expected);
+}
+
+// single commands around every digit count change, up to the top page
+static void test_single_addresses(void) {
+    uint64_t addrs[] = {
+        0, 0x4000, 0xffffc000, 0x100000000,
+        (1ULL << 36) - TEST_PAGE_SIZE, 1ULL << 36, (1ULL << 36) + TEST_PAGE_SIZE,
+        1ULL << 40, 1ULL << 47, 0x0fffffffffffc000, 1ULL << 60, 1ULL << 63,
+        TEST_TOP_PAGE,
+    };
+    for(size_t i = 0; i < sizeof(addrs) / sizeof(addrs[0]); ++i) {
+        RspPageRun run = { .start = addrs[i], .pageCount = 1 };
+        check_runs(&run, 1, 1);
+    }
+    char command[RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH + 1];
+    CHECK_EQ_U64(reference_command(command, TEST_TOP_PAGE), RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH);
+}
+
+// runs crossing 2^36 and ending on the top page, filled in odd-sized chunks
+static void test_streams(void) {
+    RspPageRun runs[] = {
+        { .start = 0x100000000, .pageCount = 3 },
+        { .start = (1ULL << 36) - 2 * TEST_PAGE_SIZE, .pageCount = 5 },
+        { .start = (1ULL << 60) - TEST_PAGE_SIZE, .pageCount = 2 },
+        { .start = TEST_TOP_PAGE - 3 * TEST_PAGE_SIZE, .pageCount = 4 },
+    };
+    uint32_t chunks[] = { 1, 2, 7, 14, 1024 };
+    for(size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+        check_runs(runs, 4, chunks[i]);
+    }
+}
+
+// a mapping ending at 2^64: every page is written and nothing wraps around to zero
+static void test_prepare_top_mapping(void) {
+    FakeMapping mappings[] = {
+        { .start = 1ULL << 36, .size = 4 * TEST_PAGE_SIZE, .readable = true, .writable = true },
+        { .start = TEST_TOP_PAGE - 7 * TEST_PAGE_SIZE, .size = 8 * TEST_PAGE_SIZE, .readable = true, .writable = true },
+    };
+    FakeDebugserverConfig config = { .mappings = mappings, .mappingCount = 2, .recordWrites = true };
+    RspMemoryRegion regions[] = {
+        { .start = (1ULL << 36), .size = 4 * TEST_PAGE_SIZE },
+        { .start = TEST_TOP_PAGE - 7 * TEST_PAGE_SIZE, .size = 8 * TEST_PAGE_SIZE },
+    };
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    RspPrepareStats stats = {0};
+    IdeviceFfiError* err = 0;
+    int ret = rsp_prepare_memory_regions(debugProxy, regions, 2, TEST_PAGE_SIZE, &stats, &err);
+    idevice_error_free(err);
+    debug_proxy_free(debugProxy);
+    FakeDebugserverStats serverStats;
+    const FakeWrite* writes = 0;
+    size_t writeCount = 0;
+    fake_debugserver_stop(server, &serverStats, &writes, &writeCount);
+
+    CHECK(ret == 0);
+    CHECK(regions[0].failedPage == -1);
+    CHECK(regions[1].failedPage == -1);
+    CHECK_EQ_U64(stats.commandCount, 12);
+    CHECK_EQ_U64(serverStats.badChecksumCount, 0);
+    CHECK_EQ_U64(serverStats.maxPacketLength, RSP_PAGE_TOUCH_COMMAND_MAX_LENGTH);
+    CHECK_EQ_U64(writeCount, 12);
+    // one stream, so debugserver sees the writes in order
+    for(size_t i = 0; i < writeCount && i < 12; ++i) {
+        uint64_t expected = i < 4 ? (1ULL << 36) + i * TEST_PAGE_SIZE : regions[1].start + (i - 4) * TEST_PAGE_SIZE;
+        CHECK_EQ_U64(writes[i].addr, expected);
+        CHECK_EQ_U64(writes[i].length, 1);
+    }
+    fake_debugserver_free(server);
+}
+
+int main(void) {
+    test_single_addresses();
+    test_streams();
+    test_prepare_top_mapping();
+    return test_finish("test_page_touch");
+}
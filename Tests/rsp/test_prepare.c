@@ -0,0 +1,112 @@
+//
+//  test_prepare.c
+//  StikJIT host tests
+//
+//  rsp_prepare_memory_regions against the fake debugserver: every page gets exactly one
+//  one-byte $M write, and refused pages are reported without stopping the stream.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define TEST_PAGE_SIZE 0x4000
+
+static int compare_writes(const void* a, const void* b) {
+    uint64_t left = ((const FakeWrite*)a)->addr;
+    uint64_t right = ((const FakeWrite*)b)->addr;
+    return left < right ? -1 : left > right;
+}
+
+// runs one prepare and returns the writes debugserver saw, sorted by address (caller frees)
+static int prepare(FakeDebugserverConfig* config, RspMemoryRegion* regions, size_t regionCount, RspPrepareStats* stats, FakeDebugserverStats* serverStats, FakeWrite** writesOut, size_t* writeCountOut) {
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(config, &debugProxy);
+    IdeviceFfiError* err = 0;
+    int ret = rsp_prepare_memory_regions(debugProxy, regions, regionCount, TEST_PAGE_SIZE, stats, &err);
+    idevice_error_free(err);
+    debug_proxy_free(debugProxy);
+    const FakeWrite* writes = 0;
+    size_t writeCount = 0;
+    fake_debugserver_stop(server, serverStats, &writes, &writeCount);
+    *writesOut = malloc((writeCount ? writeCount : 1) * sizeof(FakeWrite));
+    memcpy(*writesOut, writes, writeCount * sizeof(FakeWrite));
+    *writeCountOut = writeCount;
+    fake_debugserver_free(server);
+    qsort(*writesOut, writeCount, sizeof(FakeWrite), compare_writes);
+    return ret;
+}
+
+// every page of every region, trailing partial pages included, gets exactly one write
+static void test_touches_every_page(const FakeLink* link) {
+    FakeMapping mapping = { .start = 0x100000000, .size = 0x10000000, .readable = true, .writable = true };
+    FakeDebugserverConfig config = { .mappings = &mapping, .mappingCount = 1, .recordWrites = true };
+    if(link) {
+        config.link = *link;
+    }
+    RspMemoryRegion regions[] = {
+        { .start = 0x100000000, .size = 5 * TEST_PAGE_SIZE },
+        { .start = 0x100100000, .size = 3 * TEST_PAGE_SIZE + 1 },
+        { .start = 0x100200000, .size = 0 },
+        { .start = 0x101000000, .size = 3000 * TEST_PAGE_SIZE },
+    };
+    uint64_t expectedPages[] = { 5, 4, 0, 3000 };
+    RspPrepareStats stats = {0};
+    FakeDebugserverStats serverStats;
+    FakeWrite* writes = 0;
+    size_t writeCount = 0;
+    int ret = prepare(&config, regions, 4, &stats, &serverStats, &writes, &writeCount);
+    CHECK(ret == 0);
+    CHECK_EQ_U64(stats.commandCount, 5 + 4 + 3000);
+    CHECK_EQ_U64(serverStats.badChecksumCount, 0);
+    CHECK_EQ_U64(writeCount, 5 + 4 + 3000);
+
+    size_t index = 0;
+    for(size_t i = 0; i < 4; ++i) {
+        CHECK(regions[i].failedPage == -1);
+        for(uint64_t page = 0; page < expectedPages[i] && index < writeCount; ++page, ++index) {
+            CHECK_EQ_U64(writes[index].addr, regions[i].start + page * TEST_PAGE_SIZE);
+            CHECK_EQ_U64(writes[index].length, 1);
+        }
+    }
+    free(writes);
+}
+
+// a refused page is recorded on its region, the pages after it are still written
+static void test_refused_page(void) {
+    FakeMapping mappings[] = {
+        { .start = 0x200000000, .size = 4 * TEST_PAGE_SIZE, .readable = true, .writable = true },
+        { .start = 0x200000000 + 5 * TEST_PAGE_SIZE, .size = 5 * TEST_PAGE_SIZE, .readable = true, .writable = true },
+        { .start = 0x300000000, .size = 3 * TEST_PAGE_SIZE, .readable = true, .writable = true },
+    };
+    FakeDebugserverConfig config = { .mappings = mappings, .mappingCount = 3, .recordWrites = true };
+    RspMemoryRegion regions[] = {
+        { .start = 0x200000000, .size = 10 * TEST_PAGE_SIZE },
+        { .start = 0x300000000, .size = 3 * TEST_PAGE_SIZE },
+    };
+    RspPrepareStats stats = {0};
+    FakeDebugserverStats serverStats;
+    FakeWrite* writes = 0;
+    size_t writeCount = 0;
+    int ret = prepare(&config, regions, 2, &stats, &serverStats, &writes, &writeCount);
+    CHECK(ret == 0);
+    CHECK(regions[0].failedPage == 4);
+    CHECK(regions[0].error[0] == 'E');
+    CHECK(regions[1].failedPage == -1);
+    CHECK_EQ_U64(serverStats.memoryWriteCount, 13);
+    free(writes);
+}
+
+int main(void) {
+    test_touches_every_page(0);
+    // a shaped link exercises the window growing and refilling while replies trickle in
+    for(size_t i = 0; i < fakeLinkProfileCount; ++i) {
+        if(fakeLinkProfiles[i].link.roundTripMicros && fakeLinkProfiles[i].link.roundTripMicros <= 5000) {
+            test_touches_every_page(&fakeLinkProfiles[i].link);
+        }
+    }
+    test_refused_page();
+    return test_finish("test_prepare");
+}
@@ -0,0 +1,201 @@
+//
+//  test_prepared_pages.c
+//  StikJIT host tests
+//
+//  Prepared pages belong to the DebugSession: repeated prepares skip what the session already
+//  touched, and attaching, launching, detaching, killing, exiting, freeing memory or closing
+//  the session forget them.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "debug_session.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define TEST_PAGE_SIZE 0x4000ULL
+#define TEST_BASE 0x100000000ULL
+
+typedef struct TestConnection {
+    FakeMapping mapping;
+    FakeDebugserverConfig config;
+    FakeDebugserver* server;
+    DebugProxyHandle* debugProxy;
+} TestConnection;
+
+static void test_connect(TestConnection* connection) {
+    connection->mapping = (FakeMapping){ .start = TEST_BASE, .size = 64 * TEST_PAGE_SIZE, .readable = true, .writable = true };
+    connection->config = (FakeDebugserverConfig){ .mappings = &connection->mapping, .mappingCount = 1 };
+    connection->server = fake_debugserver_start(&connection->config, &connection->debugProxy);
+}
+
+static void test_disconnect(TestConnection* connection) {
+    debug_session_close(connection->debugProxy);
+    debug_proxy_free(connection->debugProxy);
+    fake_debugserver_stop(connection->server, 0, 0, 0);
+    fake_debugserver_free(connection->server);
+}
+
+// number of $M commands one prepare of [firstPage, firstPage + pageCount) sent
+static uint64_t test_prepare_pages(DebugProxyHandle* debugProxy, uint64_t firstPage, uint64_t pageCount, uint64_t pageSize, uint64_t* skippedOut) {
+    RspMemoryRegion region = { .start = TEST_BASE + firstPage * pageSize, .size = pageCount * pageSize };
+    RspPrepareStats stats = {0};
+    IdeviceFfiError* err = 0;
+    int ret = rsp_prepare_memory_regions(debugProxy, &region, 1, pageSize, &stats, &err);
+    idevice_error_free(err);
+    CHECK(ret == 0);
+    CHECK(region.failedPage == -1);
+    if(skippedOut) {
+        *skippedOut = stats.skippedCount;
+    }
+    return stats.commandCount;
+}
+
+static void test_skips_prepared_pages(void) {
+    TestConnection connection;
+    test_connect(&connection);
+    DebugSession* session = debug_session_open(connection.debugProxy);
+    uint64_t skipped = 0;
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 8, TEST_PAGE_SIZE, &skipped), 8);
+    CHECK_EQ_U64(skipped, 0);
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 8, TEST_PAGE_SIZE, &skipped), 0);
+    CHECK_EQ_U64(skipped, 8);
+    // overlapping on both sides: only the new pages are sent
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 4, 12, TEST_PAGE_SIZE, &skipped), 8);
+    CHECK_EQ_U64(skipped, 4);
+    CHECK_EQ_U64(session->preparedPages.skippedTotal, 12);
+    CHECK_EQ_U64(session->preparedPages.count, 1);
+    // counted in another page size, nothing is known
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 4, TEST_PAGE_SIZE / 4, &skipped), 4);
+    CHECK_EQ_U64(skipped, 0);
+    test_disconnect(&connection);
+}
+
+// without a session nothing is remembered
+static void test_without_session(void) {
+    TestConnection connection;
+    test_connect(&connection);
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 8, TEST_PAGE_SIZE, 0), 8);
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 8, TEST_PAGE_SIZE, 0), 8);
+    test_disconnect(&connection);
+}
+
+// commands that may put another process, or other mappings, behind the session
+static void test_commands_forget(void) {
+    const char* forgetting[] = { "vAttach;1f3", "vAttachWait;4170702e6170", "vAttachOrWait;4170702e6170", "vRun;2f62696e", "A8,0,2f62696e", "k", "vKill;1f3", "D", "D;1f3", "_m100004000" };
+    const char* keeping[] = { "c", "s", "vCont;c", "vCont?", "_M4000,rwx", "qMemoryRegionInfo:100000000", "Hg1234", "p20" };
+    TestConnection connection;
+    test_connect(&connection);
+    DebugSession* session = debug_session_open(connection.debugProxy);
+    for(size_t i = 0; i < sizeof(forgetting) / sizeof(forgetting[0]); ++i) {
+        test_prepare_pages(connection.debugProxy, 0, 4, TEST_PAGE_SIZE, 0);
+        debug_session_note_command(session, forgetting[i]);
+        if(session->preparedPages.count != 0) {
+            fprintf(stderr, "%s kept the prepared pages\n", forgetting[i]);
+            ++testFailureCount;
+        }
+    }
+    for(size_t i = 0; i < sizeof(keeping) / sizeof(keeping[0]); ++i) {
+        test_prepare_pages(connection.debugProxy, 0, 4, TEST_PAGE_SIZE, 0);
+        debug_session_note_command(session, keeping[i]);
+        if(session->preparedPages.count != 1) {
+            fprintf(stderr, "%s dropped the prepared pages\n", keeping[i]);
+            ++testFailureCount;
+        }
+    }
+    test_disconnect(&connection);
+}
+
+// an exit stop reply forgets them, a signal stop doesn't
+static void test_exit_forgets(void) {
+    const char* stops[] = { "T05thread:1f03;", "S11", "W00", "X09" };
+    const bool forgets[] = { false, false, true, true };
+    TestConnection connection;
+    test_connect(&connection);
+    DebugSession* session = debug_session_open(connection.debugProxy);
+    for(size_t i = 0; i < 4; ++i) {
+        test_prepare_pages(connection.debugProxy, 0, 4, TEST_PAGE_SIZE, 0);
+        debug_session_record_stop(session, stops[i], strlen(stops[i]));
+        CHECK_EQ_U64(session->preparedPages.count, forgets[i] ? 0 : 1);
+    }
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 4, TEST_PAGE_SIZE, 0), 4);
+    test_disconnect(&connection);
+}
+
+// the next session on a connection, e.g. for the next launch, starts empty
+static void test_new_session_starts_empty(void) {
+    TestConnection connection;
+    test_connect(&connection);
+    debug_session_open(connection.debugProxy);
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 4, TEST_PAGE_SIZE, 0), 4);
+    debug_session_close(connection.debugProxy);
+    debug_session_open(connection.debugProxy);
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 4, TEST_PAGE_SIZE, 0), 4);
+    CHECK_EQ_U64(test_prepare_pages(connection.debugProxy, 0, 4, TEST_PAGE_SIZE, 0), 0);
+    test_disconnect(&connection);
+}
+
+// pages past a refused page aren't remembered, so the next prepare retries them
+static void test_refused_page_not_remembered(void) {
+    FakeMapping mappings[] = {
+        { .start = TEST_BASE, .size = 2 * TEST_PAGE_SIZE, .readable = true, .writable = true },
+        { .start = TEST_BASE + 3 * TEST_PAGE_SIZE, .size = 2 * TEST_PAGE_SIZE, .readable = true, .writable = true },
+    };
+    FakeDebugserverConfig config = { .mappings = mappings, .mappingCount = 2 };
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    debug_session_open(debugProxy);
+    for(int attempt = 0; attempt < 2; ++attempt) {
+        RspMemoryRegion region = { .start = TEST_BASE, .size = 5 * TEST_PAGE_SIZE };
+        RspPrepareStats stats = {0};
+        IdeviceFfiError* err = 0;
+        CHECK(rsp_prepare_memory_regions(debugProxy, &region, 1, TEST_PAGE_SIZE, &stats, &err) == 0);
+        idevice_error_free(err);
+        CHECK(region.failedPage == 2);
+        CHECK_EQ_U64(stats.commandCount, attempt == 0 ? 5 : 3);
+    }
+    debug_session_close(debugProxy);
+    debug_proxy_free(debugProxy);
+    fake_debugserver_stop(server, 0, 0, 0);
+    fake_debugserver_free(server);
+}
+
+// gaps and merging of the range set itself
+static void test_range_set(void) {
+    PreparedPages pages = {0};
+    prepared_pages_add(&pages, TEST_PAGE_SIZE, 10, 20);
+    prepared_pages_add(&pages, TEST_PAGE_SIZE, 30, 40);
+    prepared_pages_add(&pages, TEST_PAGE_SIZE, 20, 25);
+    CHECK_EQ_U64(pages.count, 2);
+    PageRange* gaps = 0;
+    size_t gapCount = 0;
+    size_t gapCapacity = 0;
+    CHECK_EQ_U64(prepared_pages_missing(&pages, TEST_PAGE_SIZE, 0, 50, &gaps, &gapCount, &gapCapacity), 25);
+    CHECK_EQ_U64(gapCount, 3);
+    if(gapCount == 3) {
+        CHECK_EQ_U64(gaps[0].start, 0);
+        CHECK_EQ_U64(gaps[0].end, 10);
+        CHECK_EQ_U64(gaps[1].start, 25);
+        CHECK_EQ_U64(gaps[1].end, 30);
+        CHECK_EQ_U64(gaps[2].start, 40);
+        CHECK_EQ_U64(gaps[2].end, 50);
+    }
+    prepared_pages_add(&pages, TEST_PAGE_SIZE, 0, 50);
+    CHECK_EQ_U64(pages.count, 1);
+    free(gaps);
+    prepared_pages_clear(&pages);
+    CHECK_EQ_U64(pages.count, 0);
+    CHECK(pages.ranges == 0);
+}
+
+int main(void) {
+    test_range_set();
+    test_skips_prepared_pages();
+    test_without_session();
+    test_commands_forget();
+    test_exit_forgets();
+    test_new_session_starts_empty();
+    test_refused_page_not_remembered();
+    return test_finish("test_prepared_pages");
+}
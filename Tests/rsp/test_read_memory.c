@@ -0,0 +1,176 @@
+//
+//  test_read_memory.c
+//  StikJIT host tests
+//
+//  rsp_read_memory against the fake debugserver: reads longer than PacketSize are split into
+//  pipelined m packets and handed to the sink in order, a read running into an unreadable gap
+//  stops at its first byte, and the connection stays usable after a read ends early.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "debug_session.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define TEST_BASE 0x100000000ULL
+#define TEST_PACKET_SIZE 0x200
+
+typedef struct TestSink {
+    uint8_t* out;
+    uint64_t capacity;
+    // offset the next call must start at, the sink gets the data in order and without gaps
+    uint64_t nextOffset;
+    uint64_t callCount;
+    bool outOfOrder;
+    // abort after this many calls, 0 for never
+    uint64_t abortAfter;
+} TestSink;
+
+static bool test_sink(void* userData, uint64_t offset, const uint8_t* data, size_t length) {
+    TestSink* sink = userData;
+    if(offset != sink->nextOffset || offset + length > sink->capacity) {
+        sink->outOfOrder = true;
+        return false;
+    }
+    memcpy(sink->out + offset, data, length);
+    sink->nextOffset += length;
+    ++sink->callCount;
+    return sink->abortAfter == 0 || sink->callCount < sink->abortAfter;
+}
+
+static uint8_t* test_pattern(size_t length, uint32_t seed) {
+    uint8_t* data = malloc(length);
+    for(size_t i = 0; i < length; ++i) {
+        seed = seed * 1103515245 + 12345;
+        // runs of equal bytes so run-length encoded replies have something to compress
+        data[i] = (seed >> 28) < 4 ? 0 : (uint8_t)(seed >> 16);
+    }
+    return data;
+}
+
+static int test_read(DebugProxyHandle* debugProxy, uint64_t addr, uint64_t length, TestSink* sink, uint8_t* out, RspReadResult* result) {
+    memset(sink, 0, sizeof(TestSink));
+    sink->out = out;
+    sink->capacity = length;
+    IdeviceFfiError* err = 0;
+    int ret = rsp_read_memory(debugProxy, addr, length, test_sink, sink, result, &err);
+    CHECK(err == 0);
+    idevice_error_free(err);
+    CHECK(!sink->outOfOrder);
+    return ret;
+}
+
+// a read many packets long comes back whole, with and without run-length encoded replies
+static void test_long_read(bool runLengthEncode, const FakeLink* link) {
+    size_t length = 0x10000;
+    uint8_t* memory = test_pattern(length, 5);
+    FakeMapping mapping = { .start = TEST_BASE, .size = length, .bytes = memory, .readable = true, .writable = true };
+    FakeDebugserverConfig config = { .packetSize = TEST_PACKET_SIZE, .runLengthEncode = runLengthEncode, .mappings = &mapping, .mappingCount = 1 };
+    if(link) {
+        config.link = *link;
+    }
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    DebugSession* session = debug_session_open(debugProxy);
+    IdeviceFfiError* err = debug_session_negotiate(session);
+    CHECK(err == 0);
+    uint64_t chunk = debug_session_max_hex_payload(session);
+    CHECK(chunk < TEST_PACKET_SIZE / 2);
+
+    uint8_t* out = malloc(length);
+    TestSink sink;
+    RspReadResult result;
+    int ret = test_read(debugProxy, TEST_BASE + 1, length - 1, &sink, out, &result);
+    CHECK(ret == 0);
+    CHECK(result.failedOffset == -1);
+    CHECK_EQ_U64(result.bytesRead, length - 1);
+    CHECK_EQ_U64(result.packetCount, (length - 1 + chunk - 1) / chunk);
+    CHECK(memcmp(out, memory + 1, length - 1) == 0);
+
+    debug_session_close(debugProxy);
+    debug_proxy_free(debugProxy);
+    FakeDebugserverStats serverStats;
+    fake_debugserver_stop(server, &serverStats, 0, 0);
+    CHECK_EQ_U64(serverStats.badChecksumCount, 0);
+    CHECK(serverStats.maxPacketLength <= TEST_PACKET_SIZE);
+    fake_debugserver_free(server);
+    free(out);
+    free(memory);
+}
+
+// reads running into, starting in and aborted before an unreadable gap, each followed by a read
+// that only succeeds if the replies of the first one were all consumed
+static void test_gap(void) {
+    uint8_t* first = test_pattern(0x3000, 1);
+    uint8_t* second = test_pattern(0x2000, 2);
+    FakeMapping mappings[] = {
+        { .start = TEST_BASE, .size = 0x3000, .bytes = first, .readable = true, .writable = true },
+        { .start = TEST_BASE + 0x5000, .size = 0x2000, .bytes = second, .readable = true, .writable = true },
+    };
+    FakeDebugserverConfig config = { .packetSize = TEST_PACKET_SIZE, .mappings = mappings, .mappingCount = 2 };
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    DebugSession* session = debug_session_open(debugProxy);
+    IdeviceFfiError* err = debug_session_negotiate(session);
+    CHECK(err == 0);
+
+    uint8_t* out = malloc(0x7000);
+    TestSink sink;
+    RspReadResult result;
+    // the reply crossing into the gap is cut short, the reads behind it are refused
+    int ret = test_read(debugProxy, TEST_BASE + 0x100, 0x6f00, &sink, out, &result);
+    CHECK(ret == -3);
+    CHECK_EQ_U64(result.failedOffset, 0x2f00);
+    CHECK_EQ_U64(result.bytesRead, 0x2f00);
+    CHECK(memcmp(out, first + 0x100, 0x2f00) == 0);
+
+    ret = test_read(debugProxy, TEST_BASE + 0x5000, 0x2000, &sink, out, &result);
+    CHECK(ret == 0);
+    CHECK(memcmp(out, second, 0x2000) == 0);
+
+    ret = test_read(debugProxy, TEST_BASE + 0x4000, 0x2000, &sink, out, &result);
+    CHECK(ret == -3);
+    CHECK_EQ_U64(result.failedOffset, 0);
+    CHECK_EQ_U64(result.bytesRead, 0);
+    CHECK(strcmp(result.error, "E08") == 0);
+    CHECK_EQ_U64(sink.callCount, 0);
+
+    ret = test_read(debugProxy, TEST_BASE + 0x6000, 0x1000, &sink, out, &result);
+    CHECK(ret == 0);
+    CHECK(memcmp(out, second + 0x1000, 0x1000) == 0);
+
+    // the sink gives up while reads are still in flight
+    memset(&sink, 0, sizeof(sink));
+    sink.out = out;
+    sink.capacity = 0x3000;
+    sink.abortAfter = 2;
+    ret = rsp_read_memory(debugProxy, TEST_BASE, 0x3000, test_sink, &sink, &result, &err);
+    CHECK(ret == -4);
+    CHECK_EQ_U64(sink.callCount, 2);
+
+    ret = test_read(debugProxy, TEST_BASE, 0x3000, &sink, out, &result);
+    CHECK(ret == 0);
+    CHECK(memcmp(out, first, 0x3000) == 0);
+
+    debug_session_close(debugProxy);
+    debug_proxy_free(debugProxy);
+    fake_debugserver_stop(server, 0, 0, 0);
+    fake_debugserver_free(server);
+    free(out);
+    free(second);
+    free(first);
+}
+
+int main(void) {
+    test_long_read(false, 0);
+    test_long_read(true, 0);
+    for(size_t i = 0; i < fakeLinkProfileCount; ++i) {
+        if(fakeLinkProfiles[i].link.roundTripMicros && fakeLinkProfiles[i].link.roundTripMicros <= 5000) {
+            test_long_read(true, &fakeLinkProfiles[i].link);
+        }
+    }
+    test_gap();
+    return test_finish("test_read_memory");
+}
@@ -0,0 +1,163 @@
+//
+//  test_region_map.c
+//  StikJIT host tests
+//
+//  region_map_scan against the fake debugserver: a walk to the top of the address space maps
+//  every region with permissions, and a walk cut short by the query limit or an error reply
+//  partway is marked truncated and not valid. The session keeps a full walk, which ends at
+//  debugserver's last gap reaching ~0, and only walks again once the mappings may have changed.
+//
+
+#include <stdlib.h>
+
+#include "region_map.h"
+#include "debug_session.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+static int scan(FakeDebugserverConfig* config, RegionMap* map, FakeDebugserverStats* serverStats) {
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(config, &debugProxy);
+    IdeviceFfiError* err = 0;
+    int ret = region_map_scan(debugProxy, map, &err);
+    CHECK(err == 0);
+    idevice_error_free(err);
+    debug_proxy_free(debugProxy);
+    fake_debugserver_stop(server, serverStats, 0, 0);
+    fake_debugserver_free(server);
+    return ret;
+}
+
+static void test_full_walk(void) {
+    FakeMapping mappings[] = {
+        { .start = 0x100000000, .size = 0x4000, .readable = true },
+        { .start = 0x100004000, .size = 0x8000, .readable = true, .writable = true },
+        // reserved without access, left out of the map
+        { .start = 0x200000000, .size = 0x1000 },
+        { .start = 0x300000000, .size = 0x10000, .writable = true },
+    };
+    FakeDebugserverConfig config = { .mappings = mappings, .mappingCount = 4 };
+    RegionMap map = {0};
+    FakeDebugserverStats serverStats;
+    int ret = scan(&config, &map, &serverStats);
+    CHECK(ret == 0);
+    CHECK(map.valid);
+    CHECK(!map.truncated);
+    // the gap below each mapping that doesn't follow another one, the four mappings, the gap to the top
+    CHECK_EQ_U64(map.queryCount, 3 + 4 + 1);
+    CHECK_EQ_U64(serverStats.regionInfoCount, map.queryCount);
+    CHECK_EQ_U64(map.count, 3);
+    CHECK_EQ_U64(map.regions[0].start, 0x100000000);
+    CHECK_EQ_U64(map.regions[0].permissions, MAPPED_REGION_READ);
+    CHECK_EQ_U64(map.regions[1].start, 0x100004000);
+    CHECK_EQ_U64(map.regions[1].permissions, MAPPED_REGION_READ | MAPPED_REGION_WRITE);
+    CHECK_EQ_U64(map.regions[2].start, 0x300000000);
+    CHECK_EQ_U64(map.regions[2].permissions, MAPPED_REGION_WRITE);
+
+    CHECK(region_map_lookup(&map, 0x100000000) == &map.regions[0]);
+    CHECK(region_map_lookup(&map, 0x100004000) == &map.regions[1]);
+    CHECK(region_map_lookup(&map, 0x10000bfff) == &map.regions[1]);
+    CHECK(region_map_lookup(&map, 0x10000c000) == 0);
+    CHECK(region_map_lookup(&map, 0x200000000) == 0);
+    CHECK(region_map_lookup(&map, 0x30000ffff) == &map.regions[2]);
+    CHECK(region_map_lookup(&map, 0xffffffffffffffff) == 0);
+    CHECK(region_map_lookup(&map, 0) == 0);
+    region_map_free(&map);
+}
+
+// a walk that never reaches the top stops at the query limit, with what it found so far
+static void test_endless_walk(void) {
+    FakeDebugserverConfig config = { .endlessRegions = true };
+    RegionMap map = {0};
+    FakeDebugserverStats serverStats;
+    int ret = scan(&config, &map, &serverStats);
+    CHECK(ret == 0);
+    CHECK(map.truncated);
+    CHECK(!map.valid);
+    CHECK_EQ_U64(map.queryCount, serverStats.regionInfoCount);
+    CHECK_EQ_U64(map.count, map.queryCount);
+    CHECK_EQ_U64(map.regions[map.count - 1].start, (map.count - 1) * 0x1000);
+    region_map_free(&map);
+}
+
+static void test_error_partway(void) {
+    FakeMapping mappings[] = {
+        { .start = 0x100000000, .size = 0x4000, .readable = true },
+        { .start = 0x200000000, .size = 0x4000, .readable = true },
+    };
+    FakeDebugserverConfig config = { .mappings = mappings, .mappingCount = 2, .regionInfoFailAt = 3 };
+    RegionMap map = {0};
+    int ret = scan(&config, &map, 0);
+    CHECK(ret == 0);
+    CHECK(map.truncated);
+    CHECK(!map.valid);
+    CHECK_EQ_U64(map.count, 1);
+    CHECK_EQ_U64(map.queryCount, 3);
+
+    // an error on the first query means no support, not a truncated map
+    config.regionInfoFailAt = 1;
+    ret = scan(&config, &map, 0);
+    CHECK(ret == -3);
+    CHECK(!map.truncated);
+    CHECK(!map.valid);
+    CHECK_EQ_U64(map.count, 0);
+
+    // a later full walk clears the flag
+    config.regionInfoFailAt = 0;
+    ret = scan(&config, &map, 0);
+    CHECK(ret == 0);
+    CHECK(!map.truncated);
+    CHECK(map.valid);
+    CHECK_EQ_U64(map.count, 2);
+    region_map_free(&map);
+}
+
+// the gap to the top ends at ~0 like debugserver's, the walk stops there with a valid map that
+// later lookups reuse without another qMemoryRegionInfo
+static void test_session_cache(void) {
+    FakeMapping mappings[] = {
+        { .start = 0x100000000, .size = 0x4000, .readable = true },
+        { .start = 0xfffffff000000000, .size = 0x4000, .readable = true, .writable = true },
+    };
+    FakeDebugserverConfig config = { .mappings = mappings, .mappingCount = 2 };
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    DebugSession* session = debug_session_open(debugProxy);
+    const RegionMap* map = 0;
+    IdeviceFfiError* err = 0;
+    int ret = debug_session_region_map(session, false, &map, &err);
+    CHECK(ret == 0);
+    CHECK(err == 0);
+    CHECK(map == &session->regions);
+    CHECK(map->valid);
+    CHECK(!map->truncated);
+    CHECK_EQ_U64(map->count, 2);
+    CHECK_EQ_U64(map->queryCount, 2 + 2 + 1);
+    uint64_t walkQueries = map->queryCount;
+
+    ret = debug_session_region_map(session, false, &map, &err);
+    CHECK(ret == 0);
+    CHECK(region_map_lookup(map, 0xfffffff000003fff) == &map->regions[1]);
+    // a resume may change the mappings, the next lookup walks again
+    debug_session_note_command(session, "c");
+    ret = debug_session_region_map(session, false, &map, &err);
+    CHECK(ret == 0);
+    CHECK(map->valid);
+    ret = debug_session_region_map(session, false, &map, &err);
+    CHECK(ret == 0);
+
+    debug_session_close(debugProxy);
+    debug_proxy_free(debugProxy);
+    FakeDebugserverStats serverStats;
+    fake_debugserver_stop(server, &serverStats, 0, 0);
+    fake_debugserver_free(server);
+    CHECK_EQ_U64(serverStats.regionInfoCount, 2 * walkQueries);
+}
+
+int main(void) {
+    test_full_walk();
+    test_endless_walk();
+    test_error_partway();
+    test_session_cache();
+    return test_finish("test_region_map");
+}
@@ -0,0 +1,48 @@
+//
+//  test_util.h
+//  StikJIT host tests
+//
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+#include <stdio.h>
+#include <string.h>
+
+static int testFailureCount = 0;
+
+#define CHECK(condition) do { \
+    if(!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        ++testFailureCount; \
+    } \
+} while(0)
+
+#define CHECK_EQ_U64(actual, expected) do { \
+    unsigned long long actualValue = (unsigned long long)(actual); \
+    unsigned long long expectedValue = (unsigned long long)(expected); \
+    if(actualValue != expectedValue) { \
+        fprintf(stderr, "%s:%d: %s is 0x%llx, expected 0x%llx\n", __FILE__, __LINE__, #actual, actualValue, expectedValue); \
+        ++testFailureCount; \
+    } \
+} while(0)
+
+// benchmarks run a small configuration under ctest and the full one when started by hand
+static inline int test_is_quick(int argc, char** argv) {
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--quick") == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline int test_finish(const char* name) {
+    if(testFailureCount) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, testFailureCount);
+        return 1;
+    }
+    printf("%s: all checks passed\n", name);
+    return 0;
+}
+
+#endif /* TEST_UTIL_H */
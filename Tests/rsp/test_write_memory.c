@@ -0,0 +1,179 @@
+//
+//  test_write_memory.c
+//  StikJIT host tests
+//
+//  rsp_write_memory against the fake debugserver: binary X packets carry every byte value,
+//  the characters that need escaping included, an empty reply to X falls back to hex M
+//  packets, and a refused write is reported without leaving replies on the connection.
+//
+
+#include <stdlib.h>
+
+#include "rsp.h"
+#include "debug_session.h"
+#include "fake_debugserver.h"
+#include "test_util.h"
+
+#define TEST_BASE 0x100000000ULL
+#define TEST_MAPPING_SIZE 0x40000
+// small enough that a write spans many packets and fills the window several times
+#define TEST_PACKET_SIZE 0x200
+
+static uint8_t* test_pattern(size_t length, uint32_t seed) {
+    uint8_t* data = malloc(length);
+    for(size_t i = 0; i < length; ++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    return data;
+}
+
+// data made mostly of the bytes X packets have to escape, so packets shrink and their count grows
+static uint8_t* test_escape_heavy(size_t length) {
+    static const uint8_t escaped[] = { '#', '$', '}', '*' };
+    uint8_t* data = test_pattern(length, 7);
+    for(size_t i = 0; i < length; ++i) {
+        if(data[i] & 1) {
+            data[i] = escaped[(data[i] >> 1) & 3];
+        }
+    }
+    return data;
+}
+
+static void test_round_trip(const uint8_t* data, size_t length, bool binaryWrite, const FakeLink* link) {
+    uint8_t* memory = calloc(1, TEST_MAPPING_SIZE);
+    FakeMapping mapping = { .start = TEST_BASE, .size = TEST_MAPPING_SIZE, .bytes = memory, .readable = true, .writable = true };
+    FakeDebugserverConfig config = { .packetSize = TEST_PACKET_SIZE, .binaryWrite = binaryWrite, .mappings = &mapping, .mappingCount = 1, .recordWrites = true };
+    if(link) {
+        config.link = *link;
+    }
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    DebugSession* session = debug_session_open(debugProxy);
+    IdeviceFfiError* err = debug_session_negotiate(session);
+    CHECK(err == 0);
+    CHECK_EQ_U64(session->packetSize, TEST_PACKET_SIZE);
+
+    RspWriteResult result;
+    int ret = rsp_write_memory(debugProxy, TEST_BASE + 3, data, length, true, &result, &err);
+    CHECK(ret == 0);
+    CHECK(result.binary == binaryWrite);
+    CHECK(result.failedOffset == -1);
+    CHECK(session->binaryWrite == (binaryWrite ? 1 : 0));
+    CHECK(memcmp(memory + 3, data, length) == 0);
+
+    // the probe isn't repeated once the session knows the answer
+    ret = rsp_write_memory(debugProxy, TEST_BASE, data, 16, true, &result, &err);
+    CHECK(ret == 0);
+    CHECK(result.binary == binaryWrite);
+    CHECK_EQ_U64(result.packetCount, 1);
+
+    debug_session_close(debugProxy);
+    debug_proxy_free(debugProxy);
+    FakeDebugserverStats serverStats;
+    const FakeWrite* writes = 0;
+    size_t writeCount = 0;
+    fake_debugserver_stop(server, &serverStats, &writes, &writeCount);
+    CHECK_EQ_U64(serverStats.badChecksumCount, 0);
+    CHECK_EQ_U64(serverStats.badLengthCount, 0);
+    CHECK(serverStats.maxPacketLength <= TEST_PACKET_SIZE);
+
+    // writes cover the data exactly once in order, the rejected X probe never reached memory
+    CHECK(writeCount > 2);
+    uint64_t next = TEST_BASE + 3;
+    for(size_t i = 0; i + 1 < writeCount; ++i) {
+        CHECK(writes[i].binary == binaryWrite);
+        CHECK_EQ_U64(writes[i].addr, next);
+        next += writes[i].length;
+    }
+    CHECK_EQ_U64(next, TEST_BASE + 3 + length);
+    fake_debugserver_free(server);
+    free(memory);
+}
+
+// without a session X is tried first on every write
+static void test_no_session(void) {
+    uint8_t memory[64] = {0};
+    FakeMapping mapping = { .start = TEST_BASE, .size = sizeof(memory), .bytes = memory, .readable = true, .writable = true };
+    FakeDebugserverConfig config = { .mappings = &mapping, .mappingCount = 1 };
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    const uint8_t data[] = { '#', '$', '}', '*', 0, 0xff };
+    RspWriteResult result;
+    IdeviceFfiError* err = 0;
+    for(int i = 0; i < 2; ++i) {
+        int ret = rsp_write_memory(debugProxy, TEST_BASE + 8, data, sizeof(data), true, &result, &err);
+        CHECK(ret == 0);
+        CHECK(!result.binary);
+        CHECK_EQ_U64(result.packetCount, 2);
+    }
+    // hex only when binary isn't allowed
+    int ret = rsp_write_memory(debugProxy, TEST_BASE + 16, data, sizeof(data), false, &result, &err);
+    CHECK(ret == 0);
+    CHECK_EQ_U64(result.packetCount, 1);
+    CHECK(memcmp(memory + 8, data, sizeof(data)) == 0);
+    CHECK(memcmp(memory + 16, data, sizeof(data)) == 0);
+    debug_proxy_free(debugProxy);
+    FakeDebugserverStats serverStats;
+    fake_debugserver_stop(server, &serverStats, 0, 0);
+    CHECK_EQ_U64(serverStats.memoryWriteCount, 3);
+    fake_debugserver_free(server);
+}
+
+// a write running off the end of the mapping is refused at the packet that crosses it, the
+// packets already in flight behind it are answered and the connection stays usable
+static void test_refused(bool binaryWrite) {
+    uint8_t* memory = calloc(1, TEST_MAPPING_SIZE);
+    FakeMapping mapping = { .start = TEST_BASE, .size = TEST_MAPPING_SIZE, .bytes = memory, .readable = true, .writable = true };
+    FakeDebugserverConfig config = { .packetSize = TEST_PACKET_SIZE, .binaryWrite = binaryWrite, .mappings = &mapping, .mappingCount = 1 };
+    DebugProxyHandle* debugProxy = 0;
+    FakeDebugserver* server = fake_debugserver_start(&config, &debugProxy);
+    DebugSession* session = debug_session_open(debugProxy);
+    IdeviceFfiError* err = debug_session_negotiate(session);
+    CHECK(err == 0);
+
+    size_t length = 0x8000;
+    uint8_t* data = test_pattern(length, 3);
+    uint64_t addr = TEST_BASE + TEST_MAPPING_SIZE - 0x4000;
+    RspWriteResult result;
+    int ret = rsp_write_memory(debugProxy, addr, data, length, true, &result, &err);
+    CHECK(ret == -3);
+    CHECK(result.error[0] == 'E');
+    CHECK(result.failedOffset >= 0 && result.failedOffset < 0x4000);
+    CHECK(result.failedOffset > 0x4000 - 2 * TEST_PACKET_SIZE);
+    CHECK(memcmp(memory + TEST_MAPPING_SIZE - 0x4000, data, (size_t)result.failedOffset) == 0);
+
+    ret = rsp_write_memory(debugProxy, TEST_BASE, data, 0x1000, true, &result, &err);
+    CHECK(ret == 0);
+    CHECK(result.failedOffset == -1);
+    CHECK(memcmp(memory, data, 0x1000) == 0);
+
+    debug_session_close(debugProxy);
+    debug_proxy_free(debugProxy);
+    fake_debugserver_stop(server, 0, 0, 0);
+    fake_debugserver_free(server);
+    free(data);
+    free(memory);
+}
+
+int main(void) {
+    size_t length = 0x10000;
+    uint8_t* random = test_pattern(length, 1);
+    uint8_t* escapes = test_escape_heavy(length);
+    test_round_trip(random, length, true, 0);
+    test_round_trip(escapes, length, true, 0);
+    test_round_trip(random, length, false, 0);
+    test_round_trip(escapes, length, false, 0);
+    // replies trickling in over a shaped link refill the window one at a time
+    for(size_t i = 0; i < fakeLinkProfileCount; ++i) {
+        if(fakeLinkProfiles[i].link.roundTripMicros && fakeLinkProfiles[i].link.roundTripMicros <= 5000) {
+            test_round_trip(escapes, 0x4000, true, &fakeLinkProfiles[i].link);
+        }
+    }
+    test_no_session();
+    test_refused(true);
+    test_refused(false);
+    free(random);
+    free(escapes);
+    return test_finish("test_write_memory");
+}